@@ -0,0 +1,185 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Measures what the colour lookup table costs on the GPU. A full screen
+// IMX6Camera item is rendered with the table alternately off and on, and every
+// frame is timed from beforeRendering to afterRendering with glFinish() on both
+// ends, so the numbers are GPU time for the video quad alone.
+//
+// usage: imx6camera-render-bench [table.cube] [seconds per phase] [phases]
+//
+// Without a table an identity table of 33 entries per axis is used, the cost
+// does not depend on the contents. QML2_IMPORT_PATH must contain the installed
+// IMX6Camera module and a camera must be delivering frames.
+
+#include <QAtomicInt>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QMutex>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QQmlComponent>
+#include <QQmlEngine>
+#include <QQuickItem>
+#include <QQuickWindow>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#define WARMUP_FRAMES 10    // Dropped at the start of each phase: shader compile and table upload
+
+static bool writeIdentityTable(QFile *file, int size)
+{
+    QTextStream stream(file);
+    stream << "LUT_3D_SIZE " << size << "\n";
+    for (int b = 0; b < size; ++b)
+        for (int g = 0; g < size; ++g)
+            for (int r = 0; r < size; ++r)
+                stream << r / double(size - 1) << ' ' << g / double(size - 1) << ' ' << b / double(size - 1) << "\n";
+    stream.flush();
+    return stream.status() == QTextStream::Ok;
+}
+
+static void report(const char *name, QVector<double> samples)
+{
+    if (samples.isEmpty()) {
+        printf("%-5s no frames rendered\n", name);
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (int i = 0; i < samples.size(); ++i)
+        sum += samples.at(i);
+    printf("%-5s %6d frames, %.3f ms mean, %.3f ms median, %.3f ms p95\n", name, samples.size(),
+           sum / samples.size() / 1000.0, samples.at(samples.size() / 2) / 1000.0,
+           samples.at(samples.size() * 95 / 100) / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+    const QStringList arguments = app.arguments();
+    const int seconds = arguments.size() > 2 ? arguments.at(2).toInt() : 5;
+    const int phaseCount = arguments.size() > 3 ? arguments.at(3).toInt() : 6;
+
+    QTemporaryFile identityTable(QDir::tempPath() + QStringLiteral("/identity-XXXXXX.cube"));
+    QUrl table;
+    if (arguments.size() > 1) {
+        table = QUrl::fromLocalFile(QFileInfo(arguments.at(1)).absoluteFilePath());
+    } else {
+        if (!identityTable.open() || !writeIdentityTable(&identityTable, 33)) {
+            fprintf(stderr, "Could not write an identity table\n");
+            return 1;
+        }
+        identityTable.close();
+        table = QUrl::fromLocalFile(QFileInfo(identityTable.fileName()).absoluteFilePath());
+    }
+
+    QQuickWindow window;
+    QQmlEngine engine;
+    QQmlComponent component(&engine);
+    component.setData("import IMX6Camera 1.0\nIMX6Camera {}\n", QUrl());
+    QQuickItem *camera = qobject_cast<QQuickItem *>(component.create());
+    if (!camera) {
+        fprintf(stderr, "%s\n", qPrintable(component.errorString()));
+        return 1;
+    }
+    camera->setParentItem(window.contentItem());
+    QObject::connect(&window, &QWindow::widthChanged, camera, &QQuickItem::setWidth);
+    QObject::connect(&window, &QWindow::heightChanged, camera, &QQuickItem::setHeight);
+
+    // Phases alternate off, on, off, ... The GUI thread switches them and the
+    // render thread picks the switch up when it synchronizes, so every sample
+    // is filed under the phase its frame was actually rendered with.
+    QAtomicInt guiPhase(0);
+    int renderPhase = 0;
+    QElapsedTimer frameTimer;
+    QMutex samplesMutex;
+    QVector<QVector<double> > samples(phaseCount);
+
+    QObject::connect(&window, &QQuickWindow::afterSynchronizing, [&]() {
+        renderPhase = guiPhase.load();
+    });
+    QObject::connect(&window, &QQuickWindow::beforeRendering, [&]() {
+        QOpenGLContext::currentContext()->functions()->glFinish();
+        frameTimer.start();
+    });
+    QObject::connect(&window, &QQuickWindow::afterRendering, [&]() {
+        QOpenGLContext::currentContext()->functions()->glFinish();
+        const double elapsed = frameTimer.nsecsElapsed() / 1000.0;
+        QMutexLocker lock(&samplesMutex);
+        if (renderPhase < samples.size())
+            samples[renderPhase].append(elapsed);
+    });
+
+    QTimer phaseTimer;
+    phaseTimer.setInterval(seconds * 1000);
+    QObject::connect(&phaseTimer, &QTimer::timeout, [&]() {
+        const int next = guiPhase.load() + 1;
+        guiPhase.store(next);
+        if (next >= phaseCount) {
+            app.quit();
+            return;
+        }
+        camera->setProperty("lookupTable", next % 2 ? table : QUrl());
+        if (next % 2 && camera->property("lookupTableSize").toInt() == 0) {
+            fprintf(stderr, "Could not load %s\n", qPrintable(table.toLocalFile()));
+            app.exit(1);
+        }
+    });
+
+    window.showFullScreen();
+    phaseTimer.start();
+    const int result = app.exec();
+    window.hide();
+    if (result)
+        return result;
+
+    QMutexLocker lock(&samplesMutex);
+    QVector<double> off;
+    QVector<double> on;
+    for (int phase = 0; phase < samples.size(); ++phase) {
+        const QVector<double> &phaseSamples = samples.at(phase);
+        if (phaseSamples.size() > WARMUP_FRAMES)
+            (phase % 2 ? on : off) += phaseSamples.mid(WARMUP_FRAMES);
+    }
+    printf("%dx%d, %d phases of %d s\n", window.width(), window.height(), phaseCount, seconds);
+    report("off", off);
+    report("on", on);
+    return 0;
+}
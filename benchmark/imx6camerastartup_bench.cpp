@@ -0,0 +1,125 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Measures what the camera costs an application at startup. One IMX6Camera
+// item is created in a window and the bench reports how long the GUI thread
+// took to create it and show the first frame, the longest time the GUI thread
+// did not get to run its event loop, and when the camera delivered its first
+// frame. Run it with and without a camera attached: the GUI numbers should not
+// depend on the device.
+//
+// usage: imx6camera-startup-bench [seconds]
+//
+// QML2_IMPORT_PATH must contain the installed IMX6Camera module.
+
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QQmlComponent>
+#include <QQmlEngine>
+#include <QQuickItem>
+#include <QQuickWindow>
+#include <QTimer>
+
+#include <cstdio>
+
+#define STALL_PROBE_INTERVAL 1  // Milliseconds, anything well above this is the GUI thread being busy
+
+static void report(const char *name, qint64 nsecs)
+{
+    if (nsecs < 0)
+        printf("%-20s never\n", name);
+    else
+        printf("%-20s %8.1f ms\n", name, nsecs / 1000000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    QElapsedTimer clock;
+    clock.start();
+    QGuiApplication app(argc, argv);
+    const QStringList arguments = app.arguments();
+    const int seconds = arguments.size() > 1 ? arguments.at(1).toInt() : 5;
+
+    qint64 created = -1;
+    qint64 firstSwap = -1;
+    qint64 connected = -1;
+    qint64 firstFrame = -1;
+    qint64 longestStall = 0;
+
+    QQuickWindow window;
+    QQmlEngine engine;
+    QQmlComponent component(&engine);
+    component.setData("import IMX6Camera 1.0\nIMX6Camera {}\n", QUrl());
+    QQuickItem *camera = qobject_cast<QQuickItem *>(component.create());
+    if (!camera) {
+        fprintf(stderr, "%s\n", qPrintable(component.errorString()));
+        return 1;
+    }
+    created = clock.nsecsElapsed();
+    camera->setParentItem(window.contentItem());
+    QObject::connect(&window, &QWindow::widthChanged, camera, &QQuickItem::setWidth);
+    QObject::connect(&window, &QWindow::heightChanged, camera, &QQuickItem::setHeight);
+
+    // Swaps happen on the render thread, the time is taken there
+    QObject::connect(&window, &QQuickWindow::frameSwapped, &window, [&]() {
+        if (firstSwap < 0)
+            firstSwap = clock.nsecsElapsed();
+    }, Qt::DirectConnection);
+
+    // The probe runs as often as the event loop lets it, the gaps are the stalls
+    QElapsedTimer sinceProbe;
+    QTimer probe;
+    probe.setInterval(STALL_PROBE_INTERVAL);
+    QObject::connect(&probe, &QTimer::timeout, &probe, [&]() {
+        if (sinceProbe.isValid())
+            longestStall = qMax(longestStall, sinceProbe.nsecsElapsed());
+        sinceProbe.start();
+
+        if (connected < 0 && camera->property("isCameraConnected").toBool())
+            connected = clock.nsecsElapsed();
+        if (firstFrame < 0 && camera->property("renderedFrames").toInt() > 0)
+            firstFrame = clock.nsecsElapsed();
+    });
+
+    window.showFullScreen();
+    probe.start();
+    QTimer::singleShot(seconds * 1000, &app, &QCoreApplication::quit);
+    app.exec();
+    window.hide();
+
+    printf("%dx%d, %d s\n", window.width(), window.height(), seconds);
+    report("item created", created);
+    report("first swap", firstSwap);
+    report("camera connected", connected);
+    report("first camera frame", firstFrame);
+    report("longest GUI stall", longestStall);
+    return 0;
+}
@@ -0,0 +1,278 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6camerareader.h"
+
+#include <linux/futex.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+// dmabuf CPU access brackets, older kernel headers do not have them
+#ifndef DMA_BUF_IOCTL_SYNC
+struct dma_buf_sync {
+    uint64_t flags;
+};
+#define DMA_BUF_SYNC_READ       (1 << 0)
+#define DMA_BUF_SYNC_START      (0 << 2)
+#define DMA_BUF_SYNC_END        (1 << 2)
+#define DMA_BUF_IOCTL_SYNC      _IOW('b', 0, struct dma_buf_sync)
+#endif
+
+static int64_t monotonicMs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+IMX6CameraReader::IMX6CameraReader()
+    : mSocket(-1)
+    , mHeader(0)
+    , mFdCount(0)
+    , mSlotCount(0)
+    , mMemoryCount(0)
+    , mLastPublished(0)
+{
+    memset(mMemory, 0, sizeof(mMemory));
+    memset(mMemoryLength, 0, sizeof(mMemoryLength));
+}
+
+IMX6CameraReader::~IMX6CameraReader()
+{
+    disconnect();
+}
+
+bool IMX6CameraReader::connect(const char *socketPath)
+{
+    disconnect();
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (!socketPath || strlen(socketPath) >= sizeof(address.sun_path))
+        return false;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+
+    mSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mSocket < 0)
+        return false;
+    if (::connect(mSocket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || !receiveDescriptors()) {
+        disconnect();
+        return false;
+    }
+
+    void *header = mmap(NULL, sizeof(IMX6CameraShmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, mFds[0], 0);
+    if (header == MAP_FAILED) {
+        disconnect();
+        return false;
+    }
+    mHeader = static_cast<IMX6CameraShmHeader *>(header);
+    mSlotCount = __atomic_load_n(&mHeader->slotCount, __ATOMIC_ACQUIRE);
+    mMemoryCount = __atomic_load_n(&mHeader->memoryCount, __ATOMIC_ACQUIRE);
+    if (mHeader->magic != IMX6_CAMERA_SHM_MAGIC || mHeader->version != IMX6_CAMERA_SHM_VERSION
+            || mSlotCount == 0 || mSlotCount > IMX6_CAMERA_SHM_MAX_SLOTS
+            || mMemoryCount == 0 || mMemoryCount > IMX6_CAMERA_SHM_MAX_PLANES
+            || uint32_t(mFdCount) != 1 + mSlotCount * mMemoryCount) {
+        disconnect();
+        return false;
+    }
+
+    for (int i = 1; i < mFdCount; ++i) {
+        const off_t length = lseek(mFds[i], 0, SEEK_END);
+        void *data = length > 0 ? mmap(NULL, length, PROT_READ, MAP_SHARED, mFds[i], 0) : MAP_FAILED;
+        if (data == MAP_FAILED) {
+            disconnect();
+            return false;
+        }
+        mMemory[i - 1] = static_cast<const uint8_t *>(data);
+        mMemoryLength[i - 1] = length;
+    }
+
+    // Only frames published from now on are of interest
+    mLastPublished = __atomic_load_n(&mHeader->published, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+bool IMX6CameraReader::receiveDescriptors()
+{
+    IMX6CameraShmHello hello;
+    iovec io;
+    io.iov_base = &hello;
+    io.iov_len = sizeof(hello);
+
+    char control[CMSG_SPACE(sizeof(mFds))];
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    if (recvmsg(mSocket, &message, MSG_CMSG_CLOEXEC) != ssize_t(sizeof(hello)))
+        return false;
+
+    for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        mFdCount = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(mFds, CMSG_DATA(header), mFdCount * sizeof(int));
+    }
+    return hello.magic == IMX6_CAMERA_SHM_MAGIC && hello.version == IMX6_CAMERA_SHM_VERSION
+            && mFdCount > 0 && uint32_t(mFdCount) == hello.fdCount
+            && !(message.msg_flags & MSG_CTRUNC);
+}
+
+void IMX6CameraReader::disconnect()
+{
+    for (uint32_t i = 0; i < IMX6_CAMERA_SHM_MAX_SLOTS * IMX6_CAMERA_SHM_MAX_PLANES; ++i) {
+        if (mMemory[i])
+            munmap(const_cast<uint8_t *>(mMemory[i]), mMemoryLength[i]);
+        mMemory[i] = 0;
+        mMemoryLength[i] = 0;
+    }
+    if (mHeader)
+        munmap(mHeader, sizeof(IMX6CameraShmHeader));
+    mHeader = 0;
+    for (int i = 0; i < mFdCount; ++i)
+        close(mFds[i]);
+    mFdCount = 0;
+    if (mSocket >= 0)
+        close(mSocket);
+    mSocket = -1;
+    mSlotCount = 0;
+    mMemoryCount = 0;
+}
+
+bool IMX6CameraReader::isConnected() const
+{
+    return mHeader && __atomic_load_n(&mHeader->slotCount, __ATOMIC_ACQUIRE) != 0;
+}
+
+bool IMX6CameraReader::acquireFrame(IMX6CameraReaderFrame *frame, int timeoutMs)
+{
+    if (!isConnected())
+        return false;
+
+    const int64_t deadline = monotonicMs() + timeoutMs;
+    for (;;) {
+        const uint32_t published = __atomic_load_n(&mHeader->published, __ATOMIC_SEQ_CST);
+        if (published != mLastPublished) {
+            mLastPublished = published;
+            const uint32_t slot = __atomic_load_n(&mHeader->latestSlot, __ATOMIC_ACQUIRE);
+            if (slot < mSlotCount && pinSlot(slot, frame))
+                return true;
+            // Lost the race against the publisher, wait for the next frame
+            continue;
+        }
+
+        const int64_t remaining = deadline - monotonicMs();
+        if (remaining <= 0 || !isConnected())
+            return false;
+
+        timespec timeout;
+        timeout.tv_sec = remaining / 1000;
+        timeout.tv_nsec = (remaining % 1000) * 1000000;
+        __atomic_add_fetch(&mHeader->waiters, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &mHeader->published, FUTEX_WAIT, published, &timeout, NULL, 0);
+        __atomic_sub_fetch(&mHeader->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+bool IMX6CameraReader::pinSlot(int slot, IMX6CameraReaderFrame *frame)
+{
+    IMX6CameraShmSlot &shared = mHeader->slots[slot];
+    const uint32_t sequence = __atomic_load_n(&shared.sequence, __ATOMIC_ACQUIRE);
+    if (sequence & 1)
+        return false;
+
+    __atomic_add_fetch(&shared.readers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shared.sequence, __ATOMIC_SEQ_CST) != sequence) {
+        __atomic_sub_fetch(&shared.readers, 1, __ATOMIC_SEQ_CST);
+        return false;
+    }
+
+    frame->slot = slot;
+    frame->slotSequence = sequence;
+    frame->frameSequence = shared.frameSequence;
+    frame->timestamp = shared.timestamp;
+    frame->fourcc = shared.fourcc;
+    frame->width = shared.width;
+    frame->height = shared.height;
+    frame->planeCount = shared.planeCount < IMX6_CAMERA_SHM_MAX_PLANES ? shared.planeCount : IMX6_CAMERA_SHM_MAX_PLANES;
+    for (int plane = 0; plane < frame->planeCount; ++plane) {
+        const IMX6CameraShmPlane &sharedPlane = shared.planes[plane];
+        const uint32_t memory = slot * mMemoryCount + (sharedPlane.memory < mMemoryCount ? sharedPlane.memory : 0);
+        frame->data[plane] = mMemory[memory] + sharedPlane.offset;
+        frame->bytesPerLine[plane] = sharedPlane.bytesPerLine;
+        frame->length[plane] = sharedPlane.length;
+    }
+
+    if (!isFrameValid(*frame)) {
+        __atomic_sub_fetch(&shared.readers, 1, __ATOMIC_SEQ_CST);
+        return false;
+    }
+    syncBuffer(slot, true);
+    return true;
+}
+
+bool IMX6CameraReader::isFrameValid(const IMX6CameraReaderFrame &frame) const
+{
+    if (!mHeader)
+        return false;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&mHeader->slots[frame.slot].sequence, __ATOMIC_RELAXED) == frame.slotSequence;
+}
+
+void IMX6CameraReader::releaseFrame(IMX6CameraReaderFrame *frame)
+{
+    if (!mHeader || frame->slot < 0)
+        return;
+    syncBuffer(frame->slot, false);
+    __atomic_sub_fetch(&mHeader->slots[frame->slot].readers, 1, __ATOMIC_SEQ_CST);
+    frame->slot = -1;
+}
+
+void IMX6CameraReader::syncBuffer(int slot, bool start)
+{
+    // Keeps cached dmabuf mappings coherent, fails harmlessly where unsupported
+    dma_buf_sync sync;
+    sync.flags = DMA_BUF_SYNC_READ | (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END);
+    for (uint32_t memory = 0; memory < mMemoryCount; ++memory)
+        ioctl(mFds[1 + slot * mMemoryCount + memory], DMA_BUF_IOCTL_SYNC, &sync);
+}
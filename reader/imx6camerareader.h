@@ -0,0 +1,94 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef IMX6CAMERAREADER_H
+#define IMX6CAMERAREADER_H
+
+// Reads frames published by the IMX6Camera plugin from another process. The
+// buffers are mapped read-only and never copied. Plain C++, no Qt needed.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "imx6camerashm.h"
+
+struct IMX6CameraReaderFrame
+{
+    int slot;
+    uint32_t slotSequence;
+    uint32_t frameSequence;
+    int64_t timestamp;          // Capture time in microseconds, CLOCK_MONOTONIC
+    uint32_t fourcc;
+    uint32_t width;
+    uint32_t height;
+    int planeCount;
+    const uint8_t *data[IMX6_CAMERA_SHM_MAX_PLANES];
+    int bytesPerLine[IMX6_CAMERA_SHM_MAX_PLANES];
+    size_t length[IMX6_CAMERA_SHM_MAX_PLANES];
+};
+
+class IMX6CameraReader
+{
+public:
+    IMX6CameraReader();
+    ~IMX6CameraReader();
+
+    bool connect(const char *socketPath);
+    void disconnect();
+    bool isConnected() const;
+
+    // Waits up to timeoutMs for a frame newer than the last acquired one and
+    // pins it. Every acquired frame must be released again.
+    bool acquireFrame(IMX6CameraReaderFrame *frame, int timeoutMs);
+    // False when the publisher had to take the buffer back while it was read,
+    // the data must then be discarded. Check after reading. The publisher keeps
+    // only the latest frame, a read has to finish before the next one arrives.
+    bool isFrameValid(const IMX6CameraReaderFrame &frame) const;
+    void releaseFrame(IMX6CameraReaderFrame *frame);
+
+private:
+    IMX6CameraReader(const IMX6CameraReader &);
+    IMX6CameraReader &operator=(const IMX6CameraReader &);
+
+    bool receiveDescriptors();
+    bool pinSlot(int slot, IMX6CameraReaderFrame *frame);
+    void syncBuffer(int slot, bool start);
+
+    int mSocket;
+    IMX6CameraShmHeader *mHeader;
+    int mFdCount;
+    int mFds[1 + IMX6_CAMERA_SHM_MAX_SLOTS * IMX6_CAMERA_SHM_MAX_PLANES];
+    const uint8_t *mMemory[IMX6_CAMERA_SHM_MAX_SLOTS * IMX6_CAMERA_SHM_MAX_PLANES];
+    size_t mMemoryLength[IMX6_CAMERA_SHM_MAX_SLOTS * IMX6_CAMERA_SHM_MAX_PLANES];
+    uint32_t mSlotCount;
+    uint32_t mMemoryCount;
+    uint32_t mLastPublished;
+};
+
+#endif // IMX6CAMERAREADER_H
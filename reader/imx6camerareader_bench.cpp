@@ -0,0 +1,121 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+// Measures how many frames a separate process gets through the shared
+// memory interface, and how old they are when they arrive.
+//
+// usage: imx6camerareader-bench [socket path] [seconds] [--touch]
+
+#include "imx6camerareader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+static int64_t monotonicUs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *socketPath = argc > 1 ? argv[1] : "/tmp/imx6camera.sock";
+    const int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    const bool touch = argc > 3 && !strcmp(argv[3], "--touch");
+
+    IMX6CameraReader reader;
+    if (!reader.connect(socketPath)) {
+        fprintf(stderr, "Could not connect to %s\n", socketPath);
+        return 1;
+    }
+
+    uint64_t frames = 0;
+    uint64_t invalid = 0;
+    uint64_t bytes = 0;
+    uint64_t checksum = 0;
+    int64_t latencySum = 0;
+    int64_t latencyMax = 0;
+    uint32_t lastSequence = 0;
+    uint64_t skipped = 0;
+
+    const int64_t start = monotonicUs();
+    const int64_t end = start + int64_t(seconds) * 1000000;
+    while (monotonicUs() < end) {
+        IMX6CameraReaderFrame frame;
+        if (!reader.acquireFrame(&frame, 1000)) {
+            if (!reader.isConnected()) {
+                fprintf(stderr, "Publisher went away\n");
+                break;
+            }
+            continue;
+        }
+
+        const int64_t latency = monotonicUs() - frame.timestamp;
+        if (touch) {
+            // Read every cache line of every plane, as an analysis stage would
+            for (int plane = 0; plane < frame.planeCount; ++plane) {
+                for (size_t offset = 0; offset < frame.length[plane]; offset += 32)
+                    checksum += frame.data[plane][offset];
+                bytes += frame.length[plane];
+            }
+        }
+
+        if (reader.isFrameValid(frame)) {
+            ++frames;
+            latencySum += latency;
+            if (latency > latencyMax)
+                latencyMax = latency;
+            if (lastSequence && frame.frameSequence > lastSequence + 1)
+                skipped += frame.frameSequence - lastSequence - 1;
+            lastSequence = frame.frameSequence;
+        } else {
+            ++invalid;
+        }
+        reader.releaseFrame(&frame);
+    }
+
+    const double elapsed = (monotonicUs() - start) / 1000000.0;
+    printf("frames:        %llu in %.2f s, %.2f fps\n", (unsigned long long)frames, elapsed, frames / elapsed);
+    printf("skipped:       %llu frames published while reading\n", (unsigned long long)skipped);
+    printf("invalidated:   %llu frames taken back during reading\n", (unsigned long long)invalid);
+    if (frames) {
+        printf("latency:       %.2f ms average, %.2f ms max (capture to acquire)\n",
+               latencySum / 1000.0 / frames, latencyMax / 1000.0);
+    }
+    if (touch) {
+        printf("read:          %.2f MB/s (checksum %llu)\n",
+               bytes / elapsed / (1024.0 * 1024.0), (unsigned long long)checksum);
+    }
+    return 0;
+}
@@ -39,20 +39,58 @@
 #include "GLES2/gl2ext.h"
 #endif // ARM_TARGET
 #include "imx6camera.h"
+#include "imx6camerasimd.h"
+#include "imx6cameratrace.h"
 
 #include <QtCore/qmetatype.h>
 #include <QtCore/qshareddata.h>
 #include <QtCore/qvariant.h>
 #include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QQmlFile>
+#include <QQuickWindow>
 
-IMX6Camera::IMX6Camera() : cameraControl(NULL)
+#include <cstring>
+
+IMX6Camera::IMX6Camera() : m_frameChanged(false)
+  , m_glContext(0)
+  , cameraControl(NULL)
   , m_isMirror(false)
-  , m_contrast(0)
-  , m_saturation(0)
+  , m_isFlip(false)
+  , m_orientation(0)
+  , m_geometryDirty(true)
+  , m_fillMode(Stretch)
+  , m_zoom(1.0)
+  , m_zoomCenter(0.5, 0.5)
+  , m_sensorCrop(false)
+  , m_lowLatency(false)
+  , m_window(0)
+  , m_idlePolicy(DecimateWhenIdle)
+  , m_active(true)
+  , m_changeDetection(false)
+  , m_changeThreshold(2.0)
+  , m_refreshInterval(1000)
+  , m_renderedFrames(0)
+  , m_skippedRenders(0)
+  , m_pulledSequence(0)
+  , m_motionDetector(NULL)
+  , m_motionSensitivity(20)
+  , m_motionMinimumArea(0.01)
+  , m_motion(false)
+  , m_lumaStatistics(NULL)
+  , m_statisticsRegions(4, 4)
+  , m_governor(NULL)
+  , m_contrast(50)
+  , m_saturation(50)
   , m_sharpening(0)
-  , m_brightness(0)
+  , m_brightness(50)
+  , m_setColourParameters(0)
+  , m_gamma(1.0)
+  , m_adjustmentDirty(true)
   , m_sessionId(0)
+  , m_started(false)
 {
+    memset(&m_lumaResult, 0, sizeof(m_lumaResult));
     cameraControl = IMX6CameraControl::cameraControl(&m_sessionId);
     start();
     setFlag(ItemHasContents, true);
@@ -60,73 +98,211 @@ IMX6Camera::IMX6Camera() : cameraControl(NULL)
     qRegisterMetaType<IMX6CameraFrame>("IMX6CameraFrame");
     connect(cameraControl, &IMX6CameraControl::frameReady, this, &IMX6Camera::present);
     connect(cameraControl, &IMX6CameraControl::cameraConnectionChanged, this, &IMX6Camera::cameraConnectionChanged);
+    connect(cameraControl, &IMX6CameraControl::recoveryStatisticsChanged, this, &IMX6Camera::recoveryStatisticsChanged);
+    connect(cameraControl, &IMX6CameraControl::dequeueLatencyChanged, this, &IMX6Camera::dequeueLatencyChanged);
     connect(cameraControl, &IMX6CameraControl::sourceSizeChanged, this, &IMX6Camera::sourceSizeChanged);
+    connect(cameraControl, &IMX6CameraControl::sourceSizeChanged, this, &IMX6Camera::invalidateGeometry);
+    connect(cameraControl, &IMX6CameraControl::cropRectChanged, this, &IMX6Camera::invalidateGeometry);
+    connect(cameraControl, &IMX6CameraControl::openSessionsChanged, this, &IMX6Camera::updateSensorCrop);
+    connect(cameraControl, &IMX6CameraControl::supportedParametersChanged, this, &IMX6Camera::applyColourParameters);
+    connect(cameraControl, &IMX6CameraControl::frameRateChanged, this, &IMX6Camera::frameRateChanged);
+    connect(this, &QQuickItem::windowChanged, this, &IMX6Camera::handleWindowChanged);
+    connect(this, &QQuickItem::visibleChanged, this, &IMX6Camera::updateActive);
+    connect(this, &QQuickItem::opacityChanged, this, &IMX6Camera::updateActive);
+    connect(this, &QQuickItem::parentChanged, this, &IMX6Camera::trackAncestors);
+    trackAncestors();
 }
 
 IMX6Camera::~IMX6Camera()
 {
+    // Torn down without the setters, which would reconnect the window, emit and
+    // hand the control demand for a session that is about to close
+    disconnect(this, &QQuickItem::windowChanged, this, &IMX6Camera::handleWindowChanged);
+    if (m_window) {
+        // The render thread calls in directly, it has to stop before anything else goes
+        disconnect(m_window, 0, this, 0);
+        m_window = NULL;
+    }
+    Q_FOREACH (const QPointer<QQuickItem> &ancestor, m_trackedAncestors) {
+        if (ancestor)
+            disconnect(ancestor, 0, this, 0);
+    }
+    m_trackedAncestors.clear();
+    delete m_governor;
+    m_governor = NULL;
+    if (m_lowLatency) {
+        disconnect(cameraControl, &IMX6CameraControl::frameAvailable, this, &IMX6Camera::handleFrameAvailable);
+        cameraControl->removeLatestFrameConsumer();
+    }
+    if (m_changeDetection)
+        cameraControl->removeSignatureConsumer();
+    delete m_motionDetector;
+    m_motionDetector = NULL;
+    delete m_lumaStatistics;
+    m_lumaStatistics = NULL;
     cameraControl->stopCameraStream(m_sessionId);
+
     disconnect(cameraControl, &IMX6CameraControl::frameReady, this, &IMX6Camera::present);
     disconnect(cameraControl, &IMX6CameraControl::cameraConnectionChanged, this, &IMX6Camera::cameraConnectionChanged);
     disconnect(cameraControl, &IMX6CameraControl::sourceSizeChanged, this, &IMX6Camera::sourceSizeChanged);
-
-    if (m_frame.buffer)
-        m_frame.buffer->release();
+    disconnect(cameraControl, &IMX6CameraControl::sourceSizeChanged, this, &IMX6Camera::invalidateGeometry);
+    disconnect(cameraControl, &IMX6CameraControl::cropRectChanged, this, &IMX6Camera::invalidateGeometry);
+    disconnect(cameraControl, &IMX6CameraControl::openSessionsChanged, this, &IMX6Camera::updateSensorCrop);
+    disconnect(cameraControl, &IMX6CameraControl::supportedParametersChanged, this, &IMX6Camera::applyColourParameters);
+    disconnect(cameraControl, &IMX6CameraControl::frameRateChanged, this, &IMX6Camera::frameRateChanged);
+    if (m_sensorCrop)
+        cameraControl->setCropRect(QRect());
 }
 
 QSGVivanteVideoNode *IMX6Camera::createNote(IMX6CameraFrame::PixelFormat format)
 {
-    return new QSGVivanteVideoNode(format);
+    return new QSGVivanteVideoNode(cameraControl, format);
 }
 
 void IMX6Camera::start()
 {
+    m_started = true;
     QMetaObject::invokeMethod(cameraControl, "startCamera", Qt::QueuedConnection, Q_ARG(uint, m_sessionId));
 }
 
 void IMX6Camera::stop()
 {
+    // Other views of the device keep streaming, this one stops showing frames
+    m_started = false;
     cameraControl->stopCameraStream(m_sessionId);
 }
 
+bool IMX6Camera::setColourParameter(CameraParameter id, uint value, uint *member)
+{
+    if (value > 100)
+        return false;
+    // The sensor does it for free when it can, the shader takes over otherwise
+    const bool hardware = cameraControl->isParameterSupported(id);
+    if (hardware && !cameraControl->setParameter(id, value))
+        return false;
+    m_setColourParameters |= 1 << id;
+    if (value == *member)
+        return false;
+    *member = value;
+    if (!hardware) {
+        m_adjustmentDirty = true;
+        update();
+    }
+    return true;
+}
+
+// Values set before the device was loaded, or before a reload reset the sensor,
+// went to the shader. The sensor takes over those it supports now.
+void IMX6Camera::applyColourParameters()
+{
+    const CameraParameter ids[] = { Contrast, Saturation, Sharpening, Brightness };
+    const uint values[] = { m_contrast, m_saturation, m_sharpening, m_brightness };
+    for (int i = 0; i < 4; ++i) {
+        if ((m_setColourParameters & (1 << ids[i])) && cameraControl->isParameterSupported(ids[i]))
+            cameraControl->setParameter(ids[i], values[i]);
+    }
+    m_adjustmentDirty = true;
+    update();
+
+    // The getters read the sensor where it has the control
+    emit contrastChanged(contrast());
+    emit saturationChanged(saturation());
+    emit sharpeningChanged(sharpening());
+    emit brightnessChanged(brightness());
+}
+
 void IMX6Camera::setContrast(uint value)
 {
-    if (!cameraControl->setParameter(Contrast, value))
-        return;
-    if (value == m_contrast)
-        return;
-    m_contrast = value;
-    emit contrastChanged(m_contrast);
+    if (setColourParameter(Contrast, value, &m_contrast))
+        emit contrastChanged(m_contrast);
 }
 
 void IMX6Camera::setSaturation(uint value)
 {
-    if (!cameraControl->setParameter(Saturation, value))
-        return;
-    if (value == m_saturation)
-        return;
-    m_saturation = value;
-    emit saturationChanged(m_saturation);
+    if (setColourParameter(Saturation, value, &m_saturation))
+        emit saturationChanged(m_saturation);
 }
 
 void IMX6Camera::setSharpening(uint value)
 {
-    if (!cameraControl->setParameter(Sharpening, value))
-        return;
-    if (value == m_sharpening)
-        return;
-    m_sharpening = value;
-    emit sharpeningChanged(m_sharpening);
+    if (setColourParameter(Sharpening, value, &m_sharpening))
+        emit sharpeningChanged(m_sharpening);
 }
 
 void IMX6Camera::setBrightness(uint value)
 {
-    if (!cameraControl->setParameter(Brightness, value))
+    if (setColourParameter(Brightness, value, &m_brightness))
+        emit brightnessChanged(m_brightness);
+}
+
+void IMX6Camera::setGamma(qreal value)
+{
+    if (value <= 0.0 || qFuzzyCompare(value, m_gamma))
         return;
-    if (value ==  m_brightness)
+    m_gamma = value;
+    m_adjustmentDirty = true;
+    update();
+    emit gammaChanged(m_gamma);
+}
+
+void IMX6Camera::setLookupTable(const QUrl &url)
+{
+    if (url == m_lookupTableUrl)
         return;
-    m_brightness = value;
-    emit brightnessChanged(m_brightness);
+    m_lookupTableUrl = url;
+    emit lookupTableChanged(m_lookupTableUrl);
+    reloadLookupTable();
+}
+
+void IMX6Camera::reloadLookupTable()
+{
+    IMX6CameraLookupTable table;
+    if (!m_lookupTableUrl.isEmpty()) {
+        const QString fileName = QQmlFile::urlToLocalFileOrQrc(m_lookupTableUrl);
+        if (!table.load(fileName)) {
+            qWarning("Failed to load lookup table %s: %s", qPrintable(fileName), qPrintable(table.errorString()));
+            return; // Keep grading with the table we have
+        }
+    }
+    const int oldSize = m_lookupTable.size();
+    // Only the material's small atlas texture is replaced, the stream and the
+    // per-buffer textures are left alone
+    m_lookupTable = table;
+    m_adjustmentDirty = true;
+    update();
+    if (oldSize != m_lookupTable.size())
+        emit lookupTableSizeChanged(m_lookupTable.size());
+}
+
+QSGVivanteVideoAdjustment IMX6Camera::adjustment() const
+{
+    // Values are in the same [0..100] range as the sensor controls, 50 is neutral
+    // except for sharpening, where 0 is off. Only features that differ from
+    // neutral are enabled so the plain shader is used in the common case.
+    QSGVivanteVideoAdjustment adjustment;
+    if (!cameraControl->isParameterSupported(Brightness) && m_brightness != 50) {
+        adjustment.features |= QSGVivanteVideoAdjustment::Brightness;
+        adjustment.brightness = (int(m_brightness) - 50) / 100.0f;
+    }
+    if (!cameraControl->isParameterSupported(Contrast) && m_contrast != 50) {
+        adjustment.features |= QSGVivanteVideoAdjustment::Contrast;
+        adjustment.contrast = m_contrast / 50.0f;
+    }
+    if (!cameraControl->isParameterSupported(Saturation) && m_saturation != 50) {
+        adjustment.features |= QSGVivanteVideoAdjustment::Saturation;
+        adjustment.saturation = m_saturation / 50.0f;
+    }
+    if (!cameraControl->isParameterSupported(Sharpening) && m_sharpening != 0) {
+        adjustment.features |= QSGVivanteVideoAdjustment::Sharpen;
+        adjustment.sharpen = m_sharpening / 50.0f;
+    }
+    if (!qFuzzyCompare(m_gamma, qreal(1.0))) {
+        adjustment.features |= QSGVivanteVideoAdjustment::Gamma;
+        adjustment.gamma = m_gamma;
+    }
+    if (!m_lookupTable.isNull())
+        adjustment.features |= QSGVivanteVideoAdjustment::LookupTable;
+    return adjustment;
 }
 
 void IMX6Camera::setMirror(bool value)
@@ -134,15 +310,606 @@ void IMX6Camera::setMirror(bool value)
     if (m_isMirror == value)
         return;
     m_isMirror = value;
+    invalidateGeometry();
     emit mirrorChanged(m_isMirror);
 }
 
+void IMX6Camera::setFlip(bool value)
+{
+    if (m_isFlip == value)
+        return;
+    m_isFlip = value;
+    invalidateGeometry();
+    emit flipChanged(m_isFlip);
+}
+
+void IMX6Camera::setOrientation(int value)
+{
+    const int orientation = ((value % 360) + 360) % 360;
+    if (orientation % 90) {
+        qWarning("Unsupported orientation %d, only multiples of 90 degrees are allowed", value);
+        return;
+    }
+    if (m_orientation == orientation)
+        return;
+    m_orientation = orientation;
+    invalidateGeometry();
+    emit orientationChanged(m_orientation);
+}
+
+void IMX6Camera::setFillMode(IMX6Camera::FillMode mode)
+{
+    if (m_fillMode == mode)
+        return;
+    m_fillMode = mode;
+    invalidateGeometry();
+    emit fillModeChanged(m_fillMode);
+}
+
+void IMX6Camera::setSourceRect(const QRectF &rect)
+{
+    if (m_sourceRect == rect)
+        return;
+    m_sourceRect = rect;
+    updateSensorCrop();
+    invalidateGeometry();
+    emit sourceRectChanged(m_sourceRect);
+}
+
+void IMX6Camera::setZoom(qreal value)
+{
+    value = qMax(value, qreal(1.0));
+    if (qFuzzyCompare(m_zoom, value))
+        return;
+    m_zoom = value;
+    updateSensorCrop();
+    invalidateGeometry();
+    emit zoomChanged(m_zoom);
+}
+
+void IMX6Camera::setZoomCenter(const QPointF &center)
+{
+    const QPointF bounded(qBound(qreal(0.0), center.x(), qreal(1.0)), qBound(qreal(0.0), center.y(), qreal(1.0)));
+    if (m_zoomCenter == bounded)
+        return;
+    m_zoomCenter = bounded;
+    updateSensorCrop();
+    invalidateGeometry();
+    emit zoomCenterChanged(m_zoomCenter);
+}
+
+void IMX6Camera::setSensorCrop(bool value)
+{
+    if (m_sensorCrop == value)
+        return;
+    m_sensorCrop = value;
+    if (m_sensorCrop)
+        updateSensorCrop();
+    else
+        cameraControl->setCropRect(QRect());
+    invalidateGeometry();
+    emit sensorCropChanged(m_sensorCrop);
+}
+
+void IMX6Camera::setLowLatency(bool value)
+{
+    if (m_lowLatency == value)
+        return;
+    m_lowLatency = value;
+    if (m_lowLatency) {
+        // The GUI thread only schedules updates, the render thread fetches the frame itself
+        disconnect(cameraControl, &IMX6CameraControl::frameReady, this, &IMX6Camera::present);
+        connect(cameraControl, &IMX6CameraControl::frameAvailable, this, &IMX6Camera::handleFrameAvailable);
+        cameraControl->addLatestFrameConsumer();
+    } else {
+        disconnect(cameraControl, &IMX6CameraControl::frameAvailable, this, &IMX6Camera::handleFrameAvailable);
+        connect(cameraControl, &IMX6CameraControl::frameReady, this, &IMX6Camera::present);
+        cameraControl->removeLatestFrameConsumer();
+    }
+    handleWindowChanged(window());
+    emit lowLatencyChanged(m_lowLatency);
+}
+
+void IMX6Camera::handleWindowChanged(QQuickWindow *window)
+{
+    if (m_window) {
+        disconnect(m_window, &QQuickWindow::beforeRendering, this, &IMX6Camera::pullLatestFrame);
+        disconnect(m_window, &QQuickWindow::afterRendering, this, &IMX6Camera::retireFrames);
+        disconnect(m_window, &QWindow::visibilityChanged, this, &IMX6Camera::updateActive);
+        disconnect(m_window, &QWindow::widthChanged, this, &IMX6Camera::updateActive);
+        disconnect(m_window, &QWindow::heightChanged, this, &IMX6Camera::updateActive);
+    }
+    m_window = window;
+    if (m_governor)
+        m_governor->setWindow(m_window);
+    if (m_window) {
+        if (m_lowLatency)
+            connect(m_window, &QQuickWindow::beforeRendering, this, &IMX6Camera::pullLatestFrame, Qt::DirectConnection);
+        connect(m_window, &QQuickWindow::afterRendering, this, &IMX6Camera::retireFrames, Qt::DirectConnection);
+        connect(m_window, &QWindow::visibilityChanged, this, &IMX6Camera::updateActive);
+        connect(m_window, &QWindow::widthChanged, this, &IMX6Camera::updateActive);
+        connect(m_window, &QWindow::heightChanged, this, &IMX6Camera::updateActive);
+    }
+    updateActive();
+}
+
+void IMX6Camera::handleFrameAvailable()
+{
+    if (m_active)
+        update();
+}
+
+void IMX6Camera::trackAncestors()
+{
+    // Opacity and position of any ancestor decide whether the item is seen
+    Q_FOREACH (const QPointer<QQuickItem> &ancestor, m_trackedAncestors) {
+        if (ancestor)
+            disconnect(ancestor, 0, this, 0);
+    }
+    m_trackedAncestors.clear();
+    for (QQuickItem *ancestor = parentItem(); ancestor; ancestor = ancestor->parentItem()) {
+        connect(ancestor, &QQuickItem::opacityChanged, this, &IMX6Camera::updateActive);
+        connect(ancestor, &QQuickItem::xChanged, this, &IMX6Camera::updateActive);
+        connect(ancestor, &QQuickItem::yChanged, this, &IMX6Camera::updateActive);
+        connect(ancestor, &QQuickItem::parentChanged, this, &IMX6Camera::trackAncestors);
+        m_trackedAncestors.append(ancestor);
+    }
+    updateActive();
+}
+
+void IMX6Camera::updateActive()
+{
+    bool active = isVisible() && m_window && m_window->isVisible()
+            && m_window->visibility() != QWindow::Minimized;
+
+    qreal opacity = 1.0;
+    for (QQuickItem *item = this; active && item; item = item->parentItem())
+        opacity *= item->opacity();
+    active = active && opacity > 0;
+
+    if (active) {
+        const QRectF sceneRect = mapRectToScene(QRectF(0, 0, width(), height()));
+        active = sceneRect.intersects(QRectF(0, 0, m_window->width(), m_window->height()));
+    }
+
+    if (m_active == active)
+        return;
+    m_active = active;
+    updateDemand();
+    if (m_active) {
+        m_signatureMutex.lock();
+        m_sinceRender.invalidate(); // The first frame after idling is always shown
+        m_signatureMutex.unlock();
+        update();
+    }
+    emit activeChanged(m_active);
+}
+
+IMX6Camera::IdlePolicy IMX6Camera::idlePolicy() const
+{
+    return m_idlePolicy;
+}
+
+void IMX6Camera::setIdlePolicy(IdlePolicy policy)
+{
+    if (m_idlePolicy == policy)
+        return;
+    m_idlePolicy = policy;
+    updateDemand();
+    emit idlePolicyChanged(m_idlePolicy);
+}
+
+void IMX6Camera::updateDemand()
+{
+    // Analysis wants every frame even when nothing is shown
+    const bool demand = m_active || m_motionDetector || m_lumaStatistics;
+    cameraControl->setSessionDemand(m_sessionId, demand, static_cast<IMX6CameraControl::IdlePolicy>(m_idlePolicy));
+}
+
+bool IMX6Camera::active() const
+{
+    return m_active;
+}
+
+bool IMX6Camera::isSceneUnchanged(const IMX6CameraFrame &frame)
+{
+    // Compared against the last rendered frame, so slow changes still add up.
+    // Low-latency mode judges frames on the render thread.
+    QMutexLocker lock(&m_signatureMutex);
+    const QByteArray &signature = frame.signature;
+    const bool comparable = !signature.isEmpty() && signature.size() == m_renderedSignature.size()
+            && m_sinceRender.isValid() && m_sinceRender.elapsed() < m_refreshInterval;
+    if (comparable) {
+        const quint64 difference = imx6SumAbsDiff(reinterpret_cast<const uchar *>(signature.constData()),
+                                                  reinterpret_cast<const uchar *>(m_renderedSignature.constData()),
+                                                  signature.size());
+        if (difference < m_changeThreshold * signature.size())
+            return true;
+    }
+    m_renderedSignature = signature;
+    m_sinceRender.start();
+    return false;
+}
+
+bool IMX6Camera::changeDetection() const
+{
+    return m_changeDetection;
+}
+
+void IMX6Camera::setChangeDetection(bool value)
+{
+    if (m_changeDetection == value)
+        return;
+    m_changeDetection = value;
+    if (m_changeDetection) {
+        cameraControl->addSignatureConsumer();
+    } else {
+        cameraControl->removeSignatureConsumer();
+        QMutexLocker lock(&m_signatureMutex);
+        m_renderedSignature.clear();
+        m_sinceRender.invalidate();
+    }
+    emit changeDetectionChanged(m_changeDetection);
+}
+
+qreal IMX6Camera::changeThreshold() const
+{
+    return m_changeThreshold;
+}
+
+void IMX6Camera::setChangeThreshold(qreal value)
+{
+    value = qMax<qreal>(0, value);
+    if (qFuzzyCompare(m_changeThreshold + 1, value + 1))
+        return;
+    m_changeThreshold = value;
+    emit changeThresholdChanged(m_changeThreshold);
+}
+
+int IMX6Camera::refreshInterval() const
+{
+    return m_refreshInterval;
+}
+
+void IMX6Camera::setRefreshInterval(int milliseconds)
+{
+    milliseconds = qMax(0, milliseconds);
+    if (m_refreshInterval == milliseconds)
+        return;
+    m_refreshInterval = milliseconds;
+    emit refreshIntervalChanged(m_refreshInterval);
+}
+
+int IMX6Camera::renderedFrames() const
+{
+    return m_renderedFrames.load();
+}
+
+int IMX6Camera::skippedRenders() const
+{
+    return m_skippedRenders.load();
+}
+
+bool IMX6Camera::motionDetection() const
+{
+    return m_motionDetector != NULL;
+}
+
+void IMX6Camera::setMotionDetection(bool value)
+{
+    if (motionDetection() == value)
+        return;
+
+    if (value) {
+        m_motionDetector = new IMX6CameraMotionDetector(this);
+        m_motionDetector->setSensitivity(m_motionSensitivity);
+        m_motionDetector->setMinimumArea(m_motionMinimumArea);
+        m_motionDetector->setFrameDivisor(processingDivisor());
+        setMotionZones(m_motionZones);
+        connect(m_motionDetector, &IMX6CameraMotionDetector::motionUpdated, this, &IMX6Camera::handleMotion);
+        connect(m_motionDetector, &IMX6CameraProcessingStage::statisticsChanged, this, &IMX6Camera::motionDetectionLoadChanged);
+        m_motionDetector->attach(cameraControl);
+    } else {
+        delete m_motionDetector;
+        m_motionDetector = NULL;
+        const bool stopped = m_motion;
+        m_motion = false;
+        m_motionRect = QRectF();
+        m_activeMotionZones.clear();
+        if (stopped) {
+            emit motionChanged();
+            emit motionStopped();
+        }
+    }
+    updateDemand();
+    emit motionDetectionChanged(value);
+}
+
+QVariantList IMX6Camera::motionZones() const
+{
+    return m_motionZones;
+}
+
+void IMX6Camera::setMotionZones(const QVariantList &zones)
+{
+    if (m_motionDetector) {
+        QList<QRectF> rects;
+        Q_FOREACH (const QVariant &zone, zones)
+            rects.append(zone.toRectF());
+        m_motionDetector->setZones(rects);
+    }
+    if (m_motionZones == zones)
+        return;
+    m_motionZones = zones;
+    emit motionZonesChanged(m_motionZones);
+}
+
+int IMX6Camera::motionSensitivity() const
+{
+    return m_motionSensitivity;
+}
+
+void IMX6Camera::setMotionSensitivity(int value)
+{
+    value = qBound(0, value, 255);
+    if (m_motionSensitivity == value)
+        return;
+    m_motionSensitivity = value;
+    if (m_motionDetector)
+        m_motionDetector->setSensitivity(value);
+    emit motionSensitivityChanged(m_motionSensitivity);
+}
+
+qreal IMX6Camera::motionMinimumArea() const
+{
+    return m_motionMinimumArea;
+}
+
+void IMX6Camera::setMotionMinimumArea(qreal value)
+{
+    value = qBound<qreal>(0, value, 1);
+    if (qFuzzyCompare(m_motionMinimumArea + 1, value + 1))
+        return;
+    m_motionMinimumArea = value;
+    if (m_motionDetector)
+        m_motionDetector->setMinimumArea(value);
+    emit motionMinimumAreaChanged(m_motionMinimumArea);
+}
+
+bool IMX6Camera::motion() const
+{
+    return m_motion;
+}
+
+QRectF IMX6Camera::motionRect() const
+{
+    return m_motionRect;
+}
+
+QVariantList IMX6Camera::activeMotionZones() const
+{
+    return m_activeMotionZones;
+}
+
+qreal IMX6Camera::motionDetectionLoad() const
+{
+    return m_motionDetector ? m_motionDetector->load() : 0;
+}
+
+void IMX6Camera::handleMotion(bool motion, const QRectF &boundingBox, const QVariantList &zones)
+{
+    // Queued from the worker, a detector that was switched off may still have spoken
+    if (!m_motionDetector || sender() != m_motionDetector)
+        return;
+
+    const bool started = motion && !m_motion;
+    const bool stopped = !motion && m_motion;
+    m_motion = motion;
+    m_motionRect = boundingBox;
+    m_activeMotionZones = zones;
+    emit motionChanged();
+    if (started)
+        emit motionStarted(m_motionRect);
+    else if (stopped)
+        emit motionStopped();
+}
+
+bool IMX6Camera::lumaStatistics() const
+{
+    return m_lumaStatistics != NULL;
+}
+
+void IMX6Camera::setLumaStatistics(bool value)
+{
+    if (lumaStatistics() == value)
+        return;
+
+    if (value) {
+        m_lumaStatistics = new IMX6CameraLumaStatistics(this);
+        m_lumaStatistics->setRegions(m_statisticsRegions.width(), m_statisticsRegions.height());
+        m_lumaStatistics->setFrameDivisor(processingDivisor());
+        connect(m_lumaStatistics, &IMX6CameraLumaStatistics::resultAvailable, this, &IMX6Camera::takeLumaStatistics);
+        connect(m_lumaStatistics, &IMX6CameraProcessingStage::statisticsChanged, this, &IMX6Camera::lumaStatisticsTimeChanged);
+        m_lumaStatistics->attach(cameraControl);
+    } else {
+        delete m_lumaStatistics;
+        m_lumaStatistics = NULL;
+        memset(&m_lumaResult, 0, sizeof(m_lumaResult));
+        emit lumaStatisticsUpdated();
+    }
+    updateDemand();
+    emit lumaStatisticsChanged(value);
+}
+
+bool IMX6Camera::adaptiveQuality() const
+{
+    return m_governor != NULL;
+}
+
+void IMX6Camera::setAdaptiveQuality(bool value)
+{
+    if (adaptiveQuality() == value)
+        return;
+
+    const int previousLevel = qualityLevel();
+    if (value) {
+        m_governor = new IMX6CameraQualityGovernor(cameraControl, this);
+        m_governor->setWindow(m_window);
+        connect(m_governor, &IMX6CameraQualityGovernor::levelChanged, this, &IMX6Camera::applyQualityLevel);
+    } else {
+        delete m_governor;
+        m_governor = NULL;
+        if (previousLevel != IMX6CameraQualityGovernor::FullQuality)
+            applyQualityLevel();
+    }
+    emit adaptiveQualityChanged(value);
+}
+
+int IMX6Camera::qualityLevel() const
+{
+    return m_governor ? m_governor->level() : IMX6CameraQualityGovernor::FullQuality;
+}
+
+int IMX6Camera::processingDivisor() const
+{
+    return qualityLevel() >= IMX6CameraQualityGovernor::ReducedProcessing ? 2 : 1;
+}
+
+// Levels add up: processing stages first, since nobody sees them, then the frame rate
+void IMX6Camera::applyQualityLevel()
+{
+    const int level = qualityLevel();
+    int rateDivisor = 1;
+    if (level >= IMX6CameraQualityGovernor::QuarterRate)
+        rateDivisor = 4;
+    else if (level >= IMX6CameraQualityGovernor::HalfRate)
+        rateDivisor = 2;
+    cameraControl->setSessionRateDivisor(m_sessionId, rateDivisor);
+    if (m_motionDetector)
+        m_motionDetector->setFrameDivisor(processingDivisor());
+    if (m_lumaStatistics)
+        m_lumaStatistics->setFrameDivisor(processingDivisor());
+    emit qualityLevelChanged(level);
+}
+
+void IMX6Camera::takeLumaStatistics()
+{
+    if (m_lumaStatistics && sender() == m_lumaStatistics && m_lumaStatistics->takeLatest(&m_lumaResult))
+        emit lumaStatisticsUpdated();
+}
+
+QSize IMX6Camera::statisticsRegions() const
+{
+    return m_statisticsRegions;
+}
+
+void IMX6Camera::setStatisticsRegions(const QSize &regions)
+{
+    const QSize bounded(qBound(1, regions.width(), LUMA_STATISTICS_MAX_REGIONS),
+                        qBound(1, regions.height(), LUMA_STATISTICS_MAX_REGIONS));
+    if (m_statisticsRegions == bounded)
+        return;
+    m_statisticsRegions = bounded;
+    if (m_lumaStatistics)
+        m_lumaStatistics->setRegions(bounded.width(), bounded.height());
+    emit statisticsRegionsChanged(m_statisticsRegions);
+}
+
+qreal IMX6Camera::lumaMean() const
+{
+    return m_lumaResult.mean;
+}
+
+qreal IMX6Camera::underexposure() const
+{
+    return m_lumaResult.underexposed;
+}
+
+qreal IMX6Camera::overexposure() const
+{
+    return m_lumaResult.overexposed;
+}
+
+QVariantList IMX6Camera::lumaHistogram() const
+{
+    QVariantList histogram;
+    if (!m_lumaResult.sampleCount)
+        return histogram;
+    histogram.reserve(256);
+    for (int bin = 0; bin < 256; ++bin)
+        histogram.append(m_lumaResult.histogram[bin]);
+    return histogram;
+}
+
+QVariantList IMX6Camera::regionLuma() const
+{
+    QVariantList regions;
+    for (int i = 0; i < m_lumaResult.regionColumns * m_lumaResult.regionRows; ++i)
+        regions.append(m_lumaResult.regions[i]);
+    return regions;
+}
+
+qreal IMX6Camera::lumaStatisticsTime() const
+{
+    return m_lumaStatistics ? m_lumaStatistics->processingTime() : 0;
+}
+
+qreal IMX6Camera::frameRate() const
+{
+    return cameraControl->frameRate();
+}
+
+void IMX6Camera::setFrameRate(qreal rate)
+{
+    // The rate belongs to the device, every item showing it follows
+    cameraControl->setFrameRate(rate);
+}
+
+void IMX6Camera::pullLatestFrame()
+{
+    // Called from the render thread right before the scene is drawn
+    QSharedPointer<IMX6CameraTextureCache> textureCache = IMX6CameraTextureCache::cache(cameraControl, false);
+    if (textureCache.isNull())
+        return;
+    const IMX6CameraFrame frame = cameraControl->latestFrame();
+    if (!frame.isValid() || frame.sequence == m_pulledSequence)
+        return; // Nothing new since the last pass
+    m_pulledSequence = frame.sequence;
+    if (m_changeDetection && isSceneUnchanged(frame)) {
+        // The texture keeps the last frame, this one is requeued once a newer one replaces it
+        m_skippedRenders.ref();
+        emit renderStatisticsChanged();
+        return;
+    }
+    m_renderedFrames.ref();
+    emit renderStatisticsChanged();
+    textureCache->setNextFrame(frame);
+}
+
+void IMX6Camera::retireFrames()
+{
+    // Called from the render thread once the scene is drawn
+    QSharedPointer<IMX6CameraTextureCache> textureCache = IMX6CameraTextureCache::cache(cameraControl, false);
+    if (!textureCache.isNull())
+        textureCache->afterRendering();
+}
+
 void IMX6Camera::present(const IMX6CameraFrame &frame)
 {
+    IMX6_TRACE_SCOPE("present", frame.sequence);
+    if (!m_active || !m_started)
+        return;
+    if (m_changeDetection && isSceneUnchanged(frame)) {
+        // Nothing worth repainting, the buffer goes straight back to the driver
+        m_skippedRenders.ref();
+        emit renderStatisticsChanged();
+        return;
+    }
+    m_renderedFrames.ref();
+    emit renderStatisticsChanged();
+
     m_frameMutex.lock();
-    if (m_frameChanged)
-        m_frame.buffer->release();//Old frame is not updated to video node, replace it with new frame
-    m_frame = frame;
+    m_frame = frame; // An old frame not yet handed to the video node is released here
     m_frameChanged = true;
     m_frameMutex.unlock();
     update();
@@ -156,23 +923,45 @@ void IMX6Camera::scheduleOpenGLContextUpdate()
 
 uint IMX6Camera::contrast() const
 {
+    if (!cameraControl->isParameterSupported(Contrast))
+        return m_contrast;
     return cameraControl->parameter(Contrast);
 }
 
 uint IMX6Camera::saturation() const
 {
+    if (!cameraControl->isParameterSupported(Saturation))
+        return m_saturation;
     return cameraControl->parameter(Saturation);
 }
 
 uint IMX6Camera::sharpening() const
 {
+    if (!cameraControl->isParameterSupported(Sharpening))
+        return m_sharpening;
     return cameraControl->parameter(Sharpening);
 }
 
 uint IMX6Camera::brightness() const
 {
+    if (!cameraControl->isParameterSupported(Brightness))
+        return m_brightness;
     return cameraControl->parameter(Brightness);
+}
 
+qreal IMX6Camera::gamma() const
+{
+    return m_gamma;
+}
+
+QUrl IMX6Camera::lookupTable() const
+{
+    return m_lookupTableUrl;
+}
+
+int IMX6Camera::lookupTableSize() const
+{
+    return m_lookupTable.size();
 }
 
 bool IMX6Camera::mirror() const
@@ -180,11 +969,61 @@ bool IMX6Camera::mirror() const
     return m_isMirror;
 }
 
+bool IMX6Camera::flip() const
+{
+    return m_isFlip;
+}
+
+int IMX6Camera::orientation() const
+{
+    return m_orientation;
+}
+
+IMX6Camera::FillMode IMX6Camera::fillMode() const
+{
+    return m_fillMode;
+}
+
+QRectF IMX6Camera::sourceRect() const
+{
+    return m_sourceRect;
+}
+
+qreal IMX6Camera::zoom() const
+{
+    return m_zoom;
+}
+
+QPointF IMX6Camera::zoomCenter() const
+{
+    return m_zoomCenter;
+}
+
+bool IMX6Camera::sensorCrop() const
+{
+    return m_sensorCrop;
+}
+
+bool IMX6Camera::lowLatency() const
+{
+    return m_lowLatency;
+}
+
 bool IMX6Camera::isCameraConnected() const
 {
     return cameraControl->isCameraConnected();
 }
 
+QVariantMap IMX6Camera::recoveryStatistics() const
+{
+    return cameraControl->recoveryStatistics();
+}
+
+QVariantMap IMX6Camera::dequeueLatency() const
+{
+    return cameraControl->dequeueLatency();
+}
+
 QSize IMX6Camera::sourceSize() const
 {
     return cameraControl->sourceSize();
@@ -203,6 +1042,7 @@ bool IMX6Camera::isParameterSupported(IMX6Camera::CameraParameter id) const
 
 QSGNode *IMX6Camera::updatePaintNode(QSGNode *oldNode, QQuickItem::UpdatePaintNodeData *data)
 {
+    IMX6_TRACE_SCOPE("updatePaintNode", -1);
     Q_UNUSED(data);
 
     if (cameraControl->state() != IMX6CameraControl::ActiveState)
@@ -217,28 +1057,162 @@ QSGNode *IMX6Camera::updatePaintNode(QSGNode *oldNode, QQuickItem::UpdatePaintNo
         scheduleOpenGLContextUpdate();
     }
 
-    if (!videoNode)
+    if (!videoNode) {
         videoNode = createNote(m_format);
+        m_geometryDirty = true;
+        m_adjustmentDirty = true;
+    }
 
-    m_renderedRect = QRect(0, 0, width(), height());
-    m_sourceTextureRect = QRect(0, 0, 1, 1);
-    videoNode->setTexturedRectGeometry(m_renderedRect, m_sourceTextureRect, -1);
+    if (m_adjustmentDirty) {
+        videoNode->setLookupTable(m_lookupTable);
+        videoNode->setAdjustment(adjustment());
+        m_adjustmentDirty = false;
+    }
+
+    // Fill mode, crop, zoom, mirroring and rotation only change the quad and its
+    // texture coordinates, so they are recomputed when the item or its transform
+    // changes, not per frame.
+    if (m_geometryDirty) {
+        updateRects();
+        videoNode->setTexturedRectGeometry(m_renderedRect, m_sourceTextureRect, m_orientation);
+        const QSize bufferSize = cameraControl->bufferSize();
+        const QSize frameSize = cameraControl->frameSize();
+        if (!bufferSize.isEmpty() && !frameSize.isEmpty())
+            videoNode->setTexelSize(QSizeF(1.0 / bufferSize.width(), 1.0 / frameSize.height()));
+        m_geometryDirty = false;
+    }
 
     if (m_frameChanged) {
         videoNode->setCurrentFrame(m_frame);
+        m_frame = IMX6CameraFrame(); // The texture cache holds the frame from now on
         m_frameChanged = false;
     }
 
     return videoNode;
 }
 
+void IMX6Camera::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size())
+        invalidateGeometry();
+    updateActive();
+}
+
+void IMX6Camera::invalidateGeometry()
+{
+    m_geometryDirty = true;
+    update();
+}
+
+QRectF IMX6Camera::visibleSourceRect() const
+{
+    // Source rectangle, in frame pixels, after sourceRect and zoom are applied
+    const QRectF frameRect(QPointF(0, 0), cameraControl->sourceSize());
+    QRectF source = m_sourceRect.isEmpty() ? frameRect : (m_sourceRect & frameRect);
+    if (source.isEmpty())
+        source = frameRect;
+
+    if (m_zoom > 1.0) {
+        const QSizeF zoomedSize = source.size() / m_zoom;
+        QRectF zoomed(QPointF(0, 0), zoomedSize);
+        zoomed.moveCenter(QPointF(source.left() + m_zoomCenter.x() * source.width(),
+                                  source.top() + m_zoomCenter.y() * source.height()));
+        // Pan within the source rectangle, never beyond it
+        zoomed.moveLeft(qBound(source.left(), zoomed.left(), source.right() - zoomed.width()));
+        zoomed.moveTop(qBound(source.top(), zoomed.top(), source.bottom() - zoomed.height()));
+        source = zoomed;
+    }
+    return source;
+}
+
+// Texture coordinates crop against cropRect(), so the frame looks the same
+// with or without the sensor crop
+void IMX6Camera::updateSensorCrop()
+{
+    if (!m_sensorCrop || !cameraControl->isCropSupported())
+        return;
+    // Other items on the device would lose what lies outside this one's view
+    if (cameraControl->hasOtherSessions(m_sessionId))
+        cameraControl->setCropRect(QRect());
+    else
+        cameraControl->setCropRect(visibleSourceRect().toAlignedRect());
+}
+
+void IMX6Camera::updateRects()
+{
+    const bool transposed = m_orientation == 90 || m_orientation == 270;
+    QRectF source = visibleSourceRect();
+    m_renderedRect = QRectF(0, 0, width(), height());
+
+    if (!source.isEmpty() && !m_renderedRect.isEmpty()) {
+        QSizeF displayedSize = source.size();
+        if (transposed)
+            displayedSize.transpose();
+
+        switch (m_fillMode) {
+        case PreserveAspectFit: {
+            const QSizeF scaled = displayedSize.scaled(m_renderedRect.size(), Qt::KeepAspectRatio);
+            QRectF fitted(QPointF(0, 0), scaled);
+            fitted.moveCenter(m_renderedRect.center());
+            m_renderedRect = fitted;
+            break;
+        }
+        case PreserveAspectCrop: {
+            QSizeF visibleSize = m_renderedRect.size().scaled(displayedSize, Qt::KeepAspectRatio);
+            if (transposed)
+                visibleSize.transpose();
+            QRectF cropped(QPointF(0, 0), visibleSize);
+            cropped.moveCenter(source.center());
+            source = cropped;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // Texture coordinates are relative to the part of the sensor the frames contain
+    const QRectF crop = cameraControl->cropRect();
+    if (source.isEmpty() || crop.isEmpty()) {
+        m_sourceTextureRect = QRectF(0, 0, 1, 1);
+    } else {
+        m_sourceTextureRect = QRectF((source.left() - crop.left()) / crop.width(),
+                                     (source.top() - crop.top()) / crop.height(),
+                                     source.width() / crop.width(),
+                                     source.height() / crop.height());
+    }
+
+    // Textures span the whole stride, padding at the end of the lines is never sampled
+    const QSize frameSize = cameraControl->frameSize();
+    const QSize bufferSize = cameraControl->bufferSize();
+    if (!frameSize.isEmpty() && bufferSize.width() > frameSize.width()) {
+        const qreal scale = qreal(frameSize.width()) / bufferSize.width();
+        m_sourceTextureRect = QRectF(m_sourceTextureRect.x() * scale, m_sourceTextureRect.y(),
+                                     m_sourceTextureRect.width() * scale, m_sourceTextureRect.height());
+    }
+
+    // Mirror and flip are given in display space, after rotation
+    bool mirrorTexture = m_isMirror;
+    bool flipTexture = m_isFlip;
+    if (m_orientation == 90 || m_orientation == 270)
+        qSwap(mirrorTexture, flipTexture);
+
+    if (mirrorTexture)
+        m_sourceTextureRect = QRectF(m_sourceTextureRect.right(), m_sourceTextureRect.top(),
+                                     -m_sourceTextureRect.width(), m_sourceTextureRect.height());
+    if (flipTexture)
+        m_sourceTextureRect = QRectF(m_sourceTextureRect.left(), m_sourceTextureRect.bottom(),
+                                     m_sourceTextureRect.width(), -m_sourceTextureRect.height());
+}
+
 QMap<IMX6CameraFrame::PixelFormat, GLenum> QSGVivanteVideoNode::static_VideoFormat2GLFormatMap = QMap<IMX6CameraFrame::PixelFormat, GLenum>();
 
-QSGVivanteVideoNode::QSGVivanteVideoNode(IMX6CameraFrame::PixelFormat format) :
-    mFormat(format), m_orientation(-1)
+QSGVivanteVideoNode::QSGVivanteVideoNode(IMX6CameraControl *control, IMX6CameraFrame::PixelFormat format) :
+    mFormat(format), m_orientation(0)
 {
     setFlag(QSGNode::OwnsMaterial, true);
-    mMaterial = new QSGVivanteVideoMaterial();
+    mMaterial = new QSGVivanteVideoMaterial(control);
     setMaterial(mMaterial);
 }
 
@@ -248,10 +1222,37 @@ QSGVivanteVideoNode::~QSGVivanteVideoNode()
 
 void QSGVivanteVideoNode::setCurrentFrame(const IMX6CameraFrame &frame)
 {
+    IMX6_TRACE_SCOPE("setCurrentFrame", frame.sequence);
     mMaterial->setCurrentFrame(frame);
     markDirty(DirtyMaterial);
 }
 
+void QSGVivanteVideoNode::setAdjustment(const QSGVivanteVideoAdjustment &adjustment)
+{
+    if (adjustment == mMaterial->adjustment())
+        return;
+    // A different feature set is a different material type, the renderer
+    // picks up the matching shader when the material is marked dirty
+    mMaterial->setAdjustment(adjustment);
+    markDirty(DirtyMaterial);
+}
+
+void QSGVivanteVideoNode::setLookupTable(const IMX6CameraLookupTable &table)
+{
+    if (table.serial() == mMaterial->lookupTable().serial())
+        return;
+    mMaterial->setLookupTable(table);
+    markDirty(DirtyMaterial);
+}
+
+void QSGVivanteVideoNode::setTexelSize(const QSizeF &size)
+{
+    if (size == mMaterial->texelSize())
+        return;
+    mMaterial->setTexelSize(size);
+    markDirty(DirtyMaterial);
+}
+
 static inline void qSetGeom(QSGGeometry::TexturedPoint2D *v, const QPointF &p)
 {
     v->x = p.x();
@@ -286,12 +1287,37 @@ void QSGVivanteVideoNode::setTexturedRectGeometry(const QRectF &boundingRect, co
     qSetGeom(v + 2, m_rect.topRight());
     qSetGeom(v + 3, m_rect.bottomRight());
 
-    // and then texture coordinates
-    // tl, bl, tr, br
-    qSetTex(v + 0, textureRect.topLeft());
-    qSetTex(v + 1, textureRect.bottomLeft());
-    qSetTex(v + 2, textureRect.topRight());
-    qSetTex(v + 3, textureRect.bottomRight());
+    // and then texture coordinates, rotated clockwise by orientation
+    switch (orientation) {
+    default:
+        // tl, bl, tr, br
+        qSetTex(v + 0, textureRect.topLeft());
+        qSetTex(v + 1, textureRect.bottomLeft());
+        qSetTex(v + 2, textureRect.topRight());
+        qSetTex(v + 3, textureRect.bottomRight());
+        break;
+    case 90:
+        // bl, br, tl, tr
+        qSetTex(v + 0, textureRect.bottomLeft());
+        qSetTex(v + 1, textureRect.bottomRight());
+        qSetTex(v + 2, textureRect.topLeft());
+        qSetTex(v + 3, textureRect.topRight());
+        break;
+    case 180:
+        // br, tr, bl, tl
+        qSetTex(v + 0, textureRect.bottomRight());
+        qSetTex(v + 1, textureRect.topRight());
+        qSetTex(v + 2, textureRect.bottomLeft());
+        qSetTex(v + 3, textureRect.topLeft());
+        break;
+    case 270:
+        // tr, tl, br, bl
+        qSetTex(v + 0, textureRect.topRight());
+        qSetTex(v + 1, textureRect.topLeft());
+        qSetTex(v + 2, textureRect.bottomRight());
+        qSetTex(v + 3, textureRect.bottomLeft());
+        break;
+    }
 
     if (!geometry())
         setGeometry(g);
@@ -314,12 +1340,21 @@ const QMap<IMX6CameraFrame::PixelFormat, GLenum>& QSGVivanteVideoNode::getVideoF
     return static_VideoFormat2GLFormatMap;
 }
 
-QSGVivanteVideoMaterial::QSGVivanteVideoMaterial() :
+bool QSGVivanteVideoAdjustment::operator==(const QSGVivanteVideoAdjustment &other) const
+{
+    return features == other.features
+            && brightness == other.brightness
+            && contrast == other.contrast
+            && saturation == other.saturation
+            && gamma == other.gamma
+            && sharpen == other.sharpen;
+}
+
+QSGVivanteVideoMaterial::QSGVivanteVideoMaterial(IMX6CameraControl *control) :
     mOpacity(1.0),
-    mWidth(0),
-    mHeight(0),
-    mFormat(IMX6CameraFrame::Format_Invalid),
-    mCurrentTexture(0)
+    mTextureCache(IMX6CameraTextureCache::cache(control)),
+    mLookupTexture(0),
+    mUploadedSerial(0)
 {
 #ifdef QT_VIVANTE_VIDEO_DEBUG
     qDebug() << Q_FUNC_INFO;
@@ -330,36 +1365,33 @@ QSGVivanteVideoMaterial::QSGVivanteVideoMaterial() :
 
 QSGVivanteVideoMaterial::~QSGVivanteVideoMaterial()
 {
-#ifdef ARM_TARGET
-    Q_FOREACH (GLuint id, mBitsToTextureMap.values()) {
-#ifdef QT_VIVANTE_VIDEO_DEBUG
-        qDebug() << "delete texture: " << id;
-#endif
-        glDeleteTextures(1, &id);
-    }
-#endif
-    if (mCurrentFrame.buffer)
-        mCurrentFrame.buffer->release();
-    if (mNextFrame.buffer)
-        mNextFrame.buffer->release();
+    // Materials are deleted on the render thread with its context current
+    QOpenGLContext *glcontext = QOpenGLContext::currentContext();
+    if (mLookupTexture && glcontext)
+        glcontext->functions()->glDeleteTextures(1, &mLookupTexture);
 }
 
 QSGMaterialType *QSGVivanteVideoMaterial::type() const {
-    static QSGMaterialType theType;
-    return &theType;
+    // One type, and so one compiled shader, per combination of features in use
+    static QSGMaterialType types[1 << QSGVivanteVideoAdjustment::FeatureCount];
+    return &types[mAdjustment.features];
 }
 
 QSGMaterialShader *QSGVivanteVideoMaterial::createShader() const {
-    return new QSGVivanteVideoMaterialShader;
+    return new QSGVivanteVideoMaterialShader(mAdjustment.features);
 }
 
 int QSGVivanteVideoMaterial::compare(const QSGMaterial *other) const {
+    // Views of the same stream share one texture, which lets the renderer batch them
     if (this->type() == other->type()) {
         const QSGVivanteVideoMaterial *m = static_cast<const QSGVivanteVideoMaterial *>(other);
-        if (this->mBitsToTextureMap == m->mBitsToTextureMap)
-            return 0;
-        else
-            return 1;
+        if (this->mTextureCache != m->mTextureCache)
+            return this->mTextureCache.data() < m->mTextureCache.data() ? -1 : 1;
+        // Same features with different uniform values can not share a batch
+        if (mAdjustment != m->mAdjustment || mTexelSize != m->mTexelSize
+                || mLookupTable.serial() != m->mLookupTable.serial())
+            return this < m ? -1 : 1;
+        return 0;
     }
     return 1;
 }
@@ -369,13 +1401,7 @@ void QSGVivanteVideoMaterial::updateBlending() {
 }
 
 void QSGVivanteVideoMaterial::setCurrentFrame(const IMX6CameraFrame &frame) {
-    QMutexLocker lock(&mFrameMutex);
-    if (mNextFrame.isValid()) {
-        // Old frame is not binded to texture yet, release it before updating new frame
-        if (!mCurrentFrame.isValid() || mNextFrame.buffer != mCurrentFrame.buffer)
-            mNextFrame.buffer->release();
-    }
-    mNextFrame = frame;
+    mTextureCache->setNextFrame(frame);
 }
 
 void QSGVivanteVideoMaterial::bind()
@@ -385,86 +1411,52 @@ void QSGVivanteVideoMaterial::bind()
         qWarning() << Q_FUNC_INFO << "no QOpenGLContext::currentContext() => return";
         return;
     }
-#ifdef ARM_TARGET
-    QMutexLocker lock(&mFrameMutex);
-    if (mNextFrame.isValid()) {
-        if (mCurrentFrame.buffer)
-            mCurrentFrame.buffer->release();
-        mCurrentFrame = mNextFrame;
-        mCurrentTexture = vivanteMapping(mNextFrame);
-    } else {
-        glBindTexture(GL_TEXTURE_2D, mCurrentTexture);
-    }
-#endif
+    mTextureCache->bind();
 }
 
-GLuint QSGVivanteVideoMaterial::vivanteMapping(IMX6CameraFrame vF)
+QSGVivanteVideoMaterialShader::QSGVivanteVideoMaterialShader(int features) :
+    mFeatures(features),
+    mIdMatrix(-1),
+    mIdTexture(-1),
+    mIdOpacity(-1),
+    mIdBrightness(-1),
+    mIdContrast(-1),
+    mIdSaturation(-1),
+    mIdGamma(-1),
+    mIdSharpen(-1),
+    mIdTexelSize(-1),
+    mIdLookupTable(-1),
+    mIdLookupSize(-1)
 {
-    QOpenGLContext *glcontext = QOpenGLContext::currentContext();
-    if (glcontext == 0) {
-        qWarning() << Q_FUNC_INFO << "no QOpenGLContext::currentContext() => return 0";
-        return 0;
-    }
-#ifndef ARM_TARGET
-    Q_UNUSED(vF)
-#else
-    static PFNGLTEXDIRECTVIVMAPPROC glTexDirectVIVMap_LOCAL = 0;
-    static PFNGLTEXDIRECTINVALIDATEVIVPROC glTexDirectInvalidateVIV_LOCAL = 0;
-
-    if (glTexDirectVIVMap_LOCAL == 0 || glTexDirectInvalidateVIV_LOCAL == 0) {
-        glTexDirectVIVMap_LOCAL = reinterpret_cast<PFNGLTEXDIRECTVIVMAPPROC>(glcontext->getProcAddress("glTexDirectVIVMap"));
-        glTexDirectInvalidateVIV_LOCAL = reinterpret_cast<PFNGLTEXDIRECTINVALIDATEVIVPROC>(glcontext->getProcAddress("glTexDirectInvalidateVIV"));
-    }
-    if (glTexDirectVIVMap_LOCAL == 0 || glTexDirectInvalidateVIV_LOCAL == 0) {
-        qWarning() << Q_FUNC_INFO << "couldn't find \"glTexDirectVIVMap\" and/or \"glTexDirectInvalidateVIV\" => do nothing and return";
-        return 0;
-    }
-
-    if (mWidth != vF.size.width() || mHeight != vF.size.height() || mFormat != vF.format) {
-        mWidth = vF.size.width();
-        mHeight = vF.size.height();
-        mFormat = vF.format;
-        Q_FOREACH (GLuint id, mBitsToTextureMap.values()) {
-#ifdef QT_VIVANTE_VIDEO_DEBUG
-            qDebug() << "delete texture: " << id;
-#endif
-            glDeleteTextures(1, &id);
-        }
-        mBitsToTextureMap.clear();
-    }
-
-    if (!mBitsToTextureMap.contains(vF.buffer->start())) {
-        GLuint tmpTexId;
-        glGenTextures(1, &tmpTexId);
-        mBitsToTextureMap.insert(vF.buffer->start(), tmpTexId);
-
-        const uchar *constBits = vF.buffer->start();
-        void *bits = (void*)constBits;
-
-        GLuint physical = ~0U;
-
-        glBindTexture(GL_TEXTURE_2D, tmpTexId);
-        glTexDirectVIVMap_LOCAL(GL_TEXTURE_2D,
-                                vF.size.width(), vF.size.height(),
-                                QSGVivanteVideoNode::getVideoFormat2GLFormatMap().value(vF.format),
-                                &bits, &physical);
+}
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexDirectInvalidateVIV_LOCAL(GL_TEXTURE_2D);
+void QSGVivanteVideoMaterial::bindLookupTable()
+{
+    QOpenGLContext *glcontext = QOpenGLContext::currentContext();
+    if (glcontext == 0 || mLookupTable.isNull())
+        return;
 
-        return tmpTexId;
+    QOpenGLFunctions *gl = glcontext->functions();
+    gl->glActiveTexture(GL_TEXTURE1);
+    if (!mLookupTexture) {
+        gl->glGenTextures(1, &mLookupTexture);
+        gl->glBindTexture(GL_TEXTURE_2D, mLookupTexture);
+        // Linear filtering interpolates red and green, blue is blended between
+        // two slices in the shader
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     } else {
-        glBindTexture(GL_TEXTURE_2D, mBitsToTextureMap.value(vF.buffer->start()));
-        glTexDirectInvalidateVIV_LOCAL(GL_TEXTURE_2D);
-        return mBitsToTextureMap.value(vF.buffer->start());
+        gl->glBindTexture(GL_TEXTURE_2D, mLookupTexture);
     }
-
-    Q_ASSERT(false); // should never reach this line!;
-#endif
-    return 0;
+    if (mUploadedSerial != mLookupTable.serial()) {
+        gl->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        gl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mLookupTable.atlasWidth(), mLookupTable.atlasHeight(),
+                         0, GL_RGBA, GL_UNSIGNED_BYTE, mLookupTable.atlas().constData());
+        mUploadedSerial = mLookupTable.serial();
+    }
+    gl->glActiveTexture(GL_TEXTURE0);
 }
 
 void QSGVivanteVideoMaterialShader::updateState(const RenderState &state,
@@ -475,6 +1467,11 @@ void QSGVivanteVideoMaterialShader::updateState(const RenderState &state,
 
     QSGVivanteVideoMaterial *mat = static_cast<QSGVivanteVideoMaterial *>(newMaterial);
     program()->setUniformValue(mIdTexture, 0);
+    if (mFeatures & QSGVivanteVideoAdjustment::LookupTable) {
+        mat->bindLookupTable();
+        program()->setUniformValue(mIdLookupTable, 1);
+        program()->setUniformValue(mIdLookupSize, GLfloat(mat->lookupTable().size()));
+    }
     mat->bind();
     if (state.isOpacityDirty()) {
         mat->setOpacity(state.opacity());
@@ -482,6 +1479,22 @@ void QSGVivanteVideoMaterialShader::updateState(const RenderState &state,
     }
     if (state.isMatrixDirty())
         program()->setUniformValue(mIdMatrix, state.combinedMatrix());
+
+    if (mFeatures) {
+        const QSGVivanteVideoAdjustment &adjustment = mat->adjustment();
+        if (mFeatures & QSGVivanteVideoAdjustment::Brightness)
+            program()->setUniformValue(mIdBrightness, adjustment.brightness);
+        if (mFeatures & QSGVivanteVideoAdjustment::Contrast)
+            program()->setUniformValue(mIdContrast, adjustment.contrast);
+        if (mFeatures & QSGVivanteVideoAdjustment::Saturation)
+            program()->setUniformValue(mIdSaturation, adjustment.saturation);
+        if (mFeatures & QSGVivanteVideoAdjustment::Gamma)
+            program()->setUniformValue(mIdGamma, 1.0f / adjustment.gamma);
+        if (mFeatures & QSGVivanteVideoAdjustment::Sharpen) {
+            program()->setUniformValue(mIdSharpen, adjustment.sharpen);
+            program()->setUniformValue(mIdTexelSize, mat->texelSize());
+        }
+    }
 }
 
 const char * const *QSGVivanteVideoMaterialShader::attributeNames() const {
@@ -517,11 +1530,87 @@ const char *QSGVivanteVideoMaterialShader::fragmentShader() const {
             "{"
             "  gl_FragColor = vec4(texture2D( texture, qt_TexCoord ).rgb, 1.0) * opacity;\n"
             "}";
-    return shader;
+    if (!mFeatures)
+        return shader;
+
+    // Everything happens in the one pass that samples the texture anyway. Only the
+    // features in use are compiled in, so an unused adjustment costs nothing.
+    static const char *adjustingShader =
+            "uniform sampler2D texture;                                             \n"
+            "uniform lowp float opacity;                                            \n"
+            "uniform mediump float brightness;                                      \n"
+            "uniform mediump float contrast;                                        \n"
+            "uniform mediump float saturation;                                      \n"
+            "uniform mediump float inverseGamma;                                    \n"
+            "uniform mediump float sharpen;                                         \n"
+            "uniform highp vec2 texelSize;                                          \n"
+            "uniform sampler2D lookupTable;                                         \n"
+            "uniform highp float lookupSize;                                        \n"
+            "varying highp vec2 qt_TexCoord;                                        \n"
+            "void main() {                                                          \n"
+            "    mediump vec3 rgb = texture2D(texture, qt_TexCoord).rgb;            \n"
+            "#ifdef ADJUST_SHARPEN                                                  \n"
+            "    mediump vec3 blur = 0.25 * (                                       \n"
+            "        texture2D(texture, qt_TexCoord - vec2(texelSize.x, 0.0)).rgb + \n"
+            "        texture2D(texture, qt_TexCoord + vec2(texelSize.x, 0.0)).rgb + \n"
+            "        texture2D(texture, qt_TexCoord - vec2(0.0, texelSize.y)).rgb + \n"
+            "        texture2D(texture, qt_TexCoord + vec2(0.0, texelSize.y)).rgb); \n"
+            "    rgb += sharpen * (rgb - blur);                                     \n"
+            "#endif                                                                 \n"
+            "#ifdef ADJUST_LOOKUP_TABLE                                             \n"
+            "    highp vec3 cell = clamp(rgb, 0.0, 1.0) * (lookupSize - 1.0);       \n"
+            "    highp float slice = floor(cell.b);                                 \n"
+            "    highp float nextSlice = min(slice + 1.0, lookupSize - 1.0);        \n"
+            "    highp vec2 lookup = (cell.rg + 0.5)                                \n"
+            "                      / vec2(lookupSize * lookupSize, lookupSize);     \n"
+            "    rgb = mix(texture2D(lookupTable, lookup + vec2(slice / lookupSize, 0.0)).rgb,     \n"
+            "              texture2D(lookupTable, lookup + vec2(nextSlice / lookupSize, 0.0)).rgb, \n"
+            "              cell.b - slice);                                         \n"
+            "#endif                                                                 \n"
+            "#ifdef ADJUST_CONTRAST                                                 \n"
+            "    rgb = (rgb - 0.5) * contrast + 0.5;                                \n"
+            "#endif                                                                 \n"
+            "#ifdef ADJUST_BRIGHTNESS                                               \n"
+            "    rgb += brightness;                                                 \n"
+            "#endif                                                                 \n"
+            "#ifdef ADJUST_SATURATION                                               \n"
+            "    mediump float luma = dot(rgb, vec3(0.299, 0.587, 0.114));          \n"
+            "    rgb = mix(vec3(luma), rgb, saturation);                            \n"
+            "#endif                                                                 \n"
+            "#ifdef ADJUST_GAMMA                                                    \n"
+            "    rgb = pow(clamp(rgb, 0.0, 1.0), vec3(inverseGamma));               \n"
+            "#endif                                                                 \n"
+            "    gl_FragColor = vec4(clamp(rgb, 0.0, 1.0), 1.0) * opacity;          \n"
+            "}";
+
+    if (mFragmentShader.isEmpty()) {
+        if (mFeatures & QSGVivanteVideoAdjustment::Sharpen)
+            mFragmentShader += "#define ADJUST_SHARPEN\n";
+        if (mFeatures & QSGVivanteVideoAdjustment::LookupTable)
+            mFragmentShader += "#define ADJUST_LOOKUP_TABLE\n";
+        if (mFeatures & QSGVivanteVideoAdjustment::Contrast)
+            mFragmentShader += "#define ADJUST_CONTRAST\n";
+        if (mFeatures & QSGVivanteVideoAdjustment::Brightness)
+            mFragmentShader += "#define ADJUST_BRIGHTNESS\n";
+        if (mFeatures & QSGVivanteVideoAdjustment::Saturation)
+            mFragmentShader += "#define ADJUST_SATURATION\n";
+        if (mFeatures & QSGVivanteVideoAdjustment::Gamma)
+            mFragmentShader += "#define ADJUST_GAMMA\n";
+        mFragmentShader += adjustingShader;
+    }
+    return mFragmentShader.constData();
 }
 
 void QSGVivanteVideoMaterialShader::initialize() {
     mIdMatrix = program()->uniformLocation("qt_Matrix");
     mIdTexture = program()->uniformLocation("texture");
     mIdOpacity = program()->uniformLocation("opacity");
+    mIdBrightness = program()->uniformLocation("brightness");
+    mIdContrast = program()->uniformLocation("contrast");
+    mIdSaturation = program()->uniformLocation("saturation");
+    mIdGamma = program()->uniformLocation("inverseGamma");
+    mIdSharpen = program()->uniformLocation("sharpen");
+    mIdTexelSize = program()->uniformLocation("texelSize");
+    mIdLookupTable = program()->uniformLocation("lookupTable");
+    mIdLookupSize = program()->uniformLocation("lookupSize");
 }
@@ -38,16 +38,53 @@
 
 #include <QObject>
 #include <QQuickItem>
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QMutex>
+#include <QPointer>
 #include <QSGMaterial>
+#include <QSharedPointer>
 #include <QSize>
+#include <QUrl>
 #include <QtQuick/qsgnode.h>
 #include "imx6cameracontrol.h"
+#include "imx6cameralookuptable.h"
+#include "imx6cameralumastatistics.h"
+#include "imx6cameramotiondetector.h"
+#include "imx6cameraqualitygovernor.h"
+#include "imx6cameratexturecache.h"
+
+// Colour correction done in the fragment shader when the sensor has no control for it
+struct QSGVivanteVideoAdjustment
+{
+    enum Feature {
+        Brightness = 0x01,
+        Contrast = 0x02,
+        Saturation = 0x04,
+        Gamma = 0x08,
+        Sharpen = 0x10,
+        LookupTable = 0x20,
+        FeatureCount = 6
+    };
+
+    QSGVivanteVideoAdjustment()
+        : features(0), brightness(0.0f), contrast(1.0f), saturation(1.0f), gamma(1.0f), sharpen(0.0f) { }
+
+    bool operator==(const QSGVivanteVideoAdjustment &other) const;
+    bool operator!=(const QSGVivanteVideoAdjustment &other) const { return !(*this == other); }
+
+    int features;       // Only these are compiled into the shader
+    float brightness;   // Offset added to every channel, [-0.5, 0.5]
+    float contrast;     // Scale around mid grey, 1.0 is neutral
+    float saturation;   // 0.0 is grey, 1.0 is neutral
+    float gamma;        // 1.0 is neutral
+    float sharpen;      // Unsharp mask amount, 0.0 is off
+};
 
 class QSGVivanteVideoMaterial : public QSGMaterial
 {
 public:
-    QSGVivanteVideoMaterial();
+    QSGVivanteVideoMaterial(IMX6CameraControl *control);
     ~QSGVivanteVideoMaterial();
 
     virtual QSGMaterialType *type() const;
@@ -56,23 +93,31 @@ public:
     void updateBlending();
     void setCurrentFrame(const IMX6CameraFrame &frame);
     void bind();
-    GLuint vivanteMapping(IMX6CameraFrame texIdVideoFramePair);
     void setOpacity(float o) { mOpacity = o; }
+    void setAdjustment(const QSGVivanteVideoAdjustment &adjustment) { mAdjustment = adjustment; }
+    const QSGVivanteVideoAdjustment &adjustment() const { return mAdjustment; }
+    void setTexelSize(const QSizeF &size) { mTexelSize = size; }
+    QSizeF texelSize() const { return mTexelSize; }
+    void setLookupTable(const IMX6CameraLookupTable &table) { mLookupTable = table; }
+    const IMX6CameraLookupTable &lookupTable() const { return mLookupTable; }
+    // Binds the lookup table texture to unit 1, uploading it first if it changed
+    void bindLookupTable();
 
 private:
     qreal mOpacity;
-    int mWidth;
-    int mHeight;
-    IMX6CameraFrame::PixelFormat mFormat;
-    QMap<const uchar*, GLuint> mBitsToTextureMap;
-    IMX6CameraFrame mCurrentFrame, mNextFrame;
-    GLuint mCurrentTexture;
-    QMutex mFrameMutex;
+    QSharedPointer<IMX6CameraTextureCache> mTextureCache;
+    QSGVivanteVideoAdjustment mAdjustment;
+    QSizeF mTexelSize;
+    IMX6CameraLookupTable mLookupTable;
+    GLuint mLookupTexture;
+    quint32 mUploadedSerial;
 };
 
 class QSGVivanteVideoMaterialShader : public QSGMaterialShader
 {
 public:
+    explicit QSGVivanteVideoMaterialShader(int features = 0);
+
     void updateState(const RenderState &state, QSGMaterial *newMaterial, QSGMaterial *oldMaterial);
     virtual char const *const *attributeNames() const;
 
@@ -82,19 +127,35 @@ protected:
     virtual void initialize();
 
 private:
+    int mFeatures;
+    mutable QByteArray mFragmentShader;
     int mIdMatrix;
     int mIdTexture;
     int mIdOpacity;
+    int mIdBrightness;
+    int mIdContrast;
+    int mIdSaturation;
+    int mIdGamma;
+    int mIdSharpen;
+    int mIdTexelSize;
+    int mIdLookupTable;
+    int mIdLookupSize;
 };
 
 class QSGVivanteVideoNode : public QSGGeometryNode
 {
 public:
-    QSGVivanteVideoNode(IMX6CameraFrame::PixelFormat format);
+    QSGVivanteVideoNode(IMX6CameraControl *control, IMX6CameraFrame::PixelFormat format);
     ~QSGVivanteVideoNode();
 
     virtual IMX6CameraFrame::PixelFormat pixelFormat() const { return mFormat; }
     void setCurrentFrame(const IMX6CameraFrame &frame);
+    void setAdjustment(const QSGVivanteVideoAdjustment &adjustment);
+    // Size of one source pixel in texture coordinates, used by sharpening
+    void setTexelSize(const QSizeF &size);
+    void setLookupTable(const IMX6CameraLookupTable &table);
+    // orientation is the clockwise rotation in degrees (0, 90, 180 or 270).
+    // Mirroring is expressed by a textureRect with negative width and/or height.
     void setTexturedRectGeometry(const QRectF &boundingRect, const QRectF &textureRect, int orientation);
     static const QMap<IMX6CameraFrame::PixelFormat, GLenum>& getVideoFormat2GLFormatMap();
 
@@ -113,12 +174,54 @@ class IMX6Camera : public QQuickItem
 {
     Q_OBJECT
     Q_ENUMS(CameraParameter)
+    Q_ENUMS(FillMode)
+    Q_ENUMS(IdlePolicy)
     Q_PROPERTY(qreal contrast READ contrast WRITE setContrast NOTIFY contrastChanged)
     Q_PROPERTY(qreal saturation READ saturation WRITE setSaturation NOTIFY saturationChanged)
     Q_PROPERTY(qreal brightness READ brightness WRITE setBrightness NOTIFY brightnessChanged)
+    Q_PROPERTY(qreal sharpening READ sharpening WRITE setSharpening NOTIFY sharpeningChanged)
+    Q_PROPERTY(qreal gamma READ gamma WRITE setGamma NOTIFY gammaChanged)
+    Q_PROPERTY(QUrl lookupTable READ lookupTable WRITE setLookupTable NOTIFY lookupTableChanged)
+    Q_PROPERTY(int lookupTableSize READ lookupTableSize NOTIFY lookupTableSizeChanged)
     Q_PROPERTY(bool mirror READ mirror WRITE setMirror NOTIFY mirrorChanged)
+    Q_PROPERTY(bool flip READ flip WRITE setFlip NOTIFY flipChanged)
+    Q_PROPERTY(int orientation READ orientation WRITE setOrientation NOTIFY orientationChanged)
     Q_PROPERTY(bool isCameraConnected READ isCameraConnected NOTIFY cameraConnectionChanged)
+    Q_PROPERTY(QVariantMap recoveryStatistics READ recoveryStatistics NOTIFY recoveryStatisticsChanged)
+    Q_PROPERTY(QVariantMap dequeueLatency READ dequeueLatency NOTIFY dequeueLatencyChanged)
     Q_PROPERTY(QSize sourceSize READ sourceSize NOTIFY sourceSizeChanged)
+    Q_PROPERTY(FillMode fillMode READ fillMode WRITE setFillMode NOTIFY fillModeChanged)
+    Q_PROPERTY(QRectF sourceRect READ sourceRect WRITE setSourceRect NOTIFY sourceRectChanged)
+    Q_PROPERTY(qreal zoom READ zoom WRITE setZoom NOTIFY zoomChanged)
+    Q_PROPERTY(QPointF zoomCenter READ zoomCenter WRITE setZoomCenter NOTIFY zoomCenterChanged)
+    Q_PROPERTY(bool sensorCrop READ sensorCrop WRITE setSensorCrop NOTIFY sensorCropChanged)
+    Q_PROPERTY(bool lowLatency READ lowLatency WRITE setLowLatency NOTIFY lowLatencyChanged)
+    Q_PROPERTY(IdlePolicy idlePolicy READ idlePolicy WRITE setIdlePolicy NOTIFY idlePolicyChanged)
+    Q_PROPERTY(bool active READ active NOTIFY activeChanged)
+    Q_PROPERTY(qreal frameRate READ frameRate WRITE setFrameRate NOTIFY frameRateChanged)
+    Q_PROPERTY(bool changeDetection READ changeDetection WRITE setChangeDetection NOTIFY changeDetectionChanged)
+    Q_PROPERTY(qreal changeThreshold READ changeThreshold WRITE setChangeThreshold NOTIFY changeThresholdChanged)
+    Q_PROPERTY(int refreshInterval READ refreshInterval WRITE setRefreshInterval NOTIFY refreshIntervalChanged)
+    Q_PROPERTY(int renderedFrames READ renderedFrames NOTIFY renderStatisticsChanged)
+    Q_PROPERTY(int skippedRenders READ skippedRenders NOTIFY renderStatisticsChanged)
+    Q_PROPERTY(bool motionDetection READ motionDetection WRITE setMotionDetection NOTIFY motionDetectionChanged)
+    Q_PROPERTY(QVariantList motionZones READ motionZones WRITE setMotionZones NOTIFY motionZonesChanged)
+    Q_PROPERTY(int motionSensitivity READ motionSensitivity WRITE setMotionSensitivity NOTIFY motionSensitivityChanged)
+    Q_PROPERTY(qreal motionMinimumArea READ motionMinimumArea WRITE setMotionMinimumArea NOTIFY motionMinimumAreaChanged)
+    Q_PROPERTY(bool motion READ motion NOTIFY motionChanged)
+    Q_PROPERTY(QRectF motionRect READ motionRect NOTIFY motionChanged)
+    Q_PROPERTY(QVariantList activeMotionZones READ activeMotionZones NOTIFY motionChanged)
+    Q_PROPERTY(qreal motionDetectionLoad READ motionDetectionLoad NOTIFY motionDetectionLoadChanged)
+    Q_PROPERTY(bool lumaStatistics READ lumaStatistics WRITE setLumaStatistics NOTIFY lumaStatisticsChanged)
+    Q_PROPERTY(QSize statisticsRegions READ statisticsRegions WRITE setStatisticsRegions NOTIFY statisticsRegionsChanged)
+    Q_PROPERTY(qreal lumaMean READ lumaMean NOTIFY lumaStatisticsUpdated)
+    Q_PROPERTY(qreal underexposure READ underexposure NOTIFY lumaStatisticsUpdated)
+    Q_PROPERTY(qreal overexposure READ overexposure NOTIFY lumaStatisticsUpdated)
+    Q_PROPERTY(QVariantList lumaHistogram READ lumaHistogram NOTIFY lumaStatisticsUpdated)
+    Q_PROPERTY(QVariantList regionLuma READ regionLuma NOTIFY lumaStatisticsUpdated)
+    Q_PROPERTY(qreal lumaStatisticsTime READ lumaStatisticsTime NOTIFY lumaStatisticsTimeChanged)
+    Q_PROPERTY(bool adaptiveQuality READ adaptiveQuality WRITE setAdaptiveQuality NOTIFY adaptiveQualityChanged)
+    Q_PROPERTY(int qualityLevel READ qualityLevel NOTIFY qualityLevelChanged)
 
 public:
     IMX6Camera();
@@ -137,13 +240,67 @@ public:
         HorizontaMirror,
     };
 
+    enum FillMode {
+        Stretch,
+        PreserveAspectFit,
+        PreserveAspectCrop
+    };
+
+    // What the camera does while the item is hidden, transparent or off-screen
+    enum IdlePolicy {
+        DecimateWhenIdle = IMX6CameraControl::DecimateWhenIdle,
+        PauseWhenIdle = IMX6CameraControl::PauseWhenIdle
+    };
+
     uint contrast() const;
     uint saturation() const;
     uint sharpening() const;
     uint brightness() const;
+    qreal gamma() const;
+    QUrl lookupTable() const;
+    int lookupTableSize() const;
     bool mirror() const;
+    bool flip() const;
+    int orientation() const;
     bool isCameraConnected() const;
+    QVariantMap recoveryStatistics() const;
+    QVariantMap dequeueLatency() const;
     QSize sourceSize() const;
+    FillMode fillMode() const;
+    QRectF sourceRect() const;
+    qreal zoom() const;
+    QPointF zoomCenter() const;
+    bool sensorCrop() const;
+    bool lowLatency() const;
+    IdlePolicy idlePolicy() const;
+    bool active() const;
+    qreal frameRate() const;
+    bool changeDetection() const;
+    qreal changeThreshold() const;
+    int refreshInterval() const;
+    int renderedFrames() const;
+    int skippedRenders() const;
+    bool motionDetection() const;
+    QVariantList motionZones() const;
+    int motionSensitivity() const;
+    qreal motionMinimumArea() const;
+    bool motion() const;
+    QRectF motionRect() const;
+    QVariantList activeMotionZones() const;
+    qreal motionDetectionLoad() const;
+    bool lumaStatistics() const;
+    QSize statisticsRegions() const;
+    qreal lumaMean() const;
+    qreal underexposure() const;
+    qreal overexposure() const;
+    QVariantList lumaHistogram() const;
+    QVariantList regionLuma() const;
+    qreal lumaStatisticsTime() const;
+    bool adaptiveQuality() const;
+    // 0 is full quality, see IMX6CameraQualityGovernor::Level for the others
+    int qualityLevel() const;
+    // The newest statistics for C++ users, valid while lumaStatistics is on
+    const IMX6CameraLumaStatisticsResult &lumaStatisticsResult() const { return m_lumaResult; }
 
 public Q_SLOTS:
     void start();
@@ -153,7 +310,31 @@ public Q_SLOTS:
     void setSaturation(uint value);
     void setSharpening(uint value);
     void setBrightness(uint value);
+    void setGamma(qreal value);
+    void setLookupTable(const QUrl &url);
+    // Reads the lookup table file again, for calibration tools that rewrite it
+    void reloadLookupTable();
     void setMirror(bool value);
+    void setFlip(bool value);
+    void setOrientation(int value);
+    void setFillMode(FillMode mode);
+    void setSourceRect(const QRectF &rect);
+    void setZoom(qreal value);
+    void setZoomCenter(const QPointF &center);
+    void setSensorCrop(bool value);
+    void setLowLatency(bool value);
+    void setIdlePolicy(IdlePolicy policy);
+    void setFrameRate(qreal rate);
+    void setChangeDetection(bool value);
+    void setChangeThreshold(qreal value);
+    void setRefreshInterval(int milliseconds);
+    void setMotionDetection(bool value);
+    void setMotionZones(const QVariantList &zones);
+    void setMotionSensitivity(int value);
+    void setMotionMinimumArea(qreal value);
+    void setLumaStatistics(bool value);
+    void setStatisticsRegions(const QSize &regions);
+    void setAdaptiveQuality(bool value);
     void present(const IMX6CameraFrame &frame);
     void updateOpenGLContext();
     bool isParameterSupported(CameraParameter id) const;
@@ -163,14 +344,71 @@ Q_SIGNALS:
     void saturationChanged(uint);
     void sharpeningChanged(uint);
     void brightnessChanged(uint);
+    void gammaChanged(qreal);
+    void lookupTableChanged(const QUrl &);
+    void lookupTableSizeChanged(int);
     void mirrorChanged(bool);
+    void flipChanged(bool);
+    void orientationChanged(int);
     void cameraConnectionChanged(bool);
+    void recoveryStatisticsChanged();
+    void dequeueLatencyChanged();
     void sourceSizeChanged(QSize);
+    void fillModeChanged(FillMode);
+    void sourceRectChanged(const QRectF &);
+    void zoomChanged(qreal);
+    void zoomCenterChanged(const QPointF &);
+    void sensorCropChanged(bool);
+    void lowLatencyChanged(bool);
+    void idlePolicyChanged(IdlePolicy);
+    void activeChanged(bool);
+    void frameRateChanged(qreal);
+    void changeDetectionChanged(bool);
+    void changeThresholdChanged(qreal);
+    void refreshIntervalChanged(int);
+    void renderStatisticsChanged();
+    void motionDetectionChanged(bool);
+    void motionZonesChanged(const QVariantList &);
+    void motionSensitivityChanged(int);
+    void motionMinimumAreaChanged(qreal);
+    void motionChanged();
+    void motionStarted(const QRectF &rect);
+    void motionStopped();
+    void motionDetectionLoadChanged();
+    void lumaStatisticsChanged(bool);
+    void statisticsRegionsChanged(const QSize &);
+    void lumaStatisticsUpdated();
+    void lumaStatisticsTimeChanged();
+    void adaptiveQualityChanged(bool);
+    void qualityLevelChanged(int);
 
 protected:
     QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *);
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry);
+
+private Q_SLOTS:
+    void invalidateGeometry();
+    void handleWindowChanged(QQuickWindow *window);
+    void pullLatestFrame();
+    void retireFrames();
+    void handleFrameAvailable();
+    void trackAncestors();
+    void updateActive();
+    void updateDemand();
+    void handleMotion(bool motion, const QRectF &boundingBox, const QVariantList &zones);
+    void takeLumaStatistics();
+    void applyQualityLevel();
+    void applyColourParameters();
 
 private:
+    QRectF visibleSourceRect() const;
+    void updateRects();
+    void updateSensorCrop();
+    bool isSceneUnchanged(const IMX6CameraFrame &frame);
+    bool setColourParameter(CameraParameter id, uint value, uint *member);
+    int processingDivisor() const;
+    QSGVivanteVideoAdjustment adjustment() const;
+
     QMutex m_frameMutex;
     bool m_frameChanged;
     QRectF m_renderedRect;         // Destination pixel coordinates, clipped
@@ -180,11 +418,50 @@ private:
     IMX6CameraControl *cameraControl;
     IMX6CameraFrame m_frame;
     bool m_isMirror;
+    bool m_isFlip;
+    int m_orientation;
+    bool m_geometryDirty;
+    FillMode m_fillMode;
+    QRectF m_sourceRect;
+    qreal m_zoom;
+    QPointF m_zoomCenter;
+    bool m_sensorCrop;
+    bool m_lowLatency;
+    QQuickWindow *m_window;
+    IdlePolicy m_idlePolicy;
+    bool m_active;
+    QList<QPointer<QQuickItem> > m_trackedAncestors;
+    bool m_changeDetection;
+    qreal m_changeThreshold;    // Mean luma difference per signature cell
+    int m_refreshInterval;
+    QMutex m_signatureMutex;        // Guards m_renderedSignature and m_sinceRender
+    QByteArray m_renderedSignature;
+    QElapsedTimer m_sinceRender;
+    QAtomicInt m_renderedFrames;    // Counted on the render thread in low-latency mode
+    QAtomicInt m_skippedRenders;
+    quint32 m_pulledSequence;       // Render thread, the last frame pullLatestFrame() judged
+    IMX6CameraMotionDetector *m_motionDetector;
+    QVariantList m_motionZones;
+    int m_motionSensitivity;
+    qreal m_motionMinimumArea;
+    bool m_motion;
+    QRectF m_motionRect;
+    QVariantList m_activeMotionZones;
+    IMX6CameraLumaStatistics *m_lumaStatistics;
+    QSize m_statisticsRegions;
+    IMX6CameraLumaStatisticsResult m_lumaResult;
+    IMX6CameraQualityGovernor *m_governor;
     uint m_contrast;
     uint m_saturation;
     uint m_sharpening;
     uint m_brightness;
+    int m_setColourParameters;  // Bit per CameraParameter set from QML, the sensor gets them once loaded
+    qreal m_gamma;
+    QUrl m_lookupTableUrl;
+    IMX6CameraLookupTable m_lookupTable;
+    bool m_adjustmentDirty;
     int m_sessionId;
+    bool m_started;
 };
 
 #endif // IMAX6CAMERA_H
@@ -35,12 +35,17 @@
 ****************************************************************************/
 #include "imx6camera_plugin.h"
 #include "imx6camera.h"
+#include "imx6camerajpegencoder.h"
+#include "imx6cameramosaic.h"
+#include "imx6camerapreeventbuffer.h"
+#include "imx6camerasynchronizer.h"
+#include "imx6cameratrace.h"
+#include "imx6cameravideosource.h"
 IMX6CameraPlugin::IMX6CameraPlugin(QObject *parent) :
     QQmlExtensionPlugin(parent)
 {
-    // Create initial camera control, it is not attached to camera quick item
-    int id;
-    IMX6CameraControl::cameraControl(&id, this);
+    // Controls are created by the first item that uses a device, and the device
+    // is only loaded, on a worker thread, once that item wants frames.
 }
 
 void IMX6CameraPlugin::initializeEngine(QQmlEngine *engine, const char *uri)
@@ -52,4 +57,10 @@ void IMX6CameraPlugin::initializeEngine(QQmlEngine *engine, const char *uri)
 void IMX6CameraPlugin::registerTypes(const char *uri)
 {
     qmlRegisterType<IMX6Camera>(uri, 1, 0, "IMX6Camera");
+    qmlRegisterType<IMX6CameraJpegEncoder>(uri, 1, 0, "IMX6CameraJpegEncoder");
+    qmlRegisterType<IMX6CameraMosaic>(uri, 1, 0, "IMX6CameraMosaic");
+    qmlRegisterType<IMX6CameraPreEventBuffer>(uri, 1, 0, "IMX6CameraPreEventBuffer");
+    qmlRegisterType<IMX6CameraSynchronizer>(uri, 1, 0, "IMX6CameraSynchronizer");
+    qmlRegisterType<IMX6CameraTracer>(uri, 1, 0, "IMX6CameraTracer");
+    qmlRegisterType<IMX6CameraVideoSource>(uri, 1, 0, "IMX6CameraVideoSource");
 }
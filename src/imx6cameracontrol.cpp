@@ -36,22 +36,50 @@
 
 #include "imx6cameracontrol.h"
 #include "imx6camera.h"
+#include "imx6cameraframepublisher.h"
+#include "imx6camerasimd.h"
+#include "imx6cameratrace.h"
+#include <QElapsedTimer>
+#include <QMetaMethod>
+#include <QMutex>
+#include <QRunnable>
 #include <QSet>
 #include <QSocketNotifier>
+#include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 
 #include <linux/videodev2.h>
 #include <libv4l2.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <cerrno>
+#include <climits>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 #include "math.h"
 
 #define V_MAP_MODE V4L2_MEMORY_MMAP
 #define V_BUFFER_COUNT 4
 #define V4L2_PREFERRED_FORMAT V4L2_PIX_FMT_YUV420
+#define IDLE_FRAME_RATE 1
+#define SIGNATURE_COLUMNS 32
+#define SIGNATURE_ROWS 24
+#define CAMERA_LOAD_DETECTION_INTERVAL 200
+#define CAMERA_REMOVE_DETECTION_INTERVAL 1000
+#define RECOVERY_CONFIRM_TIMEOUT 1000   // A recovery step counts once a frame arrives within this
+#define STREAM_STALL_TIMEOUT 3000       // Active stream without frames, longer than the idle interval
+#define CAPTURE_ERROR_BACKOFF 5         // Milliseconds the capture thread waits after POLLERR
+#define LATENCY_BUCKETS 64
+#define LATENCY_BUCKET_WIDTH 500        // Microseconds, the histogram covers 32 ms
+
+// Freescale video detect control, mainline headers do not have it
+#ifndef V4L2_CID_VID_VIDEO_DETECT
+#define V4L2_CID_VID_VIDEO_DETECT (V4L2_CID_BASE + 39)
+#endif
 
 #define DEBUG_V4L2_CAMERA(...) ((void)0)
 //#define DEBUG_V4L2_CAMERA qDebug
@@ -66,10 +94,16 @@ static inline IMX6CameraFrame::PixelFormat v4l2PixelFormat(quint32 format)
     case V4L2_PIX_FMT_YUV444:
         return IMX6CameraFrame::Format_YUV444;
     case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YUV420M:
         return IMX6CameraFrame::Format_YUV420P;
+    case V4L2_PIX_FMT_YVU420:
+    case V4L2_PIX_FMT_YVU420M:
+        return IMX6CameraFrame::Format_YV12;
     case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
         return IMX6CameraFrame::Format_NV12;
     case V4L2_PIX_FMT_NV21:
+    case V4L2_PIX_FMT_NV21M:
         return IMX6CameraFrame::Format_NV21;
     default:
         break;
@@ -77,67 +111,629 @@ static inline IMX6CameraFrame::PixelFormat v4l2PixelFormat(quint32 format)
     return IMX6CameraFrame::Format_Invalid;
 }
 
+// Average luma of 16 pixels in the middle of every grid cell, a few hundred
+// bytes that change with the picture but hardly with sensor noise.
+static QByteArray lumaSignature(const IMX6CameraFrame &frame)
+{
+    int offset, step;
+    if (!frame.lumaLayout(&offset, &step))
+        return QByteArray();
+
+    const int width = frame.size.width();
+    const int height = frame.size.height();
+    const BufferPlane &plane = frame.plane(0);
+    if (width < 16 || height < SIGNATURE_ROWS || !plane.data)
+        return QByteArray();
+
+    QByteArray signature(SIGNATURE_COLUMNS * SIGNATURE_ROWS, Qt::Uninitialized);
+    uchar *out = reinterpret_cast<uchar *>(signature.data());
+    for (int row = 0; row < SIGNATURE_ROWS; ++row) {
+        const int y = (2 * row + 1) * height / (2 * SIGNATURE_ROWS);
+        const uchar *line = plane.data + y * plane.bytesPerLine + offset;
+        for (int column = 0; column < SIGNATURE_COLUMNS; ++column) {
+            const int x = qMin((2 * column + 1) * width / (2 * SIGNATURE_COLUMNS) - 8, width - 16);
+            *out++ = imx6SumLuma16(line + qMax(0, x) * step, step, offset) >> 4;
+        }
+    }
+    return signature;
+}
+
+static inline void setPlane(BufferPlane *plane, const Buffer &buffer, size_t offset, int bytesPerLine, size_t length)
+{
+    plane->data = buffer.start[0] ? buffer.start[0] + offset : 0;
+    plane->offset = offset;
+    plane->bytesPerLine = bytesPerLine;
+    plane->length = length;
+    plane->fd = buffer.fd[0];
+}
+
+// Prepares a v4l2_buffer for QUERYBUF, QBUF and DQBUF on either buffer type
+static void initBuffer(v4l2_buffer *buffer, v4l2_plane *planes, v4l2_buf_type type, int memoryPlaneCount)
+{
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->type = type;
+    buffer->memory = V_MAP_MODE;
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(planes, 0, sizeof(v4l2_plane) * VIDEO_MAX_PLANES);
+        buffer->m.planes = planes;
+        buffer->length = memoryPlaneCount;
+    }
+}
+
+// What loading learns from the device. Filled on the loader thread without
+// touching the control, which adopts it on its own thread.
+struct IMX6CameraDeviceSetup
+{
+    IMX6CameraDeviceSetup()
+        : handle(-1)
+        , bufferType(V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        , memoryPlaneCount(1)
+        , pixelFormat(IMX6CameraFrame::Format_Invalid)
+        , cropSupported(false)
+        , useSelectionApi(false)
+        , frameIntervalSupported(false)
+        , loadTime(0)
+    {
+        memset(&format, 0, sizeof(format));
+        memset(&frameInterval, 0, sizeof(frameInterval));
+        for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+            memset(&buffers[i], 0, sizeof(Buffer));
+            for (int plane = 0; plane < IMX6_CAMERA_MAX_PLANES; ++plane)
+                buffers[i].fd[plane] = -1;
+        }
+    }
+
+    ~IMX6CameraDeviceSetup();
+
+    QByteArray device;
+    int handle;
+    v4l2_buf_type bufferType;
+    int memoryPlaneCount;
+    v4l2_format format;
+    IMX6CameraFrame::PixelFormat pixelFormat;
+    QSize frameSize;
+    bool cropSupported;
+    bool useSelectionApi;
+    QRect defaultCrop;
+    Buffer buffers[V_BUFFER_COUNT];
+    QHash<int, v4l2_queryctrl> supportedControls;
+    bool frameIntervalSupported;
+    v4l2_fract frameInterval;   // Driver default
+    qint64 loadTime;            // Milliseconds from open to the last query
+};
+
+static void unmapBuffer(Buffer *buffer)
+{
+    for (int plane = 0; plane < IMX6_CAMERA_MAX_PLANES; ++plane) {
+        if (buffer->start[plane])
+            v4l2_munmap(buffer->start[plane], buffer->length[plane]);
+        if (buffer->fd[plane] >= 0)
+            close(buffer->fd[plane]);
+        buffer->start[plane] = 0;
+        buffer->length[plane] = 0;
+        buffer->fd[plane] = -1;
+    }
+}
+
+// Unmaps and closes whatever a setup still owns
+static void releaseDevice(IMX6CameraDeviceSetup *setup)
+{
+    for (int i = 0; i < V_BUFFER_COUNT; ++i)
+        unmapBuffer(&setup->buffers[i]);
+    if (setup->handle >= 0)
+        v4l2_close(setup->handle);
+    setup->handle = -1;
+}
+
+IMX6CameraDeviceSetup::~IMX6CameraDeviceSetup()
+{
+    releaseDevice(this);
+}
+
+static void queryControls(IMX6CameraDeviceSetup *setup)
+{
+    for (int index = V4L2_CID_BASE; index < V4L2_CID_LASTP1; ++index) {
+        struct v4l2_queryctrl queryctrl;
+        memset(&queryctrl, 0, sizeof(queryctrl));
+        queryctrl.id = index;
+        if (0 == ioctl(setup->handle, VIDIOC_QUERYCTRL, &queryctrl)) {
+            if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
+                continue;
+            int readId;
+            switch (queryctrl.id) {
+            case V4L2_CID_BRIGHTNESS:
+                readId = IMX6Camera::Brightness;
+                break;
+            case V4L2_CID_CONTRAST:
+                readId = IMX6Camera::Contrast;
+                break;
+            case V4L2_CID_SATURATION:
+                readId = IMX6Camera::Saturation;
+                break;
+            case V4L2_CID_SHARPNESS:
+                readId = IMX6Camera::Sharpening;
+                break;
+            case V4L2_CID_HFLIP:
+                readId = IMX6Camera::HorizontaMirror;
+                break;
+            default:
+                DEBUG_V4L2_CAMERA("Skip Control %s\n", queryctrl.name);
+                continue;
+            }
+            setup->supportedControls.insert(readId, queryctrl);
+        } else {
+            if (errno == EINVAL)
+                continue;
+            qCritical("VIDIOC_QUERYCTRL error %d", errno);
+        }
+    }
+}
+
+// Crop and selection calls of multi-planar devices take the _MPLANE type on
+// some drivers and the plain one on others, kernels since 4.13 take either
+static int cropIoctl(int handle, unsigned long request, void *argument, __u32 *type, v4l2_buf_type bufferType)
+{
+    *type = bufferType;
+    int ret = ioctl(handle, request, argument);
+    if (-1 == ret && errno == EINVAL && bufferType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        *type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        ret = ioctl(handle, request, argument);
+    }
+    return ret;
+}
+
+static void queryCrop(IMX6CameraDeviceSetup *setup)
+{
+    setup->cropSupported = false;
+
+    // The crop a previous user left behind is reset to the default, which is
+    // what cropRect() describes until somebody crops again
+    v4l2_selection selection;
+    memset(&selection, 0, sizeof(selection));
+    selection.target = V4L2_SEL_TGT_CROP_DEFAULT;
+    if (0 == cropIoctl(setup->handle, VIDIOC_G_SELECTION, &selection, &selection.type, setup->bufferType)) {
+        setup->useSelectionApi = true;
+        setup->cropSupported = true;
+        setup->defaultCrop = QRect(selection.r.left, selection.r.top, selection.r.width, selection.r.height);
+        selection.target = V4L2_SEL_TGT_CROP;
+        if (-1 == cropIoctl(setup->handle, VIDIOC_S_SELECTION, &selection, &selection.type, setup->bufferType))
+            DEBUG_V4L2_CAMERA("VIDIOC_S_SELECTION failed %d", errno);
+        return;
+    }
+
+    // Older drivers, like mxc_v4l2_capture, only implement the crop API
+    v4l2_cropcap cropCapability;
+    memset(&cropCapability, 0, sizeof(cropCapability));
+    if (0 == cropIoctl(setup->handle, VIDIOC_CROPCAP, &cropCapability, &cropCapability.type, setup->bufferType)) {
+        setup->useSelectionApi = false;
+        setup->cropSupported = true;
+        const v4l2_rect &rect = cropCapability.defrect;
+        setup->defaultCrop = QRect(rect.left, rect.top, rect.width, rect.height);
+        v4l2_crop crop;
+        memset(&crop, 0, sizeof(crop));
+        crop.c = rect;
+        if (-1 == cropIoctl(setup->handle, VIDIOC_S_CROP, &crop, &crop.type, setup->bufferType))
+            DEBUG_V4L2_CAMERA("VIDIOC_S_CROP failed %d", errno);
+        return;
+    }
+    DEBUG_V4L2_CAMERA("Sensor cropping is not supported");
+}
+
+static void queryFrameInterval(IMX6CameraDeviceSetup *setup)
+{
+    setup->frameIntervalSupported = false;
+
+    v4l2_streamparm parameters;
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.type = setup->bufferType;
+    if (ioctl(setup->handle, VIDIOC_G_PARM, &parameters) < 0) {
+        DEBUG_V4L2_CAMERA("Frame interval is not supported");
+        return;
+    }
+    setup->frameIntervalSupported = parameters.parm.capture.capability & V4L2_CAP_TIMEPERFRAME;
+    setup->frameInterval = parameters.parm.capture.timeperframe;
+}
+
+class IMX6CameraCaptureThread;
 class IMX6CameraControlPrivate
 {
 public:
     IMX6CameraControlPrivate()
         : state(IMX6CameraControl::UnloadedState)
-        , device("/dev/video0") // TODO: implement QMediaServiceSupportedDevicesInterface for device enumeration
+        , device(IMX6_CAMERA_DEFAULT_DEVICE)
+        , bufferType(V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        , memoryPlaneCount(1)
         , handle(-1)
         , socketNotifier(NULL)
         , size(QSize(720, 576))
+        , frameSize(QSize(720, 576))
+        , cropSupported(false)
+        , useSelectionApi(false)
         , cameraDetectTimer(NULL)
         , reloadCount(0)
         , pollCount(0)
         , isCameraConnected(false)
         , action(IMX6CameraControl::NoAction)
+        , queueMutex(QMutex::Recursive)
+        , frameSequence(0)
+        , latestFrameConsumers(0)
+        , captureArmed(true)
+        , signatureConsumers(0)
+        , publisher(NULL)
+        , frameIntervalSupported(false)
+        , frameRate(0)
+        , decimationPeriod(0)
+        , nextDelivery(0)
+        , lastCaptureTimestamp(0)
+        , powerMode(Streaming)
+        , recoveryStep(NoRecovery)
+        , recoveryTimer(NULL)
+        , recoverySequence(0)
+        , failedRecoveries(0)
+        , lastRecoveryTime(0)
+        , maxRecoveryTime(0)
+        , loading(false)
+        , detecting(false)
+        , loadedSetup(NULL)
+        , lockBuffers(false)
+        , captureThread(NULL)
+        , latencyCount(0)
+        , latencySum(0)
+        , latencyMax(0)
+        , rateDivisor(1)
+        , divisorCount(0)
     {
-        memset(&buffers[0], 0, sizeof(Buffer));
-        memset(&buffers[1], 0, sizeof(Buffer));
-        memset(&buffers[2], 0, sizeof(Buffer));
-        memset(&buffers[3], 0, sizeof(Buffer));
+        loadPool.setMaxThreadCount(1);
+        memset(latencyHistogram, 0, sizeof(latencyHistogram));
+        memset(recoveries, 0, sizeof(recoveries));
+        memset(&defaultFrameInterval, 0, sizeof(defaultFrameInterval));
+        memset(&frameInterval, 0, sizeof(frameInterval));
+        for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+            memset(&buffers[i], 0, sizeof(Buffer));
+            for (int plane = 0; plane < IMX6_CAMERA_MAX_PLANES; ++plane)
+                buffers[i].fd[plane] = -1;
+        }
+    }
+
+    bool isMultiPlanar() const
+    {
+        return bufferType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    }
+
+    void initBuffer(v4l2_buffer *buffer, v4l2_plane *planes) const
+    {
+        ::initBuffer(buffer, planes, bufferType, memoryPlaneCount);
+    }
+
+    void updatePlaneLayout(const v4l2_format &format);
+    bool skipFrame(qint64 timestamp);
+
+    enum PowerMode {
+        Streaming,
+        Decimated,  // Idle, capturing at IDLE_FRAME_RATE
+        Paused      // Idle, streaming off with the buffers still mapped
+    };
+
+    // Cheapest first, each step is tried when the one before did not bring frames back
+    enum RecoveryStep {
+        NoRecovery,
+        RequeueStep,    // Give the driver back the buffers it lost
+        RestartStep,    // STREAMOFF and STREAMON, keeping the mappings
+        ReloadStep,     // Close and reopen the device
+        RecoveryStepCount
+    };
+
+    static const char *recoveryStepName(RecoveryStep step)
+    {
+        static const char *names[] = { "none", "requeue", "restart", "reload" };
+        return names[step];
     }
 
     IMX6CameraControl::State state;
 
     QByteArray device;
     v4l2_buf_type bufferType;
+    int memoryPlaneCount;
 
     int handle;
     QSocketNotifier *socketNotifier;
     QSet<int> indexs;
     IMX6CameraFrame::PixelFormat pixelFormat;
-    QSize size;
+    QSize size;         // Uncropped source size, in frame coordinates
+    QSize frameSize;    // Size of the delivered frames, smaller than size when the sensor crops
+    bool cropSupported;
+    bool useSelectionApi;
+    QRect defaultCrop;  // Sensor rectangle that maps to the uncropped frame
+    QRect cropRect;     // Current crop, in frame coordinates
     Buffer buffers[V_BUFFER_COUNT];
     QHash<int, V4L2CameraFrameBuffer *> frameBuffers;
+    QList<V4L2CameraFrameBuffer *> retiredBuffers; // Unloaded while still referenced, guarded by queueMutex
     QHash<int, v4l2_queryctrl> supportedControls;
     QTimer *cameraDetectTimer;
     int reloadCount;
     int pollCount;
     bool isCameraConnected;
     IMX6CameraControl::Action action;
+    mutable QMutex queueMutex;  // Guards indexs and the queue state, buffers are released from the render thread
+    quint32 frameSequence;
+    int latestFrameConsumers;
+    bool captureArmed;  // False while a frame waits for the render thread to pull it
+    int signatureConsumers;
+    IMX6CameraFrame latestFrame;
+    IMX6CameraFramePublisher *publisher;
+    bool frameIntervalSupported;
+    v4l2_fract defaultFrameInterval;
+    v4l2_fract frameInterval;   // Interval while frames are wanted
+    qreal frameRate;            // Requested rate, 0 for the driver default
+    qint64 decimationPeriod;    // Microseconds between delivered frames, 0 delivers all
+    qint64 nextDelivery;
+    qint64 lastCaptureTimestamp;
+    QHash<int, IMX6CameraControl::IdlePolicy> idleSessions;
+    PowerMode powerMode;
+    QSet<int> openSessionIdList;
+    RecoveryStep recoveryStep;
+    QTimer *recoveryTimer;
+    QElapsedTimer recoveryTime;     // Since the error that started the current recovery
+    QElapsedTimer sinceFrame;       // Since the last dequeued buffer, guarded by queueMutex
+    quint32 recoverySequence;       // frameSequence when the current step was taken
+    QAtomicInt errorPending;        // An error is on its way to handleStreamError
+    QAtomicInt streamErrors;        // Counted from any thread
+    QAtomicInt corruptFrames;
+    int recoveries[RecoveryStepCount];  // Successful recoveries by the step that did it
+    int failedRecoveries;
+    qint64 lastRecoveryTime;
+    qint64 maxRecoveryTime;
+    QThreadPool loadPool;       // One loader thread, loads of a device never overlap
+    bool loading;
+    bool detecting;             // A detection task is queued on loadPool
+    QMutex loadMutex;
+    IMX6CameraDeviceSetup *loadedSetup; // Waiting for finishLoad(), guarded by loadMutex
+    IMX6CameraSchedulingProfile captureProfile;
+    IMX6CameraSchedulingProfile processingProfile;
+    bool lockBuffers;
+    IMX6CameraCaptureThread *captureThread;
+    // Dequeue latency, guarded by queueMutex
+    quint32 latencyHistogram[LATENCY_BUCKETS];
+    quint32 latencyCount;
+    qint64 latencySum;
+    qint64 latencyMax;
+    QHash<int, int> sessionRateDivisors;
+    int rateDivisor;            // Guarded by queueMutex, with divisorCount
+    quint32 divisorCount;
     static int sessionId;
-    static QSet<int> openSessionIdList;
+
+    void recordLatency(qint64 latency)
+    {
+        if (latency < 0)
+            return; // Clock mismatch, the frame was stamped on another clock
+        ++latencyHistogram[qMin<qint64>(latency / LATENCY_BUCKET_WIDTH, LATENCY_BUCKETS - 1)];
+        ++latencyCount;
+        latencySum += latency;
+        latencyMax = qMax(latencyMax, latency);
+    }
+};
+
+// Dequeues frames on a thread of its own, so capture can be scheduled apart
+// from the control's thread, see IMX6CameraControl::setCaptureProfile()
+class IMX6CameraCaptureThread : public QThread
+{
+public:
+    IMX6CameraCaptureThread(IMX6CameraControl *control, int handle, const IMX6CameraSchedulingProfile &profile)
+        : mControl(control)
+        , mHandle(handle)
+        , mWake(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+        , mProfile(profile)
+        , mArmed(1)
+    {
+    }
+
+    ~IMX6CameraCaptureThread()
+    {
+        stop();
+        if (mWake >= 0)
+            close(mWake);
+    }
+
+    // A V4L2 device that is not streaming reports POLLERR at once, it is only
+    // polled while streaming
+    void setStreaming(bool streaming)
+    {
+        mStreaming.store(streaming);
+        wake();
+    }
+
+    // A disarmed thread leaves completed buffers to someone else, see latestFrame()
+    void setArmed(bool armed)
+    {
+        mArmed.store(armed);
+        wake();
+    }
+
+    void stop()
+    {
+        if (!isRunning())
+            return;
+        mStopping.store(1);
+        wake();
+        wait();
+    }
+
+protected:
+    void run()
+    {
+        mProfile.applyToCurrentThread("capture");
+
+        pollfd fds[2];
+        fds[0].fd = mWake;
+        fds[0].events = POLLIN;
+        fds[1].fd = mHandle;
+        fds[1].events = POLLIN;
+        while (!mStopping.load()) {
+            const bool streaming = mStreaming.load() && mArmed.load();
+            if (poll(fds, streaming ? 2 : 1, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                qCritical("Capture thread could not poll the device: %s", strerror(errno));
+                return;
+            }
+            if (fds[0].revents & POLLIN) {
+                quint64 count;
+                if (read(mWake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    qWarning("Capture thread could not read its wake-up: %s", strerror(errno));
+                continue;
+            }
+            if (!streaming)
+                continue;
+
+            if (fds[1].revents & POLLIN) {
+                mControl->dequeueFrame();
+            } else if (fds[1].revents & (POLLERR | POLLHUP)) {
+                // Every buffer is out with a consumer, or the driver failed and
+                // DQBUF reports it. Either way nothing comes sooner by spinning.
+                mControl->dequeueFrame();
+                poll(fds, 1, CAPTURE_ERROR_BACKOFF);
+            }
+        }
+    }
+
+private:
+    void wake()
+    {
+        const quint64 one = 1;
+        if (mWake >= 0 && write(mWake, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            qWarning("Could not wake the capture thread: %s", strerror(errno));
+    }
+
+    IMX6CameraControl *mControl;
+    int mHandle;
+    int mWake;
+    IMX6CameraSchedulingProfile mProfile;
+    QAtomicInt mStreaming;
+    QAtomicInt mStopping;
+    QAtomicInt mArmed;
 };
 
+static inline qint64 clockMicroseconds(clockid_t clock)
+{
+    timespec time;
+    clock_gettime(clock, &time);
+    return qint64(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+// Locks the mapped buffers, false when the process may not lock that much
+static bool lockMappedBuffers(const Buffer *buffers, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        for (int plane = 0; plane < buffers[i].memoryCount; ++plane) {
+            if (buffers[i].start[plane] && mlock(buffers[i].start[plane], buffers[i].length[plane]) < 0) {
+                // EPERM or ENOMEM, RLIMIT_MEMLOCK is too low without CAP_IPC_LOCK
+                qWarning("Could not lock the video buffers: %s, they stay pageable", strerror(errno));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Thins the stream out to decimationPeriod. Half a capture interval of slack
+// keeps the average rate right despite timestamp jitter.
+bool IMX6CameraControlPrivate::skipFrame(qint64 timestamp)
+{
+    if (decimationPeriod <= 0)
+        return false;
+
+    const qint64 captureInterval = lastCaptureTimestamp ? timestamp - lastCaptureTimestamp : 0;
+    lastCaptureTimestamp = timestamp;
+    if (nextDelivery && timestamp + captureInterval / 2 < nextDelivery)
+        return true;
+
+    if (nextDelivery && timestamp - nextDelivery < decimationPeriod)
+        nextDelivery += decimationPeriod;
+    else
+        nextDelivery = timestamp + decimationPeriod;
+    return false;
+}
+
+void IMX6CameraControlPrivate::updatePlaneLayout(const v4l2_format &format)
+{
+    const int height = isMultiPlanar() ? format.fmt.pix_mp.height : format.fmt.pix.height;
+    for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+        Buffer &buffer = buffers[i];
+        if (isMultiPlanar() && memoryPlaneCount > 1) {
+            // Every plane has its own memory buffer, e.g. NV12M or YUV420M
+            buffer.planeCount = memoryPlaneCount;
+            for (int plane = 0; plane < memoryPlaneCount; ++plane) {
+                buffer.planes[plane].data = buffer.start[plane];
+                buffer.planes[plane].offset = 0;
+                buffer.planes[plane].bytesPerLine = format.fmt.pix_mp.plane_fmt[plane].bytesperline;
+                buffer.planes[plane].length = format.fmt.pix_mp.plane_fmt[plane].sizeimage;
+                buffer.planes[plane].fd = buffer.fd[plane];
+            }
+            continue;
+        }
+
+        // All planes share one memory buffer, their layout follows from the luma stride
+        const int bytesPerLine = isMultiPlanar() ? format.fmt.pix_mp.plane_fmt[0].bytesperline
+                                                 : format.fmt.pix.bytesperline;
+        const size_t lumaLength = size_t(bytesPerLine) * height;
+        switch (pixelFormat) {
+        case IMX6CameraFrame::Format_YUV420P:
+        case IMX6CameraFrame::Format_YV12:
+            buffer.planeCount = 3;
+            setPlane(&buffer.planes[0], buffer, 0, bytesPerLine, lumaLength);
+            setPlane(&buffer.planes[1], buffer, lumaLength, bytesPerLine / 2, lumaLength / 4);
+            setPlane(&buffer.planes[2], buffer, lumaLength + lumaLength / 4, bytesPerLine / 2, lumaLength / 4);
+            break;
+        case IMX6CameraFrame::Format_NV12:
+        case IMX6CameraFrame::Format_NV21:
+            buffer.planeCount = 2;
+            setPlane(&buffer.planes[0], buffer, 0, bytesPerLine, lumaLength);
+            setPlane(&buffer.planes[1], buffer, lumaLength, bytesPerLine, lumaLength / 2);
+            break;
+        default:
+            buffer.planeCount = 1;
+            setPlane(&buffer.planes[0], buffer, 0, bytesPerLine, lumaLength);
+            break;
+        }
+    }
+}
+
 int IMX6CameraControlPrivate::sessionId = 0;
-QSet<int> IMX6CameraControlPrivate::openSessionIdList;
-IMX6CameraControl* IMX6CameraControl::s_cameraControl = NULL;
+QHash<QByteArray, IMX6CameraControl *> IMX6CameraControl::s_cameraControls;
 
-IMX6CameraControl::IMX6CameraControl(QObject *parent)
+IMX6CameraControl::IMX6CameraControl(const QByteArray &device, QObject *parent)
     : QObject(parent)
     , d_ptr(new IMX6CameraControlPrivate)
 {
     Q_D(IMX6CameraControl);
+    d->device = device;
     for (int i = 0; i < V_BUFFER_COUNT; ++i)
         d->frameBuffers.insert(i, new V4L2CameraFrameBuffer(this));
+
+    // Frames cross threads when capture has a thread of its own
+    qRegisterMetaType<IMX6CameraFrame>("IMX6CameraFrame");
+    d->captureProfile = IMX6CameraSchedulingProfile::fromEnvironment("CAPTURE");
+    d->processingProfile = IMX6CameraSchedulingProfile::fromEnvironment("PROCESSING");
+    d->lockBuffers = qgetenv("IMX6CAMERA_MLOCK").toInt() != 0;
+
+    // The socket has one path, so only the default device is shared
+    const QByteArray shareSocket = qgetenv("IMX6CAMERA_SHARE_SOCKET");
+    if (!shareSocket.isEmpty() && device == IMX6_CAMERA_DEFAULT_DEVICE)
+        startFrameSharing(QString::fromLocal8Bit(shareSocket));
 }
 
 IMX6CameraControl::~IMX6CameraControl()
 {
     Q_D(IMX6CameraControl);
+    if (s_cameraControls.value(d->device) == this)
+        s_cameraControls.remove(d->device);
+    // A running load finishes first, its connection is closed with the setup
+    d->loadPool.waitForDone();
+    delete d->loadedSetup;
+    d->loadedSetup = 0;
     unload();
-    d->cameraDetectTimer->stop();
+    if (d->cameraDetectTimer)
+        d->cameraDetectTimer->stop();
 
     QHashIterator<int, V4L2CameraFrameBuffer *> it(d->frameBuffers);
     while (it.hasNext()) {
@@ -145,382 +741,1404 @@ IMX6CameraControl::~IMX6CameraControl()
         delete it.value();
     }
     d->frameBuffers.clear();
+
+    Q_FOREACH (V4L2CameraFrameBuffer *buffer, d->retiredBuffers) {
+        Buffer handle = buffer->bufferHandle();
+        unmapBuffer(&handle);
+        delete buffer;
+    }
+    d->retiredBuffers.clear();
 }
 
 IMX6CameraControl *IMX6CameraControl::cameraControl(int *sessionId, QObject *parent)
 {
-    if (!s_cameraControl)
-        s_cameraControl = new IMX6CameraControl(parent);
+    return cameraControl(IMX6_CAMERA_DEFAULT_DEVICE, sessionId, parent);
+}
+
+IMX6CameraControl *IMX6CameraControl::cameraControl(const QByteArray &device, int *sessionId, QObject *parent)
+{
+    IMX6CameraControl *control = s_cameraControls.value(device);
+    if (!control) {
+        control = new IMX6CameraControl(device, parent);
+        s_cameraControls.insert(device, control);
+    }
     *sessionId = IMX6CameraControlPrivate::sessionId;
     ++IMX6CameraControlPrivate::sessionId;
-    return s_cameraControl;
+    return control;
 }
 
-bool IMX6CameraControl::load()
+QByteArray IMX6CameraControl::device() const
 {
-    Q_D(IMX6CameraControl);
-    if (d->state != UnloadedState)
-        return true;
+    Q_D(const IMX6CameraControl);
+    return d->device;
+}
 
-    // Re-open the connection for proper initialization
-    v4l2_close(d->handle);
-    d->handle = v4l2_open(d->device.constData(), O_RDWR | O_NONBLOCK, 0);
-    if (d->handle < 0) {
+// Opens, configures and maps the device without touching the control, so it
+// can run on the loader thread. On failure everything acquired is released.
+static bool setupDevice(IMX6CameraDeviceSetup *setup)
+{
+    setup->handle = v4l2_open(setup->device.constData(), O_RDWR | O_NONBLOCK, 0);
+    if (setup->handle < 0) {
         qCritical("Could not open the video device.");
+        return false;
     }
 
     v4l2_capability capability;
-    if (v4l2_ioctl(d->handle, VIDIOC_QUERYCAP, &capability) < 0) {
+    if (v4l2_ioctl(setup->handle, VIDIOC_QUERYCAP, &capability) < 0) {
         qCritical("Failed to query the device capabilities.");
-        v4l2_close(d->handle);
-        d->handle = -1;
+        releaseDevice(setup);
         return false;
     }
 
-    if (!(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+    const quint32 capabilities = (capability.capabilities & V4L2_CAP_DEVICE_CAPS) ? capability.device_caps
+                                                                                  : capability.capabilities;
+    if (capabilities & V4L2_CAP_VIDEO_CAPTURE) {
+        setup->bufferType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if (capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        setup->bufferType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else {
         qCritical("The device does not support video capture.");
-        v4l2_close(d->handle);
-        d->handle = -1;
+        releaseDevice(setup);
         return false;
     }
+    const bool multiPlanar = setup->bufferType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 
     int index = 1;
-    if (v4l2_ioctl(d->handle, VIDIOC_S_INPUT, &index)) {
+    if (v4l2_ioctl(setup->handle, VIDIOC_S_INPUT, &index)) {
         qCritical("Could not set the video input index. %d %s", errno, strerror(errno));
-        v4l2_close(d->handle);
-        d->handle = -1;
+        releaseDevice(setup);
         return false;
     }
 
-    v4l2_format format;
+    v4l2_format &format = setup->format;
     memset(&format, 0, sizeof(format));
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.type = setup->bufferType;
     // Read size from driver side
-    format.fmt.pix.width = 0;
-    format.fmt.pix.height = 0;
-
-    format.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
-    format.fmt.pix.field = V4L2_FIELD_ANY;
-    if (v4l2_ioctl(d->handle, VIDIOC_S_FMT, &format) < 0) {
+    if (multiPlanar) {
+        format.fmt.pix_mp.width = 0;
+        format.fmt.pix_mp.height = 0;
+        format.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_UYVY;
+        format.fmt.pix_mp.field = V4L2_FIELD_ANY;
+    } else {
+        format.fmt.pix.width = 0;
+        format.fmt.pix.height = 0;
+        format.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
+        format.fmt.pix.field = V4L2_FIELD_ANY;
+    }
+    if (v4l2_ioctl(setup->handle, VIDIOC_S_FMT, &format) < 0) {
         qCritical("Could not set the video format. %d %s", errno, strerror(errno));
-        v4l2_close(d->handle);
-        d->handle = -1;
+        releaseDevice(setup);
         return false;
     }
 
-    const IMX6CameraFrame::PixelFormat pixelFormat = v4l2PixelFormat(format.fmt.pix.pixelformat);
-    d->pixelFormat = pixelFormat;
-    if (d->size != QSize(format.fmt.pix.width, format.fmt.pix.height)) {
-        d->size = QSize(format.fmt.pix.width, format.fmt.pix.height);
-        emit sourceSizeChanged(d->size);
+    if (multiPlanar) {
+        setup->pixelFormat = v4l2PixelFormat(format.fmt.pix_mp.pixelformat);
+        setup->frameSize = QSize(format.fmt.pix_mp.width, format.fmt.pix_mp.height);
+        setup->memoryPlaneCount = qBound(1, int(format.fmt.pix_mp.num_planes), IMX6_CAMERA_MAX_PLANES);
+    } else {
+        setup->pixelFormat = v4l2PixelFormat(format.fmt.pix.pixelformat);
+        setup->frameSize = QSize(format.fmt.pix.width, format.fmt.pix.height);
+        setup->memoryPlaneCount = 1;
     }
+    queryCrop(setup);
 
     v4l2_requestbuffers bufferRequest;
     memset(&bufferRequest, 0, sizeof(bufferRequest));
     bufferRequest.count = V_BUFFER_COUNT;
-    bufferRequest.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    bufferRequest.type = setup->bufferType;
     bufferRequest.memory = V_MAP_MODE;
-    if (v4l2_ioctl(d->handle, VIDIOC_REQBUFS, &bufferRequest) < 0) {
+    if (v4l2_ioctl(setup->handle, VIDIOC_REQBUFS, &bufferRequest) < 0) {
         qCritical("Could not complete the buffer request.");
-        v4l2_close(d->handle);
-        d->handle = -1;
+        releaseDevice(setup);
+        return false;
+    }
+
+    for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+        v4l2_buffer buffer;
+        v4l2_plane planes[VIDEO_MAX_PLANES];
+        initBuffer(&buffer, planes, setup->bufferType, setup->memoryPlaneCount);
+        buffer.index = i;
+        if (v4l2_ioctl(setup->handle, VIDIOC_QUERYBUF, &buffer) < 0) {
+            qCritical("Could not query video buffer.");
+            releaseDevice(setup);
+            return false;
+        }
+
+        setup->buffers[i].memoryCount = setup->memoryPlaneCount;
+        for (int plane = 0; plane < setup->memoryPlaneCount; ++plane) {
+            const size_t length = multiPlanar ? planes[plane].length : buffer.length;
+            const off_t offset = multiPlanar ? planes[plane].m.mem_offset : buffer.m.offset;
+            void *data = v4l2_mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, setup->handle, offset);
+            if (data == MAP_FAILED) {
+                qCritical("Failed to map video buffer.");
+                releaseDevice(setup);
+                return false;
+            }
+            setup->buffers[i].start[plane] = reinterpret_cast<uchar *>(data);
+            setup->buffers[i].length[plane] = length;
+
+            // Export the plane as dmabuf so it can be shared without copies
+            v4l2_exportbuffer exportBuffer;
+            memset(&exportBuffer, 0, sizeof(exportBuffer));
+            exportBuffer.type = setup->bufferType;
+            exportBuffer.index = i;
+            exportBuffer.plane = plane;
+            exportBuffer.flags = O_CLOEXEC | O_RDONLY;
+            setup->buffers[i].fd[plane] = ioctl(setup->handle, VIDIOC_EXPBUF, &exportBuffer) == 0 ? exportBuffer.fd : -1;
+        }
+    }
+
+    queryControls(setup);
+    queryFrameInterval(setup);
+    return true;
+}
+
+// Runs setupDevice() on the loader thread and hands the result to finishLoad()
+class IMX6CameraLoadTask : public QRunnable
+{
+public:
+    IMX6CameraLoadTask(IMX6CameraControl *control, IMX6CameraControlPrivate *d)
+        : mControl(control), mPrivate(d), mDevice(d->device)
+    {
+    }
+
+    void run()
+    {
+        IMX6_TRACE_SCOPE("loadDevice", -1);
+        QElapsedTimer timer;
+        timer.start();
+        IMX6CameraDeviceSetup *setup = new IMX6CameraDeviceSetup;
+        setup->device = mDevice;
+        if (setupDevice(setup)) {
+            setup->loadTime = timer.elapsed();
+        } else {
+            delete setup;
+            setup = 0;
+        }
+
+        QMutexLocker locker(&mPrivate->loadMutex);
+        mPrivate->loadedSetup = setup;
+        QMetaObject::invokeMethod(mControl, "finishLoad", Qt::QueuedConnection);
+    }
+
+private:
+    IMX6CameraControl *mControl;
+    IMX6CameraControlPrivate *mPrivate;
+    QByteArray mDevice;
+};
+
+static bool pollVideoDetect(int handle)
+{
+    struct v4l2_control ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_VID_VIDEO_DETECT;
+    int ret = ioctl(handle, VIDIOC_G_CTRL, &ctrl);
+    if (-1 == ret) {
+        qCritical() << "ioctl VDLOSS failed";
         return false;
     }
+    return ctrl.value == 1;
+}
+
+// Asks the device for a camera on the loader thread and hands the answer to
+// finishDetection(). Opening the device and VDLOSS can block for a while.
+class IMX6CameraDetectTask : public QRunnable
+{
+public:
+    // Takes over handle, a duplicate of the control's, or opens one when it is -1
+    IMX6CameraDetectTask(IMX6CameraControl *control, const QByteArray &device, int handle)
+        : mControl(control), mDevice(device), mHandle(handle)
+    {
+    }
+
+    void run()
+    {
+        IMX6_TRACE_SCOPE("detectCamera", mHandle);
+        bool connected = false;
+        if (mHandle >= 0) {
+            connected = pollVideoDetect(mHandle);
+            close(mHandle);
+        } else {
+            const int handle = v4l2_open(mDevice.constData(), O_RDWR | O_NONBLOCK, 0);
+            if (handle < 0) {
+                qCritical("Could not open the video device.");
+            } else {
+                connected = pollVideoDetect(handle);
+                v4l2_close(handle);
+            }
+        }
+        QMetaObject::invokeMethod(mControl, "finishDetection", Qt::QueuedConnection, Q_ARG(bool, connected));
+    }
+
+private:
+    IMX6CameraControl *mControl;
+    QByteArray mDevice;
+    int mHandle;
+};
+
+// Blocks on the device, loadAsync() keeps the calling thread responsive
+bool IMX6CameraControl::load()
+{
+    Q_D(IMX6CameraControl);
+    if (d->state != UnloadedState)
+        return true;
+    if (d->loading)
+        return false;
+
+    // Re-open the connection for proper initialization
+    if (d->handle >= 0) {
+        v4l2_close(d->handle);
+        d->handle = -1;
+    }
+
+    IMX6CameraDeviceSetup setup;
+    setup.device = d->device;
+    if (!setupDevice(&setup))
+        return false;
+    adoptDevice(&setup);
+    return true;
+}
+
+void IMX6CameraControl::loadAsync()
+{
+    Q_D(IMX6CameraControl);
+    if (d->state != UnloadedState || d->loading)
+        return;
+
+    // The loader opens its own connection, as load() does
+    if (d->handle >= 0) {
+        v4l2_close(d->handle);
+        d->handle = -1;
+    }
+    d->loading = true;
+    d->loadPool.start(new IMX6CameraLoadTask(this, d));
+}
+
+void IMX6CameraControl::finishLoad()
+{
+    Q_D(IMX6CameraControl);
+    QScopedPointer<IMX6CameraDeviceSetup> setup;
+    {
+        QMutexLocker locker(&d->loadMutex);
+        setup.reset(d->loadedSetup);
+        d->loadedSetup = 0;
+    }
+    d->loading = false;
+    if (!setup)
+        return; // Detection tries again, a recovery waits for its timeout
+
+    DEBUG_V4L2_CAMERA("%s loaded in %lld ms", d->device.constData(), setup->loadTime);
+    adoptDevice(setup.data());
+    updatePowerMode();  // Idling may decimate now that the frame interval is known
+    if (d->state == LoadedState && d->action == StartCamera
+            && d->powerMode != IMX6CameraControlPrivate::Paused)
+        startStream();
+    if (d->cameraDetectTimer)
+        d->cameraDetectTimer->setInterval(CAMERA_REMOVE_DETECTION_INTERVAL);
+}
+
+// Takes over the connection and the mappings of a finished setupDevice()
+void IMX6CameraControl::adoptDevice(IMX6CameraDeviceSetup *setup)
+{
+    Q_D(IMX6CameraControl);
+    if (d->handle >= 0)
+        v4l2_close(d->handle);
+    d->handle = setup->handle;
+    d->bufferType = setup->bufferType;
+    d->memoryPlaneCount = setup->memoryPlaneCount;
+    d->pixelFormat = setup->pixelFormat;
+    d->frameSize = setup->frameSize;
+    if (d->size != d->frameSize) {
+        d->size = d->frameSize;
+        emit sourceSizeChanged(d->size);
+    }
+    d->cropSupported = setup->cropSupported;
+    d->useSelectionApi = setup->useSelectionApi;
+    d->defaultCrop = setup->defaultCrop;
+    d->cropRect = QRect(QPoint(0, 0), d->size);
+
+    for (int i = 0; i < V_BUFFER_COUNT; ++i)
+        d->buffers[i] = setup->buffers[i];
+    d->updatePlaneLayout(setup->format);
+    for (int i = 0; i < V_BUFFER_COUNT; ++i)
+        d->frameBuffers[i]->set_values(d->buffers[i], i);
+    if (d->publisher)
+        d->publisher->setBuffers(d->frameBuffers.values());
+
+    // Everything belongs to the control now, releaseDevice() leaves it alone
+    setup->handle = -1;
+    for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+        for (int plane = 0; plane < IMX6_CAMERA_MAX_PLANES; ++plane) {
+            setup->buffers[i].start[plane] = 0;
+            setup->buffers[i].fd[plane] = -1;
+        }
+    }
+
+    if (d->lockBuffers)
+        lockMappedBuffers(d->buffers, V_BUFFER_COUNT);
+
+    d->supportedControls = setup->supportedControls;
+    d->frameIntervalSupported = setup->frameIntervalSupported;
+    if (!d->defaultFrameInterval.denominator)
+        d->defaultFrameInterval = setup->frameInterval;
+    if (!d->frameInterval.denominator)
+        d->frameInterval = d->defaultFrameInterval;
+
+    d->state =  LoadedState;
+    updateCaptureThread();
+    if (d->powerMode == IMX6CameraControlPrivate::Decimated)
+        applyFrameInterval(1, IDLE_FRAME_RATE, false);
+    else
+        updateFrameRate(false);
+    emit supportedParametersChanged();
+}
+
+// Dequeues on the control's thread through a socket notifier, or on a
+// capture thread when the capture profile asks for scheduling of its own
+void IMX6CameraControl::updateCaptureThread()
+{
+    Q_D(IMX6CameraControl);
+    delete d->captureThread;
+    d->captureThread = NULL;
+    if (d->socketNotifier) {
+        d->socketNotifier->setEnabled(false);
+        d->socketNotifier->deleteLater();
+        d->socketNotifier = NULL;
+    }
+    d->captureArmed = true;
+    if (d->state == UnloadedState)
+        return;
+
+    if (d->captureProfile.isDefault()) {
+        d->socketNotifier = new QSocketNotifier(d->handle, QSocketNotifier::Read, this);
+        connect(d->socketNotifier, &QSocketNotifier::activated, this, &IMX6CameraControl::dequeueFrame);
+    } else {
+        d->captureThread = new IMX6CameraCaptureThread(this, d->handle, d->captureProfile);
+        d->captureThread->setStreaming(d->state == ActiveState);
+        d->captureThread->start();
+    }
+}
+
+bool IMX6CameraControl::unload()
+{
+    Q_D(IMX6CameraControl);
+
+    if (d->state == UnloadedState)
+        return false;
+
+    if (d->state == ActiveState)
+        stopStream();
+
+    QSet<int>::Iterator it = d->indexs.begin();
+    for (; it != d->indexs.end(); ++it)
+        queueFrame(*it);
+
+    if (d->publisher)
+        d->publisher->clearBuffers();
+
+    if (d->handle >= 0) {
+        delete d->captureThread;
+        d->captureThread = NULL;
+        if (d->socketNotifier) {
+            d->socketNotifier->setEnabled(false);
+            d->socketNotifier->deleteLater();
+            d->socketNotifier = NULL;
+        }
+
+        QMutexLocker locker(&d->queueMutex);
+        for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+            if (d->frameBuffers[i]->isReferenced()) {
+                // A consumer still reads it, the memory is unmapped when the last frame goes
+                V4L2CameraFrameBuffer *retired = d->frameBuffers[i];
+                retired->set_values(retired->bufferHandle(), -1);
+                d->retiredBuffers.append(retired);
+                d->frameBuffers[i] = new V4L2CameraFrameBuffer(this);
+                for (int plane = 0; plane < IMX6_CAMERA_MAX_PLANES; ++plane) {
+                    d->buffers[i].start[plane] = 0;
+                    d->buffers[i].length[plane] = 0;
+                    d->buffers[i].fd[plane] = -1;
+                }
+            } else {
+                unmapBuffer(&d->buffers[i]);
+            }
+        }
+        locker.unlock();
+        v4l2_close(d->handle);
+        d->handle = -1;
+    }
+
+    d->state = UnloadedState;
+    return true;
+}
+
+bool IMX6CameraControl::startCamera(uint sessionId)
+{
+    Q_D(IMX6CameraControl);
+    if (!d->openSessionIdList.contains(sessionId)) {
+        d->openSessionIdList.insert(sessionId);
+        emit openSessionsChanged();
+    }
+    updateRateDivisor();
+    updatePowerMode();
+    switch (d->state) {
+    case LoadedState:
+        if (d->powerMode != IMX6CameraControlPrivate::Paused)
+            startCameraStream();
+        break;
+    case UnloadedState:
+        d->action = StartCamera;
+        startCameraDetection(CAMERA_LOAD_DETECTION_INTERVAL);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+bool IMX6CameraControl::stopCameraStream(int sessionId)
+{
+    Q_D(IMX6CameraControl);
+    if (!d->openSessionIdList.remove(sessionId))
+        return true;
+    d->idleSessions.remove(sessionId);
+    d->sessionRateDivisors.remove(sessionId);
+    updateRateDivisor();
+    emit openSessionsChanged();
+
+    // The stream belongs to all sessions, it only stops when the last one leaves
+    if (!d->openSessionIdList.isEmpty()) {
+        updatePowerMode();
+        return true;
+    }
+    d->action = StopCamera;
+    return stopStream();
+}
+
+bool IMX6CameraControl::startCameraStream()
+{
+    Q_D(IMX6CameraControl);
+    d->action = StartCamera;
+    return startStream();
+}
+
+bool IMX6CameraControl::startStream()
+{
+    Q_D(IMX6CameraControl);
+    if (d->state != LoadedState)
+        return false;
+
+    Q_ASSERT(d->handle >= 0);
+    QMutexLocker locker(&d->queueMutex);
+    d->reloadCount = 0;
+    d->indexs.clear();
+    for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+        if (d->frameBuffers[i]->isReferenced()) {
+            // Still in use by a renderer, it is queued when the last reference goes away
+            d->indexs.insert(i);
+            continue;
+        }
+        v4l2_buffer buffer;
+        v4l2_plane planes[VIDEO_MAX_PLANES];
+        d->initBuffer(&buffer, planes);
+        buffer.index = i;
+        if (v4l2_ioctl(d->handle, VIDIOC_QBUF, &buffer) < 0) {
+            qCritical("Could not queue buffer.");
+            reportStreamError(errno);
+            return false;
+        }
+    }
+    v4l2_buf_type type = d->bufferType;
+    if (v4l2_ioctl(d->handle, VIDIOC_STREAMON, &type) < 0) {
+        qCritical( "Could not start the stream.");
+        reportStreamError(errno);
+        return false;
+    }
+    d->state = ActiveState;
+    d->sinceFrame.start();
+    setCaptureArmed(true);
+    if (d->captureThread)
+        d->captureThread->setStreaming(true);
+    return true;
+}
+
+bool IMX6CameraControl::stopStream()
+{
+    Q_D(IMX6CameraControl);
+    if (d->handle < 0)
+        return false;
+
+    QMutexLocker locker(&d->queueMutex);
+    if (d->captureThread)
+        d->captureThread->setStreaming(false);
+    v4l2_buf_type type = d->bufferType;
+    const bool stopped = v4l2_ioctl(d->handle, VIDIOC_STREAMOFF, &type) == 0;
+    if (!stopped) {
+        // The mappings are still good, a restart or a reload sorts the device out
+        qCritical("Could not stop the stream.");
+        reportStreamError(errno);
+    }
+    d->state = LoadedState;
+
+    QSet<int>::Iterator it = d->indexs.begin();
+    for (; it != d->indexs.end(); ++it)
+        queueFrame(*it);
+    return stopped;
+}
+
+void IMX6CameraControl::startCameraDetection(int interval)
+{
+    Q_D(IMX6CameraControl);
+    if (!d->cameraDetectTimer) {
+        d->cameraDetectTimer = new QTimer(this);
+        connect(d->cameraDetectTimer, &QTimer::timeout, this, &IMX6CameraControl::cameraDetectTimeout);
+    }
+    d->cameraDetectTimer->start(interval);
+}
+
+void IMX6CameraControl::cameraDetectTimeout()
+{
+    Q_D(IMX6CameraControl);
+    DEBUG_V4L2_CAMERA("%s, %d, %d %d", Q_FUNC_INFO, d->state, d->action, d->handle);
+    if (d->loading || d->detecting)
+        return; // The loader has the device, or the last answer is still out
+
+    // The task gets a connection of its own, an unload may close ours meanwhile
+    const int handle = d->handle >= 0 ? dup(d->handle) : -1;
+    d->detecting = true;
+    d->loadPool.start(new IMX6CameraDetectTask(this, d->device, handle));
+}
+
+void IMX6CameraControl::finishDetection(bool connected)
+{
+    Q_D(IMX6CameraControl);
+    d->detecting = false;
+    if (d->loading)
+        return;
+
+    switch (d->state) {
+    case ActiveState:
+        if (d->action == StartCamera && !connected) {
+            stopStream();
+            DEBUG_V4L2_CAMERA("Camera removed, stop stream");
+        } else if (d->action == StartCamera && d->recoveryStep == IMX6CameraControlPrivate::NoRecovery) {
+            emit dequeueLatencyChanged();
+            // A stream that stops delivering without an error is as broken as one that fails
+            QMutexLocker locker(&d->queueMutex);
+            const qint64 interval = d->frameInterval.denominator
+                    ? qint64(1000) * d->frameInterval.numerator / d->frameInterval.denominator : 0;
+            // A frame waiting for a render thread that does not draw is no stall
+            if (d->captureArmed && d->sinceFrame.elapsed() > qMax<qint64>(STREAM_STALL_TIMEOUT, 3 * interval)) {
+                qWarning("%s: no frames for %lld ms", d->device.constData(), d->sinceFrame.elapsed());
+                reportStreamError(ETIMEDOUT);
+            }
+        }
+        break;
+    case LoadedState:
+        if (d->action == StartCamera && d->powerMode != IMX6CameraControlPrivate::Paused) {
+            if (connected) {
+                startStream();
+                DEBUG_V4L2_CAMERA("camera connected and resume stream");
+            } else {
+                DEBUG_V4L2_CAMERA("waiting for camera connection");
+            }
+        }
+        break;
+    case UnloadedState:
+        // Nothing is loaded until a session wants frames, see updatePowerMode()
+        if (d->action == StartCamera && d->powerMode != IMX6CameraControlPrivate::Paused) {
+            if (connected) {
+                loadAsync();
+                break;
+            }
+            DEBUG_V4L2_CAMERA("waiting for camera connection");
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (d->isCameraConnected != connected) {
+        d->isCameraConnected = connected;
+        emit cameraConnectionChanged(connected);
+    }
+}
+
+void IMX6CameraControl::queueFrame(int releasedIndex)
+{
+    IMX6_TRACE_SCOPE("queueFrame", releasedIndex);
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    // Unloaded buffers are unmapped once their last frame went away
+    QList<V4L2CameraFrameBuffer *>::Iterator it = d->retiredBuffers.begin();
+    while (it != d->retiredBuffers.end()) {
+        if ((*it)->isReferenced()) {
+            ++it;
+            continue;
+        }
+        Buffer handle = (*it)->bufferHandle();
+        unmapBuffer(&handle);
+        delete *it;
+        it = d->retiredBuffers.erase(it);
+    }
+
+    if (releasedIndex < 0 || d->state != ActiveState)
+        return;
+
+    if (!d->indexs.contains(releasedIndex))
+        return;
+
+    d->indexs.remove(releasedIndex);
+    v4l2_buffer buffer;
+    v4l2_plane planes[VIDEO_MAX_PLANES];
+    d->initBuffer(&buffer, planes);
+    buffer.index = releasedIndex;
+    if (v4l2_ioctl(d->handle, VIDIOC_QBUF, &buffer) < 0) {
+        // The driver is a buffer short until the recovery gives it back
+        qWarning("Could not queue new buffer. %d", releasedIndex);
+        reportStreamError(errno);
+    }
+}
+
+bool IMX6CameraControl::dequeueBuffer(IMX6CameraFrame *frame)
+{
+    Q_D(IMX6CameraControl);
+    v4l2_buffer buffer;
+    v4l2_plane planes[VIDEO_MAX_PLANES];
+
+    d->initBuffer(&buffer, planes);
+    if (ioctl(d->handle, VIDIOC_DQBUF, &buffer) < 0) { // use ioctl directly due to noisy v4l2
+        const int error = errno;
+        if (error != EAGAIN) {
+            qCritical("Could not dequeue buffer. %d, %s", error, strerror(error));
+            reportStreamError(error);
+        }
+        return false;
+    }
+
+    if (buffer.flags & V4L2_BUF_FLAG_ERROR) {
+        // Torn or incomplete picture, the buffer goes straight back. The stall
+        // timer keeps running, a stream of nothing but bad frames gets recovered.
+        d->corruptFrames.ref();
+        if (v4l2_ioctl(d->handle, VIDIOC_QBUF, &buffer) < 0)
+            reportStreamError(errno);
+        return false;
+    }
+
+    d->sinceFrame.restart();
+    d->indexs.insert(buffer.index);
+    const qint64 timestamp = qint64(buffer.timestamp.tv_sec) * 1000000 + buffer.timestamp.tv_usec;
+    // Older drivers, like mxc_v4l2_capture, stamp frames with the wall clock
+    const bool monotonic = (buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+    d->recordLatency(clockMicroseconds(monotonic ? CLOCK_MONOTONIC : CLOCK_REALTIME) - timestamp);
+    // A buffer that was held across a crop change still has the old layout
+    d->frameBuffers[buffer.index]->set_values(d->buffers[buffer.index], buffer.index);
+    *frame = IMX6CameraFrame(d->frameBuffers[buffer.index], d->frameSize, d->pixelFormat, ++d->frameSequence, timestamp);
+    return true;
+}
+
+void IMX6CameraControl::dequeueFrame()
+{
+    IMX6_TRACE_SCOPE("dequeueFrame", -1);
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    if (d->state != ActiveState)
+        return;
+
+    // When the render thread is the only one that wants frames it dequeues them
+    // itself, capture only wakes it up and stays quiet until it has pulled.
+    if (d->latestFrameConsumers > 0 && !isSignalConnected(QMetaMethod::fromSignal(&IMX6CameraControl::frameReady))) {
+        d->sinceFrame.restart();    // The driver completed a buffer, the stream is alive
+        setCaptureArmed(false);
+        locker.unlock();
+        emit frameAvailable();
+        return;
+    }
+
+    IMX6CameraFrame frame;
+    if (!dequeueBuffer(&frame))
+        return;
+    IMX6_TRACE_INSTANT("frameDequeued", frame.sequence);
+    // The capture thread leaves this to recoveryTimeout()
+    if (d->recoveryStep != IMX6CameraControlPrivate::NoRecovery && QThread::currentThread() == thread()) {
+        locker.unlock();
+        finishRecovery(true);
+        locker.relock();
+    }
+    if (d->skipFrame(frame.timestamp))
+        return; // Requeued when the frame goes out of scope, nobody hears of it
+    if (d->rateDivisor > 1 && ++d->divisorCount % d->rateDivisor)
+        return; // Thinned out for the sessions' governors
+    if (d->signatureConsumers > 0)
+        frame.signature = lumaSignature(frame);
+    const bool trackLatest = d->latestFrameConsumers > 0;
+    if (trackLatest)
+        d->latestFrame = frame;
+    locker.unlock();
+
+    // Receivers keep the buffer by copying the frame, otherwise it is requeued on return
+    emit frameReady(frame);
+    if (trackLatest)
+        emit frameAvailable();
+}
+
+IMX6CameraFrame IMX6CameraControl::latestFrame()
+{
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    if (d->state != ActiveState)
+        return IMX6CameraFrame();
+
+    // Drain whatever the driver has completed, only the newest frame is kept and
+    // the older buffers go straight back to the driver without being signalled.
+    IMX6CameraFrame frame;
+    bool fresh = false;
+    while (dequeueBuffer(&frame)) {
+        if (d->skipFrame(frame.timestamp))
+            continue;   // Requeued once the next one replaces it
+        if (d->rateDivisor > 1 && ++d->divisorCount % d->rateDivisor)
+            continue;   // Thinned out for the sessions' governors
+        d->latestFrame = frame;
+        fresh = true;
+    }
+    // Only the frame that is kept is worth a signature
+    if (fresh && d->signatureConsumers > 0)
+        d->latestFrame.signature = lumaSignature(d->latestFrame);
+    setCaptureArmed(true);
+    return d->latestFrame;
+}
+
+// Called with queueMutex held, from any thread
+void IMX6CameraControl::setCaptureArmed(bool armed)
+{
+    Q_D(IMX6CameraControl);
+    if (d->captureArmed == armed)
+        return;
+    d->captureArmed = armed;
+    if (d->captureThread) {
+        d->captureThread->setArmed(armed);
+    } else if (d->socketNotifier) {
+        if (QThread::currentThread() == thread())
+            d->socketNotifier->setEnabled(armed);
+        else
+            QMetaObject::invokeMethod(d->socketNotifier, "setEnabled", Qt::QueuedConnection, Q_ARG(bool, armed));
+    }
+}
+
+// Somebody new wants every frame, capture cannot wait for the render thread
+void IMX6CameraControl::connectNotify(const QMetaMethod &signal)
+{
+    Q_D(IMX6CameraControl);
+    if (signal == QMetaMethod::fromSignal(&IMX6CameraControl::frameReady)) {
+        QMutexLocker locker(&d->queueMutex);
+        setCaptureArmed(true);
+    }
+}
+
+// Errors come from any thread and in bursts, only one at a time is handled
+// and always on the control's thread, never inside the call that failed.
+void IMX6CameraControl::reportStreamError(int error)
+{
+    Q_D(IMX6CameraControl);
+    d->streamErrors.ref();
+    if (d->errorPending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "handleStreamError", Qt::QueuedConnection, Q_ARG(int, error));
+}
+
+void IMX6CameraControl::handleStreamError(int error)
+{
+    Q_D(IMX6CameraControl);
+    d->errorPending.store(0);
+    IMX6_TRACE_INSTANT("streamError", error);
+
+    if (d->recoveryStep == IMX6CameraControlPrivate::NoRecovery) {
+        if (d->state == UnloadedState) {
+            emit recoveryStatisticsChanged();
+            return;
+        }
+        qWarning("%s: stream error %d (%s), recovering", d->device.constData(), error, strerror(error));
+    } else if (d->recoveryTimer && d->recoveryTimer->isActive()) {
+        // Errors left over from the broken stream are likely, recoveryTimeout() judges the step
+        emit recoveryStatisticsChanged();
+        return;
+    }
+    runRecoveryStep();
+}
+
+void IMX6CameraControl::recoveryTimeout()
+{
+    Q_D(IMX6CameraControl);
+    if (d->recoveryStep == IMX6CameraControlPrivate::NoRecovery)
+        return;
+    if (d->loading) {
+        d->recoveryTimer->start(RECOVERY_CONFIRM_TIMEOUT);
+        return;
+    }
+
+    // Frames taken by the render thread count as well
+    QMutexLocker locker(&d->queueMutex);
+    const bool recovered = d->frameSequence != d->recoverySequence;
+    locker.unlock();
+    if (recovered)
+        finishRecovery(true);
+    else
+        runRecoveryStep();
+}
+
+// Takes the next step, every step gets RECOVERY_CONFIRM_TIMEOUT to bring a frame.
+void IMX6CameraControl::runRecoveryStep()
+{
+    Q_D(IMX6CameraControl);
+    if (d->action != StartCamera || d->powerMode == IMX6CameraControlPrivate::Paused) {
+        // Nobody wants frames, the next start begins from a clean stream anyway
+        if (d->recoveryTimer)
+            d->recoveryTimer->stop();
+        d->recoveryStep = IMX6CameraControlPrivate::NoRecovery;
+        emit recoveryStatisticsChanged();
+        return;
+    }
+
+    IMX6CameraControlPrivate::RecoveryStep step = d->recoveryStep;
+    switch (step) {
+    case IMX6CameraControlPrivate::NoRecovery:
+        d->recoveryTime.start();
+        // A stream that is not running has no buffers to give back
+        step = d->state == ActiveState ? IMX6CameraControlPrivate::RequeueStep
+                                       : IMX6CameraControlPrivate::RestartStep;
+        break;
+    case IMX6CameraControlPrivate::ReloadStep:
+        finishRecovery(false);
+        return;
+    default:
+        step = IMX6CameraControlPrivate::RecoveryStep(step + 1);
+        break;
+    }
+    d->recoveryStep = step;
+    DEBUG_V4L2_CAMERA("%s: recovery step %s", d->device.constData(), IMX6CameraControlPrivate::recoveryStepName(step));
+    IMX6_TRACE_SCOPE("recoveryStep", step);
+
+    if (!d->recoveryTimer) {
+        d->recoveryTimer = new QTimer(this);
+        d->recoveryTimer->setSingleShot(true);
+        connect(d->recoveryTimer, &QTimer::timeout, this, &IMX6CameraControl::recoveryTimeout);
+    }
+    {
+        QMutexLocker locker(&d->queueMutex);
+        d->recoverySequence = d->frameSequence;
+    }
+    d->recoveryTimer->start(RECOVERY_CONFIRM_TIMEOUT);
+
+    switch (step) {
+    case IMX6CameraControlPrivate::RequeueStep:
+        requeueBuffers();
+        break;
+    case IMX6CameraControlPrivate::RestartStep:
+        // Tearing down a broken stream fails more often than not, that is not news
+        d->errorPending.store(1);
+        stopStream();
+        d->errorPending.store(0);
+        startStream();
+        break;
+    case IMX6CameraControlPrivate::ReloadStep:
+        d->errorPending.store(1);
+        unload();
+        d->errorPending.store(0);
+        loadAsync();    // finishLoad() starts the stream
+        break;
+    default:
+        break;
+    }
+    emit recoveryStatisticsChanged();
+}
+
+void IMX6CameraControl::finishRecovery(bool recovered)
+{
+    Q_D(IMX6CameraControl);
+    if (d->recoveryStep == IMX6CameraControlPrivate::NoRecovery)
+        return;
+
+    if (d->recoveryTimer)
+        d->recoveryTimer->stop();
+    d->lastRecoveryTime = d->recoveryTime.elapsed();
+    d->maxRecoveryTime = qMax(d->maxRecoveryTime, d->lastRecoveryTime);
+    const IMX6CameraControlPrivate::RecoveryStep step = d->recoveryStep;
+    d->recoveryStep = IMX6CameraControlPrivate::NoRecovery;
+
+    if (recovered) {
+        ++d->recoveries[step];
+        qWarning("%s: stream recovered by %s after %lld ms", d->device.constData(),
+                 IMX6CameraControlPrivate::recoveryStepName(step), d->lastRecoveryTime);
+    } else {
+        // Out of options, wait for the device the way a first start does
+        ++d->failedRecoveries;
+        qCritical("%s: stream recovery failed after %lld ms", d->device.constData(), d->lastRecoveryTime);
+        d->errorPending.store(1);
+        unload();
+        d->errorPending.store(0);
+        startCameraDetection(CAMERA_LOAD_DETECTION_INTERVAL);
+    }
+    emit recoveryStatisticsChanged();
+}
+
+// Gives the driver back buffers that are neither queued, done nor held by a
+// frame, which is what a failed QBUF or a driver dropping a buffer leaves behind.
+void IMX6CameraControl::requeueBuffers()
+{
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    if (d->state != ActiveState)
+        return;
+
+    for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+        if (d->indexs.contains(i))
+            continue;   // Queued when its frames are released
+
+        v4l2_buffer buffer;
+        v4l2_plane planes[VIDEO_MAX_PLANES];
+        d->initBuffer(&buffer, planes);
+        buffer.index = i;
+        if (v4l2_ioctl(d->handle, VIDIOC_QUERYBUF, &buffer) < 0) {
+            reportStreamError(errno);
+            return;
+        }
+        if (buffer.flags & (V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE))
+            continue;
+
+        d->initBuffer(&buffer, planes);
+        buffer.index = i;
+        if (v4l2_ioctl(d->handle, VIDIOC_QBUF, &buffer) < 0) {
+            reportStreamError(errno);
+            return;
+        }
+        DEBUG_V4L2_CAMERA("Requeued lost buffer %d", i);
+    }
+}
+
+IMX6CameraSchedulingProfile IMX6CameraControl::captureProfile() const
+{
+    Q_D(const IMX6CameraControl);
+    return d->captureProfile;
+}
+
+void IMX6CameraControl::setCaptureProfile(const IMX6CameraSchedulingProfile &profile)
+{
+    Q_D(IMX6CameraControl);
+    d->captureProfile = profile;
+    if (d->state != UnloadedState)
+        updateCaptureThread();  // A new thread, the profile applies when it starts
+}
+
+IMX6CameraSchedulingProfile IMX6CameraControl::processingProfile() const
+{
+    Q_D(const IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    return d->processingProfile;
+}
+
+// Stages pick the profile up when they attach
+void IMX6CameraControl::setProcessingProfile(const IMX6CameraSchedulingProfile &profile)
+{
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    d->processingProfile = profile;
+}
+
+bool IMX6CameraControl::lockBuffers() const
+{
+    Q_D(const IMX6CameraControl);
+    return d->lockBuffers;
+}
+
+void IMX6CameraControl::setLockBuffers(bool lock)
+{
+    Q_D(IMX6CameraControl);
+    d->lockBuffers = lock;
+}
+
+QVariantMap IMX6CameraControl::dequeueLatency() const
+{
+    Q_D(const IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    const double bucketWidth = LATENCY_BUCKET_WIDTH / 1000.0;
+    QVariantList histogram;
+    double percentiles[3] = { 0, 0, 0 };
+    const double shares[3] = { 0.5, 0.95, 0.99 };
+    quint32 cumulative = 0;
+    int next = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+        histogram.append(d->latencyHistogram[bucket]);
+        cumulative += d->latencyHistogram[bucket];
+        // Upper edge of the bucket the percentile falls into
+        while (next < 3 && d->latencyCount && cumulative >= shares[next] * d->latencyCount)
+            percentiles[next++] = (bucket + 1) * bucketWidth;
+    }
 
-    d->socketNotifier = new QSocketNotifier(d->handle, QSocketNotifier::Read, this);
-    connect(d->socketNotifier, &QSocketNotifier::activated, this, &IMX6CameraControl::dequeueFrame);
+    QVariantMap latency;
+    latency.insert(QStringLiteral("count"), d->latencyCount);
+    latency.insert(QStringLiteral("mean"), d->latencyCount ? d->latencySum / 1000.0 / d->latencyCount : 0.0);
+    latency.insert(QStringLiteral("median"), percentiles[0]);
+    latency.insert(QStringLiteral("p95"), percentiles[1]);
+    latency.insert(QStringLiteral("p99"), percentiles[2]);
+    latency.insert(QStringLiteral("max"), d->latencyMax / 1000.0);
+    latency.insert(QStringLiteral("bucketWidth"), bucketWidth);
+    latency.insert(QStringLiteral("histogram"), histogram);
+    return latency;
+}
 
-    for (int i = 0; i < V_BUFFER_COUNT; ++i) {
-        v4l2_buffer buffer;
-        memset(&buffer, 0, sizeof(buffer));
-        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buffer.memory = V_MAP_MODE;
-        buffer.index = i;
-        if (v4l2_ioctl(d->handle, VIDIOC_QUERYBUF, &buffer) < 0) {
-            qCritical("Could not query video buffer.");
-            unload();
-            return false;
-        }
+QVariantMap IMX6CameraControl::recoveryStatistics() const
+{
+    Q_D(const IMX6CameraControl);
+    QVariantMap statistics;
+    statistics.insert(QStringLiteral("errors"), d->streamErrors.load());
+    statistics.insert(QStringLiteral("corruptFrames"), d->corruptFrames.load());
+    statistics.insert(QStringLiteral("requeueRecoveries"), d->recoveries[IMX6CameraControlPrivate::RequeueStep]);
+    statistics.insert(QStringLiteral("restartRecoveries"), d->recoveries[IMX6CameraControlPrivate::RestartStep]);
+    statistics.insert(QStringLiteral("reloadRecoveries"), d->recoveries[IMX6CameraControlPrivate::ReloadStep]);
+    statistics.insert(QStringLiteral("failedRecoveries"), d->failedRecoveries);
+    statistics.insert(QStringLiteral("lastRecoveryTime"), d->lastRecoveryTime);
+    statistics.insert(QStringLiteral("maxRecoveryTime"), d->maxRecoveryTime);
+    statistics.insert(QStringLiteral("recovering"), d->recoveryStep != IMX6CameraControlPrivate::NoRecovery);
+    return statistics;
+}
 
-        void *data = v4l2_mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, d->handle, buffer.m.offset);
-        if (data == MAP_FAILED) {
-            qCritical("Failed to map video buffer.");
-            unload();
-            return false;
-        }
-        d->buffers[i].start = reinterpret_cast<uchar *>(data);
-        d->buffers[i].bytesPerLine = format.fmt.pix.bytesperline;
-        // Workaround for alignment assumption in front-end
-        if (pixelFormat == IMX6CameraFrame::Format_YUV420P || pixelFormat == IMX6CameraFrame::Format_YV12)
-            d->buffers[i].length = d->buffers[i].bytesPerLine * format.fmt.pix.height * 1.5;
-        else
-            d->buffers[i].length = buffer.length;
+void IMX6CameraControl::addLatestFrameConsumer()
+{
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    ++d->latestFrameConsumers;
+}
 
-        d->frameBuffers[i]->set_values(d->buffers[i], i);
+void IMX6CameraControl::removeLatestFrameConsumer()
+{
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    if (--d->latestFrameConsumers <= 0) {
+        d->latestFrameConsumers = 0;
+        d->latestFrame = IMX6CameraFrame();
+        setCaptureArmed(true);
     }
+}
 
-    d->state =  LoadedState;
-    queryControls();
-    return true;
+void IMX6CameraControl::addSignatureConsumer()
+{
+    Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    ++d->signatureConsumers;
 }
 
-bool IMX6CameraControl::unload()
+void IMX6CameraControl::removeSignatureConsumer()
 {
     Q_D(IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    d->signatureConsumers = qMax(0, d->signatureConsumers - 1);
+}
 
-    if (d->state == UnloadedState)
+bool IMX6CameraControl::startFrameSharing(const QString &socketPath)
+{
+    Q_D(IMX6CameraControl);
+    if (!d->publisher) {
+        d->publisher = new IMX6CameraFramePublisher(this);
+        connect(this, &IMX6CameraControl::frameReady, d->publisher, &IMX6CameraFramePublisher::publish);
+    }
+    if (!d->publisher->listen(socketPath)) {
+        stopFrameSharing();
         return false;
-
-    if (d->state == ActiveState)
-        stopStream();
-
-    QSet<int>::Iterator it = d->indexs.begin();
-    for (; it != d->indexs.end(); ++it)
-        queueFrame(*it);
-
-    if (d->handle >= 0) {
-        if (d->socketNotifier) {
-            d->socketNotifier->setEnabled(false);
-            d->socketNotifier->deleteLater();
-        }
-
-        for (int i = 0; i < V_BUFFER_COUNT; ++i)
-            v4l2_munmap(d->buffers[i].start, d->buffers[i].length);
-        v4l2_close(d->handle);
-        d->handle = -1;
     }
-
-    d->state = UnloadedState;
+    if (d->state != UnloadedState)
+        d->publisher->setBuffers(d->frameBuffers.values());
     return true;
 }
 
-#define CAMERA_LOAD_DETECTION_INTERVAL 200
-#define CAMERA_REMOVE_DETECTION_INTERVAL 1000
-bool IMX6CameraControl::startCamera(uint sessionId)
+void IMX6CameraControl::stopFrameSharing()
 {
     Q_D(IMX6CameraControl);
-    IMX6CameraControlPrivate::openSessionIdList.insert(sessionId);
-    switch (d->state) {
-    case LoadedState:
-        startCameraStream();
-        break;
-    case UnloadedState:
-        d->action = StartCamera;
-        startCameraDetection(CAMERA_LOAD_DETECTION_INTERVAL);
-        break;
-    default:
-        break;
-    }
-    return true;
+    delete d->publisher;
+    d->publisher = NULL;
 }
 
-bool IMX6CameraControl::stopCameraStream(int sessionId)
+qreal IMX6CameraControl::frameRate() const
+{
+    Q_D(const IMX6CameraControl);
+    return d->frameRate;
+}
+
+bool IMX6CameraControl::setFrameRate(qreal rate)
 {
     Q_D(IMX6CameraControl);
-    IMX6CameraControlPrivate::openSessionIdList.remove(sessionId);
-    d->action = StopCamera;
-    stopStream();
+    rate = qMax<qreal>(0, rate);
+    if (qFuzzyCompare(d->frameRate + 1, rate + 1))
+        return true;
 
-    if (!IMX6CameraControlPrivate::openSessionIdList.isEmpty()) {
-        QMetaObject::invokeMethod(this
-                                  , "startCamera"
-                                  , Qt::QueuedConnection
-                                  , Q_ARG(uint, IMX6CameraControlPrivate::openSessionIdList.values().first()));
-    }
+    d->frameRate = rate;
+    if (d->powerMode != IMX6CameraControlPrivate::Decimated)
+        updateFrameRate(false);
+    emit frameRateChanged(d->frameRate);
     return true;
 }
 
-bool IMX6CameraControl::startCameraStream()
+// Negotiates the requested rate with the driver and decimates whatever is left
+void IMX6CameraControl::updateFrameRate(bool restart)
 {
     Q_D(IMX6CameraControl);
-    d->action = StartCamera;
-    return startStream();
+    qreal driverRate = 0;
+    if (d->frameIntervalSupported && d->handle >= 0) {
+        if (d->frameRate > 0) {
+            d->frameInterval.numerator = 1000;
+            d->frameInterval.denominator = qRound(d->frameRate * 1000);
+        } else {
+            d->frameInterval = d->defaultFrameInterval;
+        }
+        applyFrameInterval(d->frameInterval.numerator, d->frameInterval.denominator, restart);
+
+        // The driver rounds to what the sensor can do
+        v4l2_streamparm parameters;
+        memset(&parameters, 0, sizeof(parameters));
+        parameters.type = d->bufferType;
+        if (ioctl(d->handle, VIDIOC_G_PARM, &parameters) == 0 && parameters.parm.capture.timeperframe.numerator) {
+            driverRate = qreal(parameters.parm.capture.timeperframe.denominator)
+                    / parameters.parm.capture.timeperframe.numerator;
+        }
+    }
+
+    const bool decimate = d->frameRate > 0 && (driverRate <= 0 || driverRate > d->frameRate * 1.05);
+    DEBUG_V4L2_CAMERA("Frame rate %f, driver %f, decimating %d", d->frameRate, driverRate, decimate);
+    QMutexLocker locker(&d->queueMutex);
+    d->decimationPeriod = decimate ? qint64(1000000 / d->frameRate) : 0;
+    d->nextDelivery = 0;
+    d->lastCaptureTimestamp = 0;
 }
 
-bool IMX6CameraControl::startStream()
+bool IMX6CameraControl::applyFrameInterval(quint32 numerator, quint32 denominator, bool restart)
 {
     Q_D(IMX6CameraControl);
-    if (d->state != LoadedState)
+    if (!d->frameIntervalSupported || d->handle < 0 || !numerator || !denominator)
         return false;
 
-    Q_ASSERT(d->handle >= 0);
-    d->reloadCount = 0;
-    for (int i = 0; i < V_BUFFER_COUNT; ++i) {
-        v4l2_buffer buffer;
-        memset(&buffer, 0, sizeof(buffer));
-        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buffer.memory = V_MAP_MODE;
-        buffer.index = i;
-        if (v4l2_ioctl(d->handle, VIDIOC_QBUF, &buffer) < 0) {
-            qCritical("Could not queue buffer.");
-            unload();
+    v4l2_streamparm parameters;
+    memset(&parameters, 0, sizeof(parameters));
+    parameters.type = d->bufferType;
+    parameters.parm.capture.timeperframe.numerator = numerator;
+    parameters.parm.capture.timeperframe.denominator = denominator;
+
+    const bool streaming = d->state == ActiveState;
+    if (ioctl(d->handle, VIDIOC_S_PARM, &parameters) < 0) {
+        if (errno != EBUSY || !streaming) {
+            qWarning("Could not set the frame interval to %u/%u. %d %s", numerator, denominator, errno, strerror(errno));
             return false;
         }
+        // Some drivers only change the rate while stopped
+        stopStream();
+        const bool ok = ioctl(d->handle, VIDIOC_S_PARM, &parameters) == 0;
+        startStream();
+        return ok;
     }
-    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (v4l2_ioctl(d->handle, VIDIOC_STREAMON, &type) < 0) {
-        qCritical( "Could not start the stream.");
-        return false;
+
+    if (restart && streaming) {
+        // Drops the frame that is still being captured at the old interval
+        stopStream();
+        startStream();
     }
-    d->state = ActiveState;
     return true;
 }
 
-bool IMX6CameraControl::stopStream()
+void IMX6CameraControl::setSessionRateDivisor(int sessionId, int divisor)
 {
     Q_D(IMX6CameraControl);
-    if (d->handle < 0)
-        return false;
+    if (divisor > 1)
+        d->sessionRateDivisors.insert(sessionId, divisor);
+    else
+        d->sessionRateDivisors.remove(sessionId);
+    updateRateDivisor();
+}
 
-    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (v4l2_ioctl(d->handle, VIDIOC_STREAMOFF, &type) < 0) {
-        qCritical("Could not stop the stream.");
-        unload();
-        return false;
+void IMX6CameraControl::updateRateDivisor()
+{
+    Q_D(IMX6CameraControl);
+    int divisor = d->openSessionIdList.isEmpty() ? 1 : INT_MAX;
+    Q_FOREACH (int session, d->openSessionIdList)
+        divisor = qMin(divisor, d->sessionRateDivisors.value(session, 1));
+
+    QMutexLocker locker(&d->queueMutex);
+    if (d->rateDivisor != divisor) {
+        DEBUG_V4L2_CAMERA("Rate divisor %d -> %d", d->rateDivisor, divisor);
+        d->rateDivisor = divisor;
+        d->divisorCount = 0;
     }
-    d->state = LoadedState;
+}
 
-    QSet<int>::Iterator it = d->indexs.begin();
-    for (; it != d->indexs.end(); ++it)
-        queueFrame(*it);
-    return true;
+int IMX6CameraControl::bufferCount()
+{
+    return V_BUFFER_COUNT;
 }
 
-void IMX6CameraControl::startCameraDetection(int interval)
+int IMX6CameraControl::heldBuffers() const
 {
-    Q_D(IMX6CameraControl);
-    if (!d->cameraDetectTimer) {
-        d->cameraDetectTimer = new QTimer(this);
-        connect(d->cameraDetectTimer, &QTimer::timeout, this, &IMX6CameraControl::cameraDetectTimeout);
-    }
-    d->cameraDetectTimer->start(interval);
+    Q_D(const IMX6CameraControl);
+    QMutexLocker locker(&d->queueMutex);
+    return d->state == ActiveState ? d->indexs.size() : 0;
 }
 
-void IMX6CameraControl::cameraDetectTimeout()
+void IMX6CameraControl::setSessionDemand(int sessionId, bool active, IdlePolicy policy)
 {
     Q_D(IMX6CameraControl);
-    DEBUG_V4L2_CAMERA("%s, %d, %d %d", Q_FUNC_INFO, d->state, d->action, d->handle);
+    if (active)
+        d->idleSessions.remove(sessionId);
+    else
+        d->idleSessions.insert(sessionId, policy);
+    updatePowerMode();
+}
 
-    if (d->handle < 0) {
-        d->handle = v4l2_open(d->device.constData(), O_RDWR | O_NONBLOCK, 0);
-        if (d->handle < 0) {
-            qCritical("Could not open the video device.");
+void IMX6CameraControl::updatePowerMode()
+{
+    Q_D(IMX6CameraControl);
+    const QSet<int> &sessions = d->openSessionIdList;
+    bool idle = !sessions.isEmpty();
+    bool pause = true;
+    Q_FOREACH (int session, sessions) {
+        if (!d->idleSessions.contains(session)) {
+            idle = false;
+            break;
         }
+        if (d->idleSessions.value(session) != PauseWhenIdle)
+            pause = false;
     }
-    bool connected = pollVDLOSS();
-    switch (d->state) {
-    case ActiveState:
-        if (d->action == StartCamera && !connected) {
-            stopStream();
-            DEBUG_V4L2_CAMERA("Camera removed, stop stream");
-        }
-        break;
-    case LoadedState:
-        if (d->action == StartCamera) {
-            if (connected) {
-                startStream();
-                DEBUG_V4L2_CAMERA("camera connected and resume stream");
-            } else {
-                DEBUG_V4L2_CAMERA("waiting for camera connection");
-            }
-        }
+
+    IMX6CameraControlPrivate::PowerMode mode = IMX6CameraControlPrivate::Streaming;
+    if (idle)
+        mode = pause || !d->frameIntervalSupported ? IMX6CameraControlPrivate::Paused : IMX6CameraControlPrivate::Decimated;
+    if (mode == d->powerMode)
+        return;
+
+    DEBUG_V4L2_CAMERA("Power mode %d -> %d", d->powerMode, mode);
+    const IMX6CameraControlPrivate::PowerMode previous = d->powerMode;
+    d->powerMode = mode;
+
+    if (previous == IMX6CameraControlPrivate::Decimated)
+        updateFrameRate(mode == IMX6CameraControlPrivate::Streaming);
+
+    switch (mode) {
+    case IMX6CameraControlPrivate::Streaming:
+        if (d->state == LoadedState && d->action == StartCamera)
+            startStream();
+        else if (d->state == UnloadedState && d->action == StartCamera)
+            QTimer::singleShot(0, this, &IMX6CameraControl::cameraDetectTimeout);   // Load without waiting for the next poll
         break;
-    case UnloadedState:
-        if (d->action == StartCamera) {
-            if (connected && load()) {
-                startStream();
-                d->cameraDetectTimer->setInterval(CAMERA_REMOVE_DETECTION_INTERVAL);
-                return;
-            }
-            DEBUG_V4L2_CAMERA("waiting for camera connection");
+    case IMX6CameraControlPrivate::Decimated:
+        if (d->state == LoadedState && d->action == StartCamera)
+            startStream();
+        if (!applyFrameInterval(1, IDLE_FRAME_RATE, false)) {
+            d->powerMode = IMX6CameraControlPrivate::Paused;
+            if (d->state == ActiveState)
+                stopStream();
         }
         break;
-    default:
+    case IMX6CameraControlPrivate::Paused:
+        if (d->state == ActiveState)
+            stopStream();
         break;
     }
-
-    if (d->isCameraConnected != connected) {
-        d->isCameraConnected = connected;
-        emit cameraConnectionChanged(connected);
-    }
 }
 
-void IMX6CameraControl::queueFrame(int releasedIndex)
+bool IMX6CameraControl::hasOtherSessions(int sessionId) const
 {
-    Q_D(IMX6CameraControl);
-    if (d->state != ActiveState)
-        return;
+    Q_D(const IMX6CameraControl);
+    const int count = d->openSessionIdList.size();
+    return d->openSessionIdList.contains(sessionId) ? count > 1 : count > 0;
+}
 
-    if (!d->indexs.contains(releasedIndex))
-        return;
+bool IMX6CameraControl::isCropSupported() const
+{
+    Q_D(const IMX6CameraControl);
+    return d->cropSupported;
+}
 
-    d->indexs.remove(releasedIndex);
-    v4l2_buffer buffer;
-    memset(&buffer, 0, sizeof(buffer));
-    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V_MAP_MODE;
-    buffer.index = releasedIndex;
-    if (v4l2_ioctl(d->handle, VIDIOC_QBUF, &buffer) < 0) {
-        qDebug("Could not queue new buffer. %d", releasedIndex);
-        return;
-    }
+QRect IMX6CameraControl::cropRect() const
+{
+    Q_D(const IMX6CameraControl);
+    return d->cropRect;
 }
 
-void IMX6CameraControl::dequeueFrame()
+bool IMX6CameraControl::setCropRect(const QRect &rect)
 {
     Q_D(IMX6CameraControl);
-    if (d->state != ActiveState)
-        return;
-    v4l2_buffer buffer;
+    if (!d->cropSupported || d->handle < 0 || d->size.isEmpty() || d->defaultCrop.isEmpty())
+        return false;
 
-    memset(&buffer, 0, sizeof(buffer));
-    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V_MAP_MODE;
-    if (ioctl(d->handle, VIDIOC_DQBUF, &buffer) < 0) { // use ioctl directly due to noisy v4l2
-        qCritical("Could not dequeue buffer. %d, %s", errno, strerror(errno));
-        return;
-    }
+    const QRect frameRect(QPoint(0, 0), d->size);
+    const QRect target = rect.isEmpty() ? frameRect : (rect & frameRect);
+    if (target.isEmpty())
+        return false;
+    if (target == d->cropRect)
+        return true;
 
-    d->indexs.insert(buffer.index);
-    IMX6CameraFrame frame(d->frameBuffers[buffer.index], d->size, d->pixelFormat);
-    emit frameReady(frame);
-}
+    // Map from frame coordinates to the sensor coordinates of the default crop
+    const qreal scaleX = qreal(d->defaultCrop.width()) / d->size.width();
+    const qreal scaleY = qreal(d->defaultCrop.height()) / d->size.height();
+    v4l2_rect sensorRect;
+    sensorRect.left = d->defaultCrop.x() + qRound(target.x() * scaleX);
+    sensorRect.top = d->defaultCrop.y() + qRound(target.y() * scaleY);
+    sensorRect.width = qRound(target.width() * scaleX);
+    sensorRect.height = qRound(target.height() * scaleY);
+
+    // Buffers the driver holds may be filled in either geometry, a restart drops
+    // them. Frames out with consumers keep the layout they were captured in.
+    QMutexLocker locker(&d->queueMutex);
+    const bool restart = d->state == ActiveState;
+    if (restart)
+        stopStream();
 
-void IMX6CameraControl::queryControls()
-{
-    Q_D(IMX6CameraControl);
-    for (int index = V4L2_CID_BASE; index < V4L2_CID_LASTP1; ++index) {
-        struct v4l2_queryctrl queryctrl;
-        memset(&queryctrl, 0, sizeof(queryctrl));
-        queryctrl.id = index;
-        if (0 == ioctl(d->handle, VIDIOC_QUERYCTRL, &queryctrl)) {
-            if (queryctrl.flags & V4L2_CTRL_FLAG_DISABLED)
-                continue;
-            int readId;
-            switch (queryctrl.id) {
-            case V4L2_CID_BRIGHTNESS:
-                readId = IMX6Camera::Brightness;
-                break;
-            case V4L2_CID_CONTRAST:
-                readId = IMX6Camera::Contrast;
-                break;
-            case V4L2_CID_SATURATION:
-                readId = IMX6Camera::Saturation;
-                break;
-            case V4L2_CID_HFLIP:
-                readId = IMX6Camera::HorizontaMirror;
-                break;
-            default:
-                DEBUG_V4L2_CAMERA("Skip Control %s\n", queryctrl.name);
-                continue;
-            }
-            d->supportedControls.insert(readId, queryctrl);
+    bool cropped = false;
+    if (d->useSelectionApi) {
+        v4l2_selection selection;
+        memset(&selection, 0, sizeof(selection));
+        selection.target = V4L2_SEL_TGT_CROP;
+        selection.r = sensorRect;
+        if (-1 == cropIoctl(d->handle, VIDIOC_S_SELECTION, &selection, &selection.type, d->bufferType)) {
+            DEBUG_V4L2_CAMERA("VIDIOC_S_SELECTION failed %d", errno);
         } else {
-            if (errno == EINVAL)
-                continue;
-            qCritical("VIDIOC_QUERYCTRL error %d", errno);
+            sensorRect = selection.r; // The driver may adjust the rectangle
+            cropped = true;
+        }
+    } else {
+        v4l2_crop crop;
+        memset(&crop, 0, sizeof(crop));
+        crop.c = sensorRect;
+        if (-1 == cropIoctl(d->handle, VIDIOC_S_CROP, &crop, &crop.type, d->bufferType)) {
+            DEBUG_V4L2_CAMERA("VIDIOC_S_CROP failed %d", errno);
+        } else {
+            if (0 == ioctl(d->handle, VIDIOC_G_CROP, &crop))
+                sensorRect = crop.c;
+            cropped = true;
+        }
+    }
+
+    // Without a scaler the driver now delivers smaller frames, which is what saves DMA bandwidth
+    v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = d->bufferType;
+    if (cropped && 0 == v4l2_ioctl(d->handle, VIDIOC_G_FMT, &format)) {
+        if (d->isMultiPlanar())
+            d->frameSize = QSize(format.fmt.pix_mp.width, format.fmt.pix_mp.height);
+        else
+            d->frameSize = QSize(format.fmt.pix.width, format.fmt.pix.height);
+        d->updatePlaneLayout(format);
+        // Held buffers pick the new layout up in dequeueBuffer() once they come back
+        for (int i = 0; i < V_BUFFER_COUNT; ++i) {
+            if (!d->frameBuffers[i]->isReferenced())
+                d->frameBuffers[i]->set_values(d->buffers[i], i);
         }
     }
+    if (restart)
+        startStream();
+    if (!cropped)
+        return false;
+
+    d->cropRect = QRect(qRound((sensorRect.left - d->defaultCrop.x()) / scaleX),
+                        qRound((sensorRect.top - d->defaultCrop.y()) / scaleY),
+                        qRound(sensorRect.width / scaleX),
+                        qRound(sensorRect.height / scaleY));
+    locker.unlock();
+    emit cropRectChanged(d->cropRect);
+    return true;
 }
 
 IMX6CameraControl::State IMX6CameraControl::state() const
@@ -600,22 +2218,10 @@ int IMX6CameraControl::parameter(int id) const
     }
     return returnValue;
 }
-#ifndef V4L2_CID_VID_VIDEO_DETECT
-#define V4L2_CID_VID_VIDEO_DETECT (V4L2_CID_BASE + 39)
-#endif
-
 bool IMX6CameraControl::pollVDLOSS()
 {
     Q_D(IMX6CameraControl);
-    struct v4l2_control ctrl;
-    memset(&ctrl, 0, sizeof(ctrl));
-    ctrl.id = V4L2_CID_VID_VIDEO_DETECT;
-    int ret = ioctl(d->handle, VIDIOC_G_CTRL, &ctrl);
-    if (-1 == ret) {
-        qCritical() << "ioctl VDLOSS failed";
-        return false;
-    }
-    return ctrl.value == 1;
+    return pollVideoDetect(d->handle);
 }
 
 bool IMX6CameraControl::isCameraConnected() const
@@ -629,3 +2235,25 @@ QSize IMX6CameraControl::sourceSize() const
     Q_D(const IMX6CameraControl);
     return d->size;
 }
+
+QSize IMX6CameraControl::frameSize() const
+{
+    Q_D(const IMX6CameraControl);
+    return d->frameSize;
+}
+
+QSize IMX6CameraControl::bufferSize() const
+{
+    // Frame size in pixels including the stride padding of the first plane
+    Q_D(const IMX6CameraControl);
+    const int bytesPerLine = d->buffers[0].planes[0].bytesPerLine;
+    if (bytesPerLine <= 0)
+        return d->frameSize;
+    return QSize(qMax(d->frameSize.width(), bytesPerLine / IMX6CameraFrame::bytesPerPixel(d->pixelFormat)), d->frameSize.height());
+}
+
+bool IMX6CameraControl::isMultiPlanar() const
+{
+    Q_D(const IMX6CameraControl);
+    return d->isMultiPlanar();
+}
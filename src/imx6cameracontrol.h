@@ -36,16 +36,40 @@
 #ifndef IMAX6CAMERACONTROL_H
 #define IMAX6CAMERACONTROL_H
 
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
 #include <QObject>
+#include <QRect>
 #include <QSize>
+#include <QVariantMap>
+#include "imx6camerascheduling.h"
+#define IMX6_CAMERA_MAX_PLANES 3
+#define IMX6_CAMERA_DEFAULT_DEVICE "/dev/video0"
+
+// One plane of pixel data as the driver laid it out in memory
+struct BufferPlane {
+    uchar *data;        // Mapped address of the first pixel of the plane
+    size_t offset;      // Offset of the plane within its memory buffer
+    int bytesPerLine;   // Stride, including any padding
+    size_t length;      // Size of the plane in bytes
+    int fd;             // dmabuf of the memory buffer holding the plane, -1 if not exported
+};
+
 struct Buffer {
-    uchar *start;
-    size_t length;
-    int bytesPerLine;
+    // Mapped memory buffers, one per plane on multi-planar devices
+    uchar *start[IMX6_CAMERA_MAX_PLANES];
+    size_t length[IMX6_CAMERA_MAX_PLANES];
+    int fd[IMX6_CAMERA_MAX_PLANES];
+    int memoryCount;
+
+    BufferPlane planes[IMX6_CAMERA_MAX_PLANES];
+    int planeCount;
 };
 
 class IMX6CameraFrame;
 class IMX6CameraControlPrivate;
+struct IMX6CameraDeviceSetup;
 class IMX6Camera;
 class IMX6CameraControl : public QObject
 {
@@ -63,11 +87,24 @@ public:
         StopCamera
     };
 
+    enum IdlePolicy {
+        DecimateWhenIdle,   // Keep streaming at a low frame rate
+        PauseWhenIdle       // Stop streaming but keep the buffers mapped
+    };
+
+    // One control per capture device, shared by every session that shows it
     static IMX6CameraControl *cameraControl(int *sessionId, QObject *parent = 0);
+    static IMX6CameraControl *cameraControl(const QByteArray &device, int *sessionId, QObject *parent = 0);
+
+    QByteArray device() const;
 
     bool load();
     bool unload();
 
+    // Opens and maps the device on a worker thread, the control is loaded
+    // once the worker is done. Nothing happens while a load is running.
+    void loadAsync();
+
     State state() const;
 
     bool setParameter(int id, uint value);
@@ -77,11 +114,77 @@ public:
     bool pollVDLOSS();
     bool isCameraConnected() const;
     QSize sourceSize() const;
+    QSize frameSize() const;
+    QSize bufferSize() const;
+    bool isMultiPlanar() const;
+
+    // Capture rate in frames per second, 0 for the driver default. Rates the
+    // driver cannot provide are reached by dropping frames at dequeue time.
+    qreal frameRate() const;
+    bool setFrameRate(qreal rate);
+
+    // The sensor crop applies to every session of the device, so items only
+    // crop while no other session is open, see IMX6Camera::sensorCrop
+    bool isCropSupported() const;
+    QRect cropRect() const;
+    bool setCropRect(const QRect &rect);
+    bool hasOtherSessions(int sessionId) const;
+
+    // Low-latency access for the render thread, see IMX6Camera::lowLatency. While
+    // nobody is connected to frameReady, frames are only dequeued by latestFrame()
+    // and the capture side just emits frameAvailable.
+    IMX6CameraFrame latestFrame();
+    void addLatestFrameConsumer();
+    void removeLatestFrameConsumer();
+
+    // Frames carry a luma signature while anyone needs it, see IMX6Camera::changeDetection
+    void addSignatureConsumer();
+    void removeSignatureConsumer();
+
+    // A session that shows nothing asks for fewer frames, the device idles
+    // when no session wants frames.
+    void setSessionDemand(int sessionId, bool active, IdlePolicy policy = DecimateWhenIdle);
+
+    // A session under load asks for every divisor-th frame only. Frames are
+    // thinned out when every open session asks for it, by the smallest divisor.
+    void setSessionRateDivisor(int sessionId, int divisor);
+
+    // Driver buffers, and how many of them are out with consumers
+    static int bufferCount();
+    int heldBuffers() const;
+
+    // Publishes every frame to other processes, see imx6camerashm.h
+    bool startFrameSharing(const QString &socketPath);
+    void stopFrameSharing();
+
+    // Scheduling of the thread that dequeues frames and of the workers of the
+    // processing stages. With a capture profile other than the default, frames
+    // are dequeued on a thread of their own and frameReady is emitted there.
+    IMX6CameraSchedulingProfile captureProfile() const;
+    void setCaptureProfile(const IMX6CameraSchedulingProfile &profile);
+    IMX6CameraSchedulingProfile processingProfile() const;
+    void setProcessingProfile(const IMX6CameraSchedulingProfile &profile);
+
+    // Locks the mapped buffers into memory, from the next load
+    bool lockBuffers() const;
+    void setLockBuffers(bool lock);
+
+    // Time from the driver timestamping a frame to its dequeue: count, and mean,
+    // median, p95, p99 and max in milliseconds. histogram counts frames in
+    // buckets of bucketWidth milliseconds, the last bucket is open ended.
+    QVariantMap dequeueLatency() const;
+
+    // Stream errors and how they were dealt with: errors, corruptFrames,
+    // requeueRecoveries, restartRecoveries, reloadRecoveries, failedRecoveries,
+    // lastRecoveryTime and maxRecoveryTime in milliseconds, and recovering.
+    QVariantMap recoveryStatistics() const;
 
 public slots:
     void queueFrame(int releasedIndex);
     void dequeueFrame();
 
+    // Sessions are counted, starting one on a running stream and stopping
+    // one that is not the last do not touch the device
     bool startCamera(uint sessionId);
     bool stopCameraStream(int sessionId);
     bool startCameraStream();
@@ -89,21 +192,46 @@ public slots:
 
 signals:
     void frameReady(const IMX6CameraFrame &frame);
+    void frameAvailable();
     void cameraConnectionChanged(bool);
     void sourceSizeChanged(QSize);
+    void cropRectChanged(const QRect &rect);
+    void frameRateChanged(qreal rate);
+    void openSessionsChanged();
+    void supportedParametersChanged();  // The device was loaded, the sensor controls are known
+    void recoveryStatisticsChanged();
+    void dequeueLatencyChanged();   // Once a second while streaming
 
 private slots:
     void cameraDetectTimeout();
     bool startStream();
     bool stopStream();
+    void handleStreamError(int error);
+    void recoveryTimeout();
+    void finishLoad();
+    void finishDetection(bool connected);
 
 private:
-    IMX6CameraControl(QObject *parent = 0);
+    IMX6CameraControl(const QByteArray &device, QObject *parent = 0);
     ~IMX6CameraControl();
-    void queryControls();
+    void adoptDevice(IMX6CameraDeviceSetup *setup);
+    void updateCaptureThread();
+    bool applyFrameInterval(quint32 numerator, quint32 denominator, bool restart);
+    void updatePowerMode();
+    void updateRateDivisor();
+    void updateFrameRate(bool restart);
+    bool dequeueBuffer(IMX6CameraFrame *frame);
+    void reportStreamError(int error);
+    void runRecoveryStep();
+    void finishRecovery(bool recovered);
+    void requeueBuffers();
+    void setCaptureArmed(bool armed);
+
+protected:
+    void connectNotify(const QMetaMethod &signal);
 
 private:
-    static IMX6CameraControl* s_cameraControl;
+    static QHash<QByteArray, IMX6CameraControl *> s_cameraControls;
     QScopedPointer<IMX6CameraControlPrivate> d_ptr;
     Q_DECLARE_PRIVATE(IMX6CameraControl)
 };
@@ -120,12 +248,12 @@ public:
     };
 
     V4L2CameraFrameBuffer(IMX6CameraControl *control, const Buffer &handle, int index)
-        : control(control), handle(handle), index(index)
+        : control(control), handle(handle), index(index), refCount(0)
     {
     }
 
     V4L2CameraFrameBuffer(IMX6CameraControl *ctl)
-        : control(ctl)
+        : control(ctl), index(-1), refCount(0)
     {
     }
 
@@ -138,12 +266,23 @@ public:
     {
     }
 
+    void ref()
+    {
+        refCount.ref();
+    }
+
+    // Drops one reference, the buffer goes back to the driver with the last one
     void release()
     {
-        if (control)
+        if (!refCount.deref() && control)
             control->queueFrame(index);
     }
 
+    bool isReferenced() const
+    {
+        return refCount.load() != 0;
+    }
+
     MapMode mapMode() const
     {
         return ReadOnly;
@@ -154,14 +293,34 @@ public:
         if (mode != ReadOnly)
             return Q_NULLPTR;
 
-        *numBytes = handle.length;
-        *bytesPerLine = handle.bytesPerLine;
-        return handle.start;
+        *numBytes = handle.length[0];
+        *bytesPerLine = handle.planes[0].bytesPerLine;
+        return handle.start[0];
     }
 
     uchar *start()
     {
-        return handle.start;
+        return handle.start[0];
+    }
+
+    int planeCount() const
+    {
+        return handle.planeCount;
+    }
+
+    const BufferPlane &plane(int plane) const
+    {
+        return handle.planes[plane];
+    }
+
+    const Buffer &bufferHandle() const
+    {
+        return handle;
+    }
+
+    int bufferIndex() const
+    {
+        return index;
     }
 
     void unmap()
@@ -173,6 +332,7 @@ private:
     IMX6CameraControl *control;
     Buffer handle;
     int index;
+    QAtomicInt refCount;
 };
 
 class IMX6CameraFrame
@@ -200,21 +360,45 @@ public:
         Format_NV21,
     };
 
-    IMX6CameraFrame(V4L2CameraFrameBuffer *buffer, const QSize &size, PixelFormat format)
-        : buffer(buffer), size(size), format(format)
-    {}
+    // Frames share their buffer: every copy holds a reference, and the buffer
+    // is queued back to the driver when the last copy goes away.
+    IMX6CameraFrame(V4L2CameraFrameBuffer *buffer, const QSize &size, PixelFormat format,
+                    quint32 sequence = 0, qint64 timestamp = 0)
+        : buffer(buffer), size(size), format(format), sequence(sequence), timestamp(timestamp)
+    {
+        if (buffer)
+            buffer->ref();
+    }
 
-    IMX6CameraFrame() : buffer(0)
+    IMX6CameraFrame() : buffer(0), format(Format_Invalid), sequence(0), timestamp(0)
     {}
 
+    IMX6CameraFrame(const IMX6CameraFrame &other)
+        : buffer(other.buffer), size(other.size), format(other.format), sequence(other.sequence)
+        , timestamp(other.timestamp), signature(other.signature)
+    {
+        if (buffer)
+            buffer->ref();
+    }
+
     ~IMX6CameraFrame()
-    {}
+    {
+        if (buffer)
+            buffer->release();
+    }
 
     IMX6CameraFrame &operator =(const IMX6CameraFrame &other)
     {
+        if (other.buffer)
+            other.buffer->ref();
+        if (buffer)
+            buffer->release();
         buffer = other.buffer;
         size = other.size;
         format = other.format;
+        sequence = other.sequence;
+        timestamp = other.timestamp;
+        signature = other.signature;
         return *this;
     }
 
@@ -223,9 +407,79 @@ public:
         return buffer != 0;
     }
 
+    // Bytes per pixel of the first plane
+    static int bytesPerPixel(PixelFormat format)
+    {
+        switch (format) {
+        case Format_AYUV444:
+        case Format_AYUV444_Premultiplied:
+            return 4;
+        case Format_YUV444:
+        case Format_UYVY:
+        case Format_YUYV:
+            return 2;
+        default:
+            break;
+        }
+        return 1;
+    }
+
+    int planeCount() const
+    {
+        return buffer ? buffer->planeCount() : 0;
+    }
+
+    const BufferPlane &plane(int plane) const
+    {
+        return buffer->plane(plane);
+    }
+
+    // Visible bytes per row of a plane, without the driver's row padding
+    int planeWidthBytes(int plane) const
+    {
+        int bytes = size.width() * bytesPerPixel(format);
+        if (plane > 0 && format != Format_NV12 && format != Format_NV21)
+            bytes = size.width() / 2;
+        return qMin(bytes, buffer->plane(plane).bytesPerLine);
+    }
+
+    int planeHeight(int plane) const
+    {
+        return plane > 0 ? size.height() / 2 : size.height();
+    }
+
+    // Where luma lives in plane 0: the offset of the first sample and the
+    // distance between samples. False for formats this code cannot read.
+    bool lumaLayout(int *offset, int *step) const
+    {
+        switch (format) {
+        case Format_UYVY:
+            *offset = 1;
+            *step = 2;
+            return true;
+        case Format_YUYV:
+            *offset = 0;
+            *step = 2;
+            return true;
+        case Format_YUV420P:
+        case Format_YV12:
+        case Format_NV12:
+        case Format_NV21:
+            *offset = 0;
+            *step = 1;
+            return true;
+        default:
+            break;
+        }
+        return false;
+    }
+
     V4L2CameraFrameBuffer *buffer;
     QSize size;
     PixelFormat format;
+    quint32 sequence;   // Increments with every dequeued frame of a stream
+    qint64 timestamp;   // Driver capture time in microseconds
+    QByteArray signature; // Coarse luma grid for change detection, empty unless requested
 };
 
 
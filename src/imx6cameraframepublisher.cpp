@@ -0,0 +1,410 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameraframepublisher.h"
+
+#include <QSocketNotifier>
+
+#include <linux/futex.h>
+#include <linux/videodev2.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Only the latest frame. With four driver buffers and the display holding one
+// or two, any more would leave capture short and drop frames on screen. A
+// reader still busy with a frame when the next one is published loses it and
+// sees that by the slot sequence.
+#define SHM_MAX_HELD_FRAMES 1
+
+static quint32 v4l2FourCC(IMX6CameraFrame::PixelFormat format, bool separatePlanes)
+{
+    switch (format) {
+    case IMX6CameraFrame::Format_UYVY:
+        return V4L2_PIX_FMT_UYVY;
+    case IMX6CameraFrame::Format_YUYV:
+        return V4L2_PIX_FMT_YUYV;
+    case IMX6CameraFrame::Format_YUV444:
+        return V4L2_PIX_FMT_YUV444;
+    case IMX6CameraFrame::Format_YUV420P:
+        return separatePlanes ? V4L2_PIX_FMT_YUV420M : V4L2_PIX_FMT_YUV420;
+    case IMX6CameraFrame::Format_YV12:
+        return separatePlanes ? V4L2_PIX_FMT_YVU420M : V4L2_PIX_FMT_YVU420;
+    case IMX6CameraFrame::Format_NV12:
+        return separatePlanes ? V4L2_PIX_FMT_NV12M : V4L2_PIX_FMT_NV12;
+    case IMX6CameraFrame::Format_NV21:
+        return separatePlanes ? V4L2_PIX_FMT_NV21M : V4L2_PIX_FMT_NV21;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static int createSharedMemory(size_t size)
+{
+    int fd = -1;
+#ifdef __NR_memfd_create
+    fd = syscall(__NR_memfd_create, "imx6camera", 1 /* MFD_CLOEXEC */);
+#endif
+    if (fd < 0) {
+        // Kernels before 3.17 have no memfd, fall back to an unlinked tmpfs file
+        char path[] = "/dev/shm/imx6camera-XXXXXX";
+        fd = mkstemp(path);
+        if (fd >= 0) {
+            unlink(path);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    if (fd >= 0 && ftruncate(fd, size) < 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+IMX6CameraFramePublisher::IMX6CameraFramePublisher(QObject *parent)
+    : QObject(parent)
+    , mServer(-1)
+    , mServerNotifier(NULL)
+    , mHeaderFd(-1)
+    , mHeader(NULL)
+    , mSlotCount(0)
+    , mMemoryCount(0)
+    , mMaxHeldFrames(SHM_MAX_HELD_FRAMES)
+{
+}
+
+IMX6CameraFramePublisher::~IMX6CameraFramePublisher()
+{
+    close();
+    if (mHeader)
+        munmap(mHeader, sizeof(IMX6CameraShmHeader));
+    if (mHeaderFd >= 0)
+        ::close(mHeaderFd);
+}
+
+bool IMX6CameraFramePublisher::createHeader()
+{
+    if (mHeader)
+        return true;
+
+    mHeaderFd = createSharedMemory(sizeof(IMX6CameraShmHeader));
+    if (mHeaderFd < 0) {
+        qCritical("Could not create the frame sharing memory. %d %s", errno, strerror(errno));
+        return false;
+    }
+    void *data = mmap(NULL, sizeof(IMX6CameraShmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, mHeaderFd, 0);
+    if (data == MAP_FAILED) {
+        qCritical("Could not map the frame sharing memory. %d %s", errno, strerror(errno));
+        ::close(mHeaderFd);
+        mHeaderFd = -1;
+        return false;
+    }
+    mHeader = static_cast<IMX6CameraShmHeader *>(data);
+    memset(mHeader, 0, sizeof(IMX6CameraShmHeader));
+    mHeader->magic = IMX6_CAMERA_SHM_MAGIC;
+    mHeader->version = IMX6_CAMERA_SHM_VERSION;
+    for (int i = 0; i < IMX6_CAMERA_SHM_MAX_SLOTS; ++i)
+        mHeader->slots[i].sequence = 1;
+    return true;
+}
+
+bool IMX6CameraFramePublisher::listen(const QString &socketPath)
+{
+    close();
+    if (!createHeader())
+        return false;
+
+    const QByteArray path = socketPath.toLocal8Bit();
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.isEmpty() || size_t(path.size()) >= sizeof(address.sun_path)) {
+        qCritical("Invalid frame sharing socket path %s", path.constData());
+        return false;
+    }
+    strncpy(address.sun_path, path.constData(), sizeof(address.sun_path) - 1);
+
+    mServer = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (mServer < 0) {
+        qCritical("Could not create the frame sharing socket. %d %s", errno, strerror(errno));
+        return false;
+    }
+    unlink(path.constData());
+    if (bind(mServer, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || ::listen(mServer, 8) < 0) {
+        qCritical("Could not listen on %s. %d %s", path.constData(), errno, strerror(errno));
+        ::close(mServer);
+        mServer = -1;
+        return false;
+    }
+
+    mSocketPath = socketPath;
+    mServerNotifier = new QSocketNotifier(mServer, QSocketNotifier::Read, this);
+    connect(mServerNotifier, &QSocketNotifier::activated, this, &IMX6CameraFramePublisher::acceptClient);
+    return true;
+}
+
+void IMX6CameraFramePublisher::close()
+{
+    disconnectClients();
+    delete mServerNotifier;
+    mServerNotifier = NULL;
+    if (mServer >= 0) {
+        ::close(mServer);
+        mServer = -1;
+        unlink(mSocketPath.toLocal8Bit().constData());
+    }
+    mSocketPath.clear();
+}
+
+bool IMX6CameraFramePublisher::isListening() const
+{
+    return mServer >= 0;
+}
+
+void IMX6CameraFramePublisher::setBuffers(const QList<V4L2CameraFrameBuffer *> &buffers)
+{
+    clearBuffers();
+    if (!mHeader || buffers.isEmpty() || buffers.size() > IMX6_CAMERA_SHM_MAX_SLOTS)
+        return;
+
+    const int memoryCount = buffers.first()->bufferHandle().memoryCount;
+    QVector<int> fds(buffers.size() * memoryCount, -1);
+    Q_FOREACH (V4L2CameraFrameBuffer *buffer, buffers) {
+        const Buffer &handle = buffer->bufferHandle();
+        const int slot = buffer->bufferIndex();
+        if (slot < 0 || slot >= buffers.size() || handle.memoryCount != memoryCount)
+            return;
+        for (int memory = 0; memory < memoryCount; ++memory) {
+            if (handle.fd[memory] < 0) {
+                qWarning("The driver can not export dmabufs, frames are not shared");
+                return;
+            }
+            fds[slot * memoryCount + memory] = handle.fd[memory];
+        }
+    }
+
+    mFds = fds;
+    mSlotCount = buffers.size();
+    mMemoryCount = memoryCount;
+    __atomic_store_n(&mHeader->slotCount, mSlotCount, __ATOMIC_RELAXED);
+    __atomic_store_n(&mHeader->memoryCount, mMemoryCount, __ATOMIC_RELEASE);
+}
+
+void IMX6CameraFramePublisher::clearBuffers()
+{
+    // The fds are about to be closed, readers reconnect once new buffers exist
+    disconnectClients();
+    releaseAllFrames();
+    mFds.clear();
+    mSlotCount = 0;
+    mMemoryCount = 0;
+    if (mHeader)
+        __atomic_store_n(&mHeader->slotCount, 0, __ATOMIC_RELEASE);
+}
+
+void IMX6CameraFramePublisher::publish(const IMX6CameraFrame &frame)
+{
+    if (!mHeader || mSlotCount == 0 || !frame.isValid())
+        return;
+    if (mClients.isEmpty()) {
+        // Nobody listens, hold no buffers
+        releaseAllFrames();
+        return;
+    }
+
+    const int slotIndex = frame.buffer->bufferIndex();
+    if (slotIndex < 0 || slotIndex >= mSlotCount)
+        return;
+
+    const Buffer &handle = frame.buffer->bufferHandle();
+    IMX6CameraShmSlot &slot = mHeader->slots[slotIndex];
+
+    // Odd while the slot is rewritten
+    quint32 sequence = __atomic_load_n(&slot.sequence, __ATOMIC_RELAXED);
+    if (!(sequence & 1))
+        ++sequence;
+    __atomic_store_n(&slot.sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot.frameSequence = frame.sequence;
+    slot.timestamp = frame.timestamp;
+    slot.fourcc = v4l2FourCC(frame.format, handle.memoryCount > 1);
+    slot.width = frame.size.width();
+    slot.height = frame.size.height();
+    slot.planeCount = qMin(frame.planeCount(), IMX6_CAMERA_SHM_MAX_PLANES);
+    for (uint plane = 0; plane < slot.planeCount; ++plane) {
+        const BufferPlane &bufferPlane = frame.plane(plane);
+        slot.planes[plane].memory = 0;
+        for (int memory = 0; memory < handle.memoryCount; ++memory) {
+            if (handle.fd[memory] == bufferPlane.fd)
+                slot.planes[plane].memory = memory;
+        }
+        slot.planes[plane].offset = bufferPlane.offset;
+        slot.planes[plane].bytesPerLine = bufferPlane.bytesPerLine;
+        slot.planes[plane].length = bufferPlane.length;
+    }
+
+    __atomic_store_n(&slot.sequence, sequence + 1, __ATOMIC_RELEASE);
+
+    mHeldFrames[slotIndex] = frame;
+    mHeldSlots.removeAll(slotIndex);
+    mHeldSlots.append(slotIndex);
+
+    __atomic_store_n(&mHeader->latestSlot, slotIndex, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&mHeader->published, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mHeader->waiters, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &mHeader->published, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    releaseFrames(slotIndex);
+}
+
+void IMX6CameraFramePublisher::releaseFrames(int keepSlot)
+{
+    // Frames nobody reads go back to the driver right away. If readers hold
+    // too many, the oldest is taken from them, they notice it by the sequence.
+    QList<int>::Iterator it = mHeldSlots.begin();
+    while (it != mHeldSlots.end()) {
+        const int slot = *it;
+        const bool busy = mHeader && __atomic_load_n(&mHeader->slots[slot].readers, __ATOMIC_ACQUIRE) > 0;
+        if (slot != keepSlot && (!busy || mHeldSlots.size() > mMaxHeldFrames)) {
+            it = mHeldSlots.erase(it);
+            releaseFrame(slot);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Once no client is connected, pins that are left belong to readers that died
+// between pinning a slot and releasing it. They would hold the buffer forever.
+void IMX6CameraFramePublisher::releaseAllFrames()
+{
+    Q_FOREACH (int slot, mHeldSlots)
+        releaseFrame(slot);
+    mHeldSlots.clear();
+    if (mHeader) {
+        for (int slot = 0; slot < IMX6_CAMERA_SHM_MAX_SLOTS; ++slot)
+            __atomic_store_n(&mHeader->slots[slot].readers, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void IMX6CameraFramePublisher::releaseFrame(int slot)
+{
+    if (mHeader) {
+        // Invalidate before the driver may write the buffer again
+        quint32 sequence = __atomic_load_n(&mHeader->slots[slot].sequence, __ATOMIC_RELAXED);
+        if (!(sequence & 1))
+            __atomic_store_n(&mHeader->slots[slot].sequence, sequence + 1, __ATOMIC_RELEASE);
+    }
+    mHeldFrames[slot] = IMX6CameraFrame();
+}
+
+void IMX6CameraFramePublisher::acceptClient()
+{
+    const int client = accept4(mServer, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (client < 0)
+        return;
+    if (mSlotCount == 0 || !sendHello(client)) {
+        ::close(client);
+        return;
+    }
+
+    QSocketNotifier *notifier = new QSocketNotifier(client, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &IMX6CameraFramePublisher::readClient);
+    mClients.insert(client, notifier);
+}
+
+void IMX6CameraFramePublisher::readClient(int socket)
+{
+    // Clients never send anything, readable means they went away
+    char data[16];
+    const ssize_t count = recv(socket, data, sizeof(data), MSG_DONTWAIT);
+    if (count > 0 || (count < 0 && errno == EAGAIN))
+        return;
+    delete mClients.take(socket);
+    ::close(socket);
+    if (mClients.isEmpty())
+        releaseAllFrames();
+}
+
+bool IMX6CameraFramePublisher::sendHello(int socket)
+{
+    QVector<int> fds;
+    fds.append(mHeaderFd);
+    fds += mFds;
+
+    IMX6CameraShmHello hello;
+    hello.magic = IMX6_CAMERA_SHM_MAGIC;
+    hello.version = IMX6_CAMERA_SHM_VERSION;
+    hello.fdCount = fds.size();
+
+    iovec io;
+    io.iov_base = &hello;
+    io.iov_len = sizeof(hello);
+
+    QByteArray control(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(header), fds.constData(), sizeof(int) * fds.size());
+
+    if (sendmsg(socket, &message, MSG_NOSIGNAL) != ssize_t(sizeof(hello))) {
+        qWarning("Could not send the frame sharing descriptors. %d %s", errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void IMX6CameraFramePublisher::disconnectClients()
+{
+    QHash<int, QSocketNotifier *>::Iterator it = mClients.begin();
+    for (; it != mClients.end(); ++it) {
+        delete it.value();
+        ::close(it.key());
+    }
+    mClients.clear();
+}
@@ -0,0 +1,90 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef IMX6CAMERAFRAMEPUBLISHER_H
+#define IMX6CAMERAFRAMEPUBLISHER_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QVector>
+#include "imx6cameracontrol.h"
+#include "imx6camerashm.h"
+
+class QSocketNotifier;
+
+// Publishes captured frames to other processes without copying them. The
+// driver buffers are passed as dmabuf fds over a Unix domain socket, and a
+// memfd holds the lock-free slot table described in imx6camerashm.h.
+class IMX6CameraFramePublisher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IMX6CameraFramePublisher(QObject *parent = 0);
+    ~IMX6CameraFramePublisher();
+
+    bool listen(const QString &socketPath);
+    void close();
+    bool isListening() const;
+
+    // Called whenever the driver buffers are (re)mapped, connected readers have to reconnect
+    void setBuffers(const QList<V4L2CameraFrameBuffer *> &buffers);
+    void clearBuffers();
+
+public Q_SLOTS:
+    void publish(const IMX6CameraFrame &frame);
+
+private Q_SLOTS:
+    void acceptClient();
+    void readClient(int socket);
+
+private:
+    bool createHeader();
+    bool sendHello(int socket);
+    void releaseFrames(int keepSlot);
+    void releaseAllFrames();
+    void releaseFrame(int slot);
+    void disconnectClients();
+
+    QString mSocketPath;
+    int mServer;
+    QSocketNotifier *mServerNotifier;
+    QHash<int, QSocketNotifier *> mClients;
+    int mHeaderFd;
+    IMX6CameraShmHeader *mHeader;
+    QVector<int> mFds;          // dmabufs, slot by slot
+    int mSlotCount;
+    int mMemoryCount;
+    IMX6CameraFrame mHeldFrames[IMX6_CAMERA_SHM_MAX_SLOTS];
+    QList<int> mHeldSlots;      // Oldest first
+    int mMaxHeldFrames;
+};
+
+#endif // IMX6CAMERAFRAMEPUBLISHER_H
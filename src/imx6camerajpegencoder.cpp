@@ -0,0 +1,577 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6camerajpegencoder.h"
+#include <QRunnable>
+#include <QThread>
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <jpeglib.h>
+
+struct JpegErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static void jpegErrorExit(j_common_ptr info)
+{
+    char message[JMSG_LENGTH_MAX];
+    info->err->format_message(info, message);
+    qWarning("JPEG encoding failed: %s", message);
+    longjmp(reinterpret_cast<JpegErrorManager *>(info->err)->jump, 1);
+}
+
+static inline bool isSubsampledVertically(IMX6CameraFrame::PixelFormat format)
+{
+    return format != IMX6CameraFrame::Format_UYVY && format != IMX6CameraFrame::Format_YUYV;
+}
+
+// Copies one row into a scratch row of paddedWidth samples, repeating the last one
+static inline void padRow(JSAMPLE *row, int width, int paddedWidth)
+{
+    for (int x = width; x < paddedWidth; ++x)
+        row[x] = row[width - 1];
+}
+
+static void extractLumaRow(const uchar *data, const IMX6CameraJpegImage &image, int y, JSAMPLE *row, int paddedWidth)
+{
+    const uchar *in = data + image.offset[0] + y * image.stride[0];
+    switch (image.format) {
+    case IMX6CameraFrame::Format_UYVY:
+        for (int x = 0; x < image.width; ++x)
+            row[x] = in[x * 2 + 1];
+        break;
+    case IMX6CameraFrame::Format_YUYV:
+        for (int x = 0; x < image.width; ++x)
+            row[x] = in[x * 2];
+        break;
+    default:
+        memcpy(row, in, image.width);
+        break;
+    }
+    padRow(row, image.width, paddedWidth);
+}
+
+// y is a chroma row: a luma row for 4:2:2, half of one for 4:2:0
+static void extractChromaRows(const uchar *data, const IMX6CameraJpegImage &image, int y,
+                              JSAMPLE *cb, JSAMPLE *cr, int paddedWidth)
+{
+    // Matches IMX6CameraFrame::planeWidthBytes(), an odd last column has no chroma of its own
+    const int width = qMax(1, image.width / 2);
+    switch (image.format) {
+    case IMX6CameraFrame::Format_UYVY:
+    case IMX6CameraFrame::Format_YUYV: {
+        const uchar *in = data + image.offset[0] + y * image.stride[0];
+        const int cbOffset = image.format == IMX6CameraFrame::Format_UYVY ? 0 : 1;
+        for (int x = 0; x < width; ++x) {
+            cb[x] = in[x * 4 + cbOffset];
+            cr[x] = in[x * 4 + cbOffset + 2];
+        }
+        break;
+    }
+    case IMX6CameraFrame::Format_NV12:
+    case IMX6CameraFrame::Format_NV21: {
+        const uchar *in = data + image.offset[1] + y * image.stride[1];
+        const int cbOffset = image.format == IMX6CameraFrame::Format_NV12 ? 0 : 1;
+        for (int x = 0; x < width; ++x) {
+            cb[x] = in[x * 2 + cbOffset];
+            cr[x] = in[x * 2 + 1 - cbOffset];
+        }
+        break;
+    }
+    default: {
+        const int cbPlane = image.format == IMX6CameraFrame::Format_YV12 ? 2 : 1;
+        const int crPlane = 3 - cbPlane;
+        memcpy(cb, data + image.offset[cbPlane] + y * image.stride[cbPlane], width);
+        memcpy(cr, data + image.offset[crPlane] + y * image.stride[crPlane], width);
+        break;
+    }
+    }
+    padRow(cb, width, paddedWidth);
+    padRow(cr, width, paddedWidth);
+}
+
+class IMX6CameraJpegTask : public QRunnable
+{
+public:
+    IMX6CameraJpegTask(IMX6CameraJpegEncoder *encoder, quint64 ticket, const QByteArray &staging,
+                       const IMX6CameraJpegImage &image, int quality)
+        : mEncoder(encoder), mTicket(ticket), mStaging(staging), mImage(image), mQuality(quality)
+    {
+    }
+
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        QByteArray jpeg;
+        IMX6CameraJpegEncoder::encode(reinterpret_cast<const uchar *>(mStaging.constData()), mImage, mQuality, &jpeg);
+        QMetaObject::invokeMethod(mEncoder, "finishFrame", Qt::QueuedConnection,
+                                  Q_ARG(quint64, mTicket), Q_ARG(QByteArray, jpeg),
+                                  Q_ARG(QByteArray, mStaging), Q_ARG(qint64, timer.nsecsElapsed()));
+    }
+
+private:
+    IMX6CameraJpegEncoder *mEncoder;
+    quint64 mTicket;
+    QByteArray mStaging;
+    IMX6CameraJpegImage mImage;
+    int mQuality;
+};
+
+IMX6CameraJpegEncoder::IMX6CameraJpegEncoder(QObject *parent)
+    : QObject(parent)
+    , m_cameraControl(NULL)
+    , m_sessionId(0)
+    , m_active(false)
+    , m_capturing(false)
+    , m_stopAfterSnapshots(false)
+    , m_quality(85)
+    , m_maxInFlight(QThread::idealThreadCount())
+    , m_nextTicket(0)
+    , m_encodedFrames(0)
+    , m_droppedFrames(0)
+    , m_encodeTime(0)
+    , m_latency(0)
+    , m_throughput(0)
+    , m_windowStart(0)
+    , m_windowFrames(0)
+{
+    m_cameraControl = IMX6CameraControl::cameraControl(&m_sessionId);
+    m_pool.setMaxThreadCount(QThread::idealThreadCount());
+    m_clock.start();
+}
+
+IMX6CameraJpegEncoder::~IMX6CameraJpegEncoder()
+{
+    setActive(false);
+    setCapturing(false);
+    m_pool.waitForDone();
+}
+
+bool IMX6CameraJpegEncoder::active() const
+{
+    return m_active;
+}
+
+void IMX6CameraJpegEncoder::setActive(bool value)
+{
+    if (m_active == value)
+        return;
+
+    m_active = value;
+    if (m_active) {
+        m_stopAfterSnapshots = false;
+        setCapturing(true);
+        openOutput();
+    } else if (m_snapshots.isEmpty()) {
+        // Frames still in the pool are written when they finish
+        setCapturing(false);
+    } else {
+        m_stopAfterSnapshots = true;  // Snapshots asked for are still taken
+    }
+    emit activeChanged(m_active);
+}
+
+void IMX6CameraJpegEncoder::setCapturing(bool value)
+{
+    if (m_capturing == value)
+        return;
+
+    m_capturing = value;
+    if (m_capturing) {
+        connect(m_cameraControl, &IMX6CameraControl::frameReady, this, &IMX6CameraJpegEncoder::encodeFrame);
+        QMetaObject::invokeMethod(m_cameraControl, "startCamera", Qt::QueuedConnection, Q_ARG(uint, m_sessionId));
+    } else {
+        disconnect(m_cameraControl, &IMX6CameraControl::frameReady, this, &IMX6CameraJpegEncoder::encodeFrame);
+        m_cameraControl->stopCameraStream(m_sessionId);
+    }
+}
+
+int IMX6CameraJpegEncoder::quality() const
+{
+    return m_quality;
+}
+
+void IMX6CameraJpegEncoder::setQuality(int value)
+{
+    value = qBound(1, value, 100);
+    if (m_quality == value)
+        return;
+
+    m_quality = value;
+    emit qualityChanged(m_quality);
+}
+
+QString IMX6CameraJpegEncoder::output() const
+{
+    return m_output;
+}
+
+void IMX6CameraJpegEncoder::setOutput(const QString &fileName)
+{
+    if (m_output == fileName)
+        return;
+
+    m_output = fileName;
+    if (m_active)
+        openOutput();
+    emit outputChanged(m_output);
+}
+
+int IMX6CameraJpegEncoder::threadCount() const
+{
+    return m_pool.maxThreadCount();
+}
+
+void IMX6CameraJpegEncoder::setThreadCount(int value)
+{
+    value = qMax(1, value);
+    if (m_pool.maxThreadCount() == value)
+        return;
+
+    m_pool.setMaxThreadCount(value);
+    emit threadCountChanged(value);
+}
+
+int IMX6CameraJpegEncoder::maxInFlight() const
+{
+    return m_maxInFlight;
+}
+
+void IMX6CameraJpegEncoder::setMaxInFlight(int value)
+{
+    value = qMax(1, value);
+    if (m_maxInFlight == value)
+        return;
+
+    m_maxInFlight = value;
+    emit maxInFlightChanged(m_maxInFlight);
+}
+
+int IMX6CameraJpegEncoder::encodedFrames() const
+{
+    return m_encodedFrames;
+}
+
+int IMX6CameraJpegEncoder::droppedFrames() const
+{
+    return m_droppedFrames;
+}
+
+qreal IMX6CameraJpegEncoder::encodeTime() const
+{
+    return m_encodeTime;
+}
+
+qreal IMX6CameraJpegEncoder::latency() const
+{
+    return m_latency;
+}
+
+qreal IMX6CameraJpegEncoder::throughput() const
+{
+    return m_throughput;
+}
+
+void IMX6CameraJpegEncoder::snapshot(const QString &fileName)
+{
+    m_snapshots.append(fileName);
+    if (!m_capturing) {
+        // Captures just long enough to take the snapshot, without becoming
+        // active, so the MJPEG output is neither opened nor truncated
+        setCapturing(true);
+        m_stopAfterSnapshots = true;
+    }
+}
+
+void IMX6CameraJpegEncoder::openOutput()
+{
+    m_outputFile.close();
+    if (m_output.isEmpty())
+        return;
+
+    m_outputFile.setFileName(m_output);
+    if (!m_outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Could not open the MJPEG stream %s.", qPrintable(m_output));
+        emit error(QStringLiteral("Could not open %1").arg(m_output));
+    }
+}
+
+void IMX6CameraJpegEncoder::encodeFrame(const IMX6CameraFrame &frame)
+{
+    const bool stream = m_active && (m_outputFile.isOpen() || receivers(SIGNAL(frameEncoded(QByteArray,quint32,qint64))) > 0);
+    if (!frame.isValid() || (!stream && m_snapshots.isEmpty()))
+        return;
+
+    if (!isFormatSupported(frame.format)) {
+        static bool warned = false;
+        if (!warned) {
+            qWarning("JPEG encoding does not support pixel format %d.", frame.format);
+            warned = true;
+        }
+        return;
+    }
+
+    int inFlight = 0;
+    Q_FOREACH (const PendingFrame &pending, m_pending) {
+        if (!pending.done)
+            ++inFlight;
+    }
+    if (inFlight >= m_maxInFlight) {
+        ++m_droppedFrames;
+        emit statisticsChanged();
+        return;
+    }
+
+    // The pool works on a copy, encoding takes longer than the driver can
+    // spare one of its few buffers.
+    QByteArray staging = m_freeStaging.isEmpty() ? QByteArray() : m_freeStaging.takeLast();
+    IMX6CameraJpegImage image;
+    stage(frame, &staging, &image);
+
+    PendingFrame pending;
+    pending.sequence = frame.sequence;
+    pending.timestamp = frame.timestamp;
+    pending.submitted = m_clock.nsecsElapsed();
+    pending.stream = stream;
+    pending.done = false;
+    pending.ok = false;
+    if (!m_snapshots.isEmpty())
+        pending.snapshot = m_snapshots.takeFirst();
+
+    const quint64 ticket = m_nextTicket++;
+    m_pending.insert(ticket, pending);
+    m_pool.start(new IMX6CameraJpegTask(this, ticket, staging, image, m_quality));
+}
+
+void IMX6CameraJpegEncoder::stage(const IMX6CameraFrame &frame, QByteArray *staging, IMX6CameraJpegImage *image) const
+{
+    image->format = frame.format;
+    image->width = frame.size.width();
+    image->height = frame.size.height();
+    image->planeCount = frame.planeCount();
+
+    int size = 0;
+    for (int i = 0; i < image->planeCount; ++i) {
+        image->offset[i] = size;
+        image->stride[i] = frame.planeWidthBytes(i);
+        size += image->stride[i] * frame.planeHeight(i);
+    }
+    staging->resize(size);
+
+    uchar *out = reinterpret_cast<uchar *>(staging->data());
+    for (int i = 0; i < image->planeCount; ++i) {
+        const BufferPlane &plane = frame.plane(i);
+        const int rows = frame.planeHeight(i);
+        if (image->stride[i] == plane.bytesPerLine) {
+            memcpy(out + image->offset[i], plane.data, size_t(plane.bytesPerLine) * rows);
+            continue;
+        }
+        for (int y = 0; y < rows; ++y)
+            memcpy(out + image->offset[i] + y * image->stride[i], plane.data + y * plane.bytesPerLine, image->stride[i]);
+    }
+}
+
+void IMX6CameraJpegEncoder::finishFrame(quint64 ticket, const QByteArray &jpeg, const QByteArray &staging, qint64 encodeTime)
+{
+    if (m_freeStaging.size() < m_maxInFlight)
+        m_freeStaging.append(staging);
+
+    QMap<quint64, PendingFrame>::iterator it = m_pending.find(ticket);
+    if (it == m_pending.end())
+        return;
+    it->done = true;
+    it->ok = !jpeg.isEmpty();
+    it->jpeg = jpeg;
+
+    const qreal encodeMs = encodeTime / 1000000.0;
+    m_encodeTime = m_encodeTime > 0 ? m_encodeTime * 0.9 + encodeMs * 0.1 : encodeMs;
+
+    // Frames finish out of order on the pool, deliver them in capture order
+    while (!m_pending.isEmpty() && m_pending.begin()->done) {
+        const PendingFrame frame = m_pending.take(m_pending.begin().key());
+        deliver(frame);
+    }
+    emit statisticsChanged();
+}
+
+void IMX6CameraJpegEncoder::deliver(const PendingFrame &frame)
+{
+    const qint64 now = m_clock.nsecsElapsed();
+    const qreal latencyMs = (now - frame.submitted) / 1000000.0;
+    m_latency = m_latency > 0 ? m_latency * 0.9 + latencyMs * 0.1 : latencyMs;
+
+    ++m_windowFrames;
+    if (now - m_windowStart >= 1000000000) {
+        m_throughput = m_windowFrames * 1000000000.0 / (now - m_windowStart);
+        m_windowStart = now;
+        m_windowFrames = 0;
+    }
+
+    if (!frame.ok) {
+        emit error(QStringLiteral("Could not encode frame %1").arg(frame.sequence));
+        return;
+    }
+    ++m_encodedFrames;
+
+    if (!frame.snapshot.isEmpty()) {
+        QFile file(frame.snapshot);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(frame.jpeg) == frame.jpeg.size()) {
+            emit snapshotSaved(frame.snapshot);
+        } else {
+            qWarning("Could not save the snapshot %s.", qPrintable(frame.snapshot));
+            emit error(QStringLiteral("Could not write %1").arg(frame.snapshot));
+        }
+        if (m_stopAfterSnapshots && m_snapshots.isEmpty() && !hasPendingSnapshots()) {
+            m_stopAfterSnapshots = false;
+            setCapturing(false);
+        }
+    }
+
+    if (frame.stream) {
+        if (m_outputFile.isOpen())
+            m_outputFile.write(frame.jpeg);
+        emit frameEncoded(frame.jpeg, frame.sequence, frame.timestamp);
+    }
+}
+
+bool IMX6CameraJpegEncoder::hasPendingSnapshots() const
+{
+    Q_FOREACH (const PendingFrame &pending, m_pending) {
+        if (!pending.snapshot.isEmpty())
+            return true;
+    }
+    return false;
+}
+
+bool IMX6CameraJpegEncoder::isFormatSupported(IMX6CameraFrame::PixelFormat format)
+{
+    switch (format) {
+    case IMX6CameraFrame::Format_UYVY:
+    case IMX6CameraFrame::Format_YUYV:
+    case IMX6CameraFrame::Format_YUV420P:
+    case IMX6CameraFrame::Format_YV12:
+    case IMX6CameraFrame::Format_NV12:
+    case IMX6CameraFrame::Format_NV21:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+// Feeds the YCbCr samples to libjpeg as they are (raw data input), so there is
+// no colour conversion and no full-size intermediate image. libjpeg grows the
+// output through buffer and length after setjmp(), so they belong to the caller:
+// locals changed after setjmp() are indeterminate once an error jumps back.
+static bool compressRaw(const uchar *data, const IMX6CameraJpegImage &image, int quality,
+                        unsigned char **buffer, unsigned long *length)
+{
+    jpeg_compress_struct info;
+    JpegErrorManager error;
+    info.err = jpeg_std_error(&error.pub);
+    error.pub.error_exit = jpegErrorExit;
+
+    // One row of MCUs per call, with rows padded to whole blocks
+    const int verticalFactor = isSubsampledVertically(image.format) ? 2 : 1;
+    const int lumaRows = DCTSIZE * verticalFactor;
+    const int lumaWidth = (image.width + 2 * DCTSIZE - 1) & ~(2 * DCTSIZE - 1);
+    const int chromaWidth = lumaWidth / 2;
+    const int chromaHeight = qMax(1, image.height / verticalFactor);
+    JSAMPLE *scratch = static_cast<JSAMPLE *>(malloc(lumaRows * lumaWidth + 2 * DCTSIZE * chromaWidth));
+    if (!scratch)
+        return false;
+
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&info);
+        free(scratch);
+        return false;
+    }
+
+    jpeg_create_compress(&info);
+    jpeg_mem_dest(&info, buffer, length);
+    info.image_width = image.width;
+    info.image_height = image.height;
+    info.input_components = 3;
+    info.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&info);
+    jpeg_set_colorspace(&info, JCS_YCbCr);
+    jpeg_set_quality(&info, quality, TRUE);
+    info.raw_data_in = TRUE;
+    info.dct_method = JDCT_IFAST;
+
+    info.comp_info[0].h_samp_factor = 2;
+    info.comp_info[0].v_samp_factor = verticalFactor;
+    for (int i = 1; i < 3; ++i) {
+        info.comp_info[i].h_samp_factor = 1;
+        info.comp_info[i].v_samp_factor = 1;
+    }
+
+    JSAMPROW lumaRow[2 * DCTSIZE];
+    JSAMPROW cbRow[DCTSIZE];
+    JSAMPROW crRow[DCTSIZE];
+    for (int i = 0; i < lumaRows; ++i)
+        lumaRow[i] = scratch + i * lumaWidth;
+    for (int i = 0; i < DCTSIZE; ++i) {
+        cbRow[i] = scratch + lumaRows * lumaWidth + i * chromaWidth;
+        crRow[i] = scratch + lumaRows * lumaWidth + (DCTSIZE + i) * chromaWidth;
+    }
+    JSAMPARRAY planes[3] = { lumaRow, cbRow, crRow };
+
+    jpeg_start_compress(&info, TRUE);
+    for (int y = 0; y < image.height; y += lumaRows) {
+        for (int i = 0; i < lumaRows; ++i)
+            extractLumaRow(data, image, qMin(y + i, image.height - 1), lumaRow[i], lumaWidth);
+        for (int i = 0; i < DCTSIZE; ++i)
+            extractChromaRows(data, image, qMin(y / verticalFactor + i, chromaHeight - 1), cbRow[i], crRow[i], chromaWidth);
+        jpeg_write_raw_data(&info, planes, lumaRows);
+    }
+    jpeg_finish_compress(&info);
+
+    jpeg_destroy_compress(&info);
+    free(scratch);
+    return true;
+}
+
+bool IMX6CameraJpegEncoder::encode(const uchar *data, const IMX6CameraJpegImage &image, int quality, QByteArray *jpeg)
+{
+    unsigned char *buffer = 0;
+    unsigned long length = 0;
+    const bool ok = compressRaw(data, image, quality, &buffer, &length);
+    if (ok)
+        *jpeg = QByteArray(reinterpret_cast<const char *>(buffer), length);
+    free(buffer);
+    return ok;
+}
@@ -0,0 +1,155 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERAJPEGENCODER_H
+#define IMX6CAMERAJPEGENCODER_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include "imx6cameracontrol.h"
+
+// A frame copied out of the driver buffer, planes packed without row padding
+struct IMX6CameraJpegImage {
+    IMX6CameraFrame::PixelFormat format;
+    int width;
+    int height;
+    int planeCount;
+    int offset[IMX6_CAMERA_MAX_PLANES];
+    int stride[IMX6_CAMERA_MAX_PLANES];
+};
+
+// Encodes camera frames to JPEG straight from their YCbCr layout. Frames are
+// spread over a thread pool and come out in capture order, either as JPEG
+// stills or appended to an MJPEG stream.
+class IMX6CameraJpegEncoder : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(int quality READ quality WRITE setQuality NOTIFY qualityChanged)
+    Q_PROPERTY(QString output READ output WRITE setOutput NOTIFY outputChanged)
+    Q_PROPERTY(int threadCount READ threadCount WRITE setThreadCount NOTIFY threadCountChanged)
+    Q_PROPERTY(int maxInFlight READ maxInFlight WRITE setMaxInFlight NOTIFY maxInFlightChanged)
+    Q_PROPERTY(int encodedFrames READ encodedFrames NOTIFY statisticsChanged)
+    Q_PROPERTY(int droppedFrames READ droppedFrames NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal encodeTime READ encodeTime NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal latency READ latency NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal throughput READ throughput NOTIFY statisticsChanged)
+
+public:
+    explicit IMX6CameraJpegEncoder(QObject *parent = 0);
+    ~IMX6CameraJpegEncoder();
+
+    bool active() const;
+    int quality() const;
+    QString output() const;
+    int threadCount() const;
+    int maxInFlight() const;
+    int encodedFrames() const;
+    int droppedFrames() const;
+    qreal encodeTime() const;
+    qreal latency() const;
+    qreal throughput() const;
+
+    static bool isFormatSupported(IMX6CameraFrame::PixelFormat format);
+    static bool encode(const uchar *data, const IMX6CameraJpegImage &image, int quality, QByteArray *jpeg);
+
+public Q_SLOTS:
+    void setActive(bool value);
+    void setQuality(int value);
+    void setOutput(const QString &fileName);
+    void setThreadCount(int value);
+    void setMaxInFlight(int value);
+    void snapshot(const QString &fileName);
+    void encodeFrame(const IMX6CameraFrame &frame);
+
+Q_SIGNALS:
+    void activeChanged(bool);
+    void qualityChanged(int);
+    void outputChanged(const QString &);
+    void threadCountChanged(int);
+    void maxInFlightChanged(int);
+    void statisticsChanged();
+    void frameEncoded(const QByteArray &jpeg, quint32 sequence, qint64 timestamp);
+    void snapshotSaved(const QString &fileName);
+    void error(const QString &message);
+
+private Q_SLOTS:
+    void finishFrame(quint64 ticket, const QByteArray &jpeg, const QByteArray &staging, qint64 encodeTime);
+
+private:
+    struct PendingFrame {
+        quint32 sequence;
+        qint64 timestamp;
+        qint64 submitted;   // m_clock time in nanoseconds
+        QString snapshot;
+        bool stream;
+        bool done;
+        bool ok;
+        QByteArray jpeg;
+    };
+
+    void stage(const IMX6CameraFrame &frame, QByteArray *staging, IMX6CameraJpegImage *image) const;
+    void deliver(const PendingFrame &frame);
+    void openOutput();
+    void setCapturing(bool value);
+    bool hasPendingSnapshots() const;
+
+    IMX6CameraControl *m_cameraControl;
+    int m_sessionId;
+    bool m_active;
+    bool m_capturing;           // Active, or taking snapshots while inactive
+    bool m_stopAfterSnapshots;
+    int m_quality;
+    QString m_output;
+    QFile m_outputFile;
+    int m_maxInFlight;
+    QStringList m_snapshots;
+
+    QThreadPool m_pool;
+    QList<QByteArray> m_freeStaging;    // Reused copies, so steady state does not allocate
+    QMap<quint64, PendingFrame> m_pending;
+    quint64 m_nextTicket;
+
+    QElapsedTimer m_clock;
+    int m_encodedFrames;
+    int m_droppedFrames;
+    qreal m_encodeTime;     // Running averages in milliseconds
+    qreal m_latency;
+    qreal m_throughput;     // Frames per second over the last second
+    qint64 m_windowStart;
+    int m_windowFrames;
+};
+
+#endif // IMX6CAMERAJPEGENCODER_H
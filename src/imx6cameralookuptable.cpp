@@ -0,0 +1,123 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameralookuptable.h"
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+static QAtomicInt lookupTableSerial;
+
+IMX6CameraLookupTable::IMX6CameraLookupTable()
+    : mSize(0)
+    , mSerial(0)
+{
+}
+
+bool IMX6CameraLookupTable::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        mErrorString = file.errorString();
+        return false;
+    }
+
+    QTextStream stream(&file);
+    int size = 0;
+    int entries = 0;
+    int lineNumber = 0;
+    QByteArray atlas;
+    uchar *texels = 0;
+
+    while (!stream.atEnd()) {
+        const QString line = stream.readLine().simplified();
+        ++lineNumber;
+        if (line.isEmpty() || line.startsWith(QLatin1Char('#')))
+            continue;
+
+        const QStringList fields = line.split(QLatin1Char(' '));
+        const QString &keyword = fields.first();
+        if (keyword == QLatin1String("TITLE")) {
+            continue;
+        } else if (keyword == QLatin1String("LUT_3D_SIZE")) {
+            size = fields.value(1).toInt();
+            if (size < 2 || size > LOOKUP_TABLE_MAX_SIZE) {
+                mErrorString = QString::fromLatin1("unsupported LUT_3D_SIZE %1").arg(fields.value(1));
+                return false;
+            }
+            atlas = QByteArray(size * size * size * 4, '\0');
+            texels = reinterpret_cast<uchar *>(atlas.data());
+        } else if (keyword == QLatin1String("DOMAIN_MIN") || keyword == QLatin1String("DOMAIN_MAX")) {
+            // The shader looks the table up over [0, 1] only
+            const float expected = keyword == QLatin1String("DOMAIN_MIN") ? 0.0f : 1.0f;
+            for (int i = 1; i < 4; ++i) {
+                if (fields.value(i).toFloat() != expected) {
+                    mErrorString = QString::fromLatin1("line %1: only the [0, 1] domain is supported").arg(lineNumber);
+                    return false;
+                }
+            }
+        } else if (keyword == QLatin1String("LUT_1D_SIZE")) {
+            mErrorString = QString::fromLatin1("1D tables are not supported");
+            return false;
+        } else {
+            bool ok = fields.size() == 3 && texels && entries < size * size * size;
+            float rgb[3];
+            for (int i = 0; ok && i < 3; ++i)
+                rgb[i] = fields.at(i).toFloat(&ok);
+            if (!ok) {
+                mErrorString = QString::fromLatin1("line %1: unexpected \"%2\"").arg(lineNumber).arg(line);
+                return false;
+            }
+            // Red changes fastest in the file, then green, then blue
+            const int r = entries % size;
+            const int g = (entries / size) % size;
+            const int b = entries / (size * size);
+            uchar *texel = texels + ((g * size * size) + b * size + r) * 4;
+            for (int i = 0; i < 3; ++i)
+                texel[i] = uchar(qBound(0.0f, rgb[i], 1.0f) * 255.0f + 0.5f);
+            texel[3] = 255;
+            ++entries;
+        }
+    }
+
+    if (!size || entries != size * size * size) {
+        mErrorString = QString::fromLatin1("expected %1 entries, found %2").arg(size * size * size).arg(entries);
+        return false;
+    }
+
+    mSize = size;
+    mAtlas = atlas;
+    mSerial = lookupTableSerial.fetchAndAddRelaxed(1) + 1;
+    mErrorString.clear();
+    return true;
+}
@@ -0,0 +1,69 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERALOOKUPTABLE_H
+#define IMX6CAMERALOOKUPTABLE_H
+
+#include <QByteArray>
+#include <QString>
+
+#define LOOKUP_TABLE_MAX_SIZE 64    // Entries per axis, the atlas is size * size texels wide
+
+// A 3D colour lookup table, stored as the 2D atlas the video material uploads:
+// size slices of size x size RGBA texels side by side, one slice per blue
+// entry, red along x and green along y within a slice.
+class IMX6CameraLookupTable
+{
+public:
+    IMX6CameraLookupTable();
+
+    // Reads an Adobe/Resolve .cube file. On failure the table is left as it
+    // was and errorString() says why.
+    bool load(const QString &fileName);
+
+    bool isNull() const { return mSize == 0; }
+    int size() const { return mSize; }
+    int atlasWidth() const { return mSize * mSize; }
+    int atlasHeight() const { return mSize; }
+    const QByteArray &atlas() const { return mAtlas; }
+    // Differs between every table loaded, so a reload of the same file is
+    // noticed by materials that already uploaded the previous contents
+    quint32 serial() const { return mSerial; }
+    QString errorString() const { return mErrorString; }
+
+private:
+    int mSize;
+    QByteArray mAtlas;
+    quint32 mSerial;
+    QString mErrorString;
+};
+
+#endif // IMX6CAMERALOOKUPTABLE_H
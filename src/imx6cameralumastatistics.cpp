@@ -0,0 +1,140 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameralumastatistics.h"
+#include "imx6camerasimd.h"
+#include <cstring>
+
+// Limited range video levels
+#define LUMA_BLACK 16
+#define LUMA_WHITE 235
+
+IMX6CameraLumaStatistics::IMX6CameraLumaStatistics(QObject *parent)
+    : IMX6CameraProcessingStage(parent)
+    , m_regionColumns(4)
+    , m_regionRows(4)
+    , m_rowStep(4)
+    , m_notifyPending(0)
+{
+}
+
+IMX6CameraLumaStatistics::~IMX6CameraLumaStatistics()
+{
+    detach();
+}
+
+void IMX6CameraLumaStatistics::setRegions(int columns, int rows)
+{
+    m_regionColumns.store(qBound(1, columns, LUMA_STATISTICS_MAX_REGIONS));
+    m_regionRows.store(qBound(1, rows, LUMA_STATISTICS_MAX_REGIONS));
+}
+
+void IMX6CameraLumaStatistics::setRowStep(int rowStep)
+{
+    m_rowStep.store(qMax(1, rowStep));
+}
+
+bool IMX6CameraLumaStatistics::takeLatest(IMX6CameraLumaStatisticsResult *result)
+{
+    m_notifyPending.store(0);
+    if (!m_results.update())
+        return false;
+    *result = m_results.front();
+    return true;
+}
+
+void IMX6CameraLumaStatistics::process(const IMX6CameraFrame &frame)
+{
+    int offset, step;
+    const BufferPlane &plane = frame.plane(0);
+    if (!frame.lumaLayout(&offset, &step) || !plane.data)
+        return;
+
+    const int width = frame.size.width();
+    const int height = frame.size.height();
+    const int columns = qMin(m_regionColumns.load(), width);
+    const int rows = qMin(m_regionRows.load(), height);
+    const int rowStep = m_rowStep.load();
+    if (width <= 0 || height <= 0)
+        return;
+
+    quint64 regionSums[LUMA_STATISTICS_MAX_REGIONS * LUMA_STATISTICS_MAX_REGIONS];
+    quint32 regionCounts[LUMA_STATISTICS_MAX_REGIONS * LUMA_STATISTICS_MAX_REGIONS];
+    memset(regionSums, 0, sizeof(regionSums));
+    memset(regionCounts, 0, sizeof(regionCounts));
+    memset(m_histograms, 0, sizeof(m_histograms));
+
+    // One pass: each row segment feeds the histogram and its region sum
+    for (int y = 0; y < height; y += rowStep) {
+        const uchar *line = plane.data + y * plane.bytesPerLine + offset;
+        const int region = y * rows / height * columns;
+        for (int column = 0; column < columns; ++column) {
+            const int left = column * width / columns;
+            const int right = (column + 1) * width / columns;
+            regionSums[region + column] += imx6LumaHistogram(line + left * step, right - left, step, offset, m_histograms);
+            regionCounts[region + column] += right - left;
+        }
+    }
+
+    IMX6CameraLumaStatisticsResult &result = m_results.back();
+    result.sequence = frame.sequence;
+    result.timestamp = frame.timestamp;
+    result.regionColumns = columns;
+    result.regionRows = rows;
+
+    quint64 sum = 0;
+    quint32 count = 0;
+    for (int i = 0; i < columns * rows; ++i) {
+        sum += regionSums[i];
+        count += regionCounts[i];
+        result.regions[i] = regionCounts[i] ? qreal(regionSums[i]) / regionCounts[i] : 0;
+    }
+
+    quint32 dark = 0;
+    quint32 bright = 0;
+    for (int bin = 0; bin < 256; ++bin) {
+        const quint32 samples = m_histograms[bin] + m_histograms[256 + bin]
+                + m_histograms[512 + bin] + m_histograms[768 + bin];
+        result.histogram[bin] = samples;
+        if (bin <= LUMA_BLACK)
+            dark += samples;
+        else if (bin >= LUMA_WHITE)
+            bright += samples;
+    }
+    result.sampleCount = count;
+    result.mean = count ? qreal(sum) / count : 0;
+    result.underexposed = count ? qreal(dark) / count : 0;
+    result.overexposed = count ? qreal(bright) / count : 0;
+    m_results.publish();
+
+    if (m_notifyPending.testAndSetOrdered(0, 1))
+        emit resultAvailable();
+}
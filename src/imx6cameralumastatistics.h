@@ -0,0 +1,86 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERALUMASTATISTICS_H
+#define IMX6CAMERALUMASTATISTICS_H
+
+#include "imx6cameraprocessingstage.h"
+#include "imx6cameratriplebuffer.h"
+
+#define LUMA_STATISTICS_MAX_REGIONS 8   // Per direction
+
+struct IMX6CameraLumaStatisticsResult {
+    quint32 sequence;
+    qint64 timestamp;
+    quint32 sampleCount;
+    quint32 histogram[256];
+    qreal mean;
+    qreal underexposed;     // Share of samples at or below video black
+    qreal overexposed;      // Share of samples at or above video white
+    int regionColumns;
+    int regionRows;
+    qreal regions[LUMA_STATISTICS_MAX_REGIONS * LUMA_STATISTICS_MAX_REGIONS]; // Mean luma, row by row
+};
+
+// Luma histogram, mean, clipping and per-region means of every frame, taken
+// in one pass over the mapped buffer.
+class IMX6CameraLumaStatistics : public IMX6CameraProcessingStage
+{
+    Q_OBJECT
+public:
+    explicit IMX6CameraLumaStatistics(QObject *parent = 0);
+    ~IMX6CameraLumaStatistics();
+
+    void setRegions(int columns, int rows);
+    // Only every rowStep-th row is read, 1 reads the whole frame
+    void setRowStep(int rowStep);
+
+    // Copies the newest result if one arrived since the last call. Lock-free,
+    // but only one thread may take results.
+    bool takeLatest(IMX6CameraLumaStatisticsResult *result);
+
+Q_SIGNALS:
+    // Emitted from the worker thread, at most once until takeLatest() is called
+    void resultAvailable();
+
+protected:
+    void process(const IMX6CameraFrame &frame);
+
+private:
+    QAtomicInt m_regionColumns;
+    QAtomicInt m_regionRows;
+    QAtomicInt m_rowStep;
+    QAtomicInt m_notifyPending;
+    IMX6CameraTripleBuffer<IMX6CameraLumaStatisticsResult> m_results;
+    quint32 m_histograms[4 * 256];
+};
+
+#endif // IMX6CAMERALUMASTATISTICS_H
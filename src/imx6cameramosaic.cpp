@@ -0,0 +1,590 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameramosaic.h"
+#include "imx6cameratrace.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QQuickWindow>
+#include <QSGGeometry>
+#include <QtMath>
+
+#include <cstring>
+
+namespace {
+
+struct MosaicVertex {
+    float x;
+    float y;
+    float tx;
+    float ty;
+    float tile;
+};
+
+const QSGGeometry::AttributeSet &mosaicAttributes()
+{
+    static QSGGeometry::Attribute attributes[] = {
+        QSGGeometry::Attribute::create(0, 2, GL_FLOAT, true),
+        QSGGeometry::Attribute::create(1, 2, GL_FLOAT),
+        QSGGeometry::Attribute::create(2, 1, GL_FLOAT)
+    };
+    static QSGGeometry::AttributeSet attributeSet = { 3, sizeof(MosaicVertex), attributes };
+    return attributeSet;
+}
+
+inline void setVertex(MosaicVertex *v, const QPointF &p, const QPointF &t, int tile)
+{
+    v->x = p.x();
+    v->y = p.y();
+    v->tx = t.x();
+    v->ty = t.y();
+    v->tile = tile;
+}
+
+}
+
+QSGVivanteMosaicMaterial::QSGVivanteMosaicMaterial(const QVector<IMX6CameraControl *> &controls)
+{
+    // Created on the render thread, so the caches belong to its context
+    Q_FOREACH (IMX6CameraControl *control, controls)
+        mTextureCaches.append(IMX6CameraTextureCache::cache(control));
+    setFlag(Blending, false);
+}
+
+QSGMaterialType *QSGVivanteMosaicMaterial::type() const
+{
+    // The shader depends on the number of samplers only
+    static QSGMaterialType types[MOSAIC_MAX_TILES_PER_DRAW];
+    return &types[mTextureCaches.size() - 1];
+}
+
+QSGMaterialShader *QSGVivanteMosaicMaterial::createShader() const
+{
+    return new QSGVivanteMosaicMaterialShader(mTextureCaches.size());
+}
+
+int QSGVivanteMosaicMaterial::compare(const QSGMaterial *other) const
+{
+    if (type() != other->type())
+        return 1;
+    const QSGVivanteMosaicMaterial *m = static_cast<const QSGVivanteMosaicMaterial *>(other);
+    for (int i = 0; i < mTextureCaches.size(); ++i) {
+        if (mTextureCaches.at(i) != m->mTextureCaches.at(i))
+            return mTextureCaches.at(i).data() < m->mTextureCaches.at(i).data() ? -1 : 1;
+    }
+    return 0;
+}
+
+void QSGVivanteMosaicMaterial::setNextFrame(int tile, const IMX6CameraFrame &frame)
+{
+    mTextureCaches.at(tile)->setNextFrame(frame);
+}
+
+void QSGVivanteMosaicMaterial::bind()
+{
+    QOpenGLContext *glcontext = QOpenGLContext::currentContext();
+    if (glcontext == 0) {
+        qWarning() << Q_FUNC_INFO << "no QOpenGLContext::currentContext() => return";
+        return;
+    }
+    // A stream shown twice is bound twice, its cache maps each frame only once
+    QOpenGLFunctions *gl = glcontext->functions();
+    for (int i = mTextureCaches.size() - 1; i >= 0; --i) {
+        gl->glActiveTexture(GL_TEXTURE0 + i);
+        mTextureCaches.at(i)->bind();
+    }
+}
+
+QSGVivanteMosaicMaterialShader::QSGVivanteMosaicMaterialShader(int tileCount) :
+    mTileCount(tileCount),
+    mIdMatrix(-1),
+    mIdTiles(-1),
+    mIdOpacity(-1)
+{
+    // GLSL ES 2.0 only indexes sampler arrays with constants, so the tile is
+    // picked by comparisons. Fragments of one tile all take the same branch.
+    mFragmentShader =
+            "uniform sampler2D tiles[" + QByteArray::number(mTileCount) + "];\n"
+            "uniform lowp float opacity;\n"
+            "varying highp vec2 qt_TexCoord;\n"
+            "varying mediump float tile;\n"
+            "void main() {\n"
+            "    lowp vec3 rgb;\n";
+    for (int i = 0; i < mTileCount - 1; ++i) {
+        mFragmentShader += "    " + QByteArray(i ? "else " : "") + "if (tile < " + QByteArray::number(i) + ".5)\n"
+                "        rgb = texture2D(tiles[" + QByteArray::number(i) + "], qt_TexCoord).rgb;\n";
+    }
+    mFragmentShader += "    " + QByteArray(mTileCount > 1 ? "else\n        " : "")
+            + "rgb = texture2D(tiles[" + QByteArray::number(mTileCount - 1) + "], qt_TexCoord).rgb;\n"
+            "    gl_FragColor = vec4(rgb, 1.0) * opacity;\n"
+            "}\n";
+}
+
+void QSGVivanteMosaicMaterialShader::updateState(const RenderState &state,
+                                                 QSGMaterial *newMaterial,
+                                                 QSGMaterial *oldMaterial)
+{
+    Q_UNUSED(oldMaterial);
+
+    QSGVivanteMosaicMaterial *mat = static_cast<QSGVivanteMosaicMaterial *>(newMaterial);
+    GLint units[MOSAIC_MAX_TILES_PER_DRAW];
+    for (int i = 0; i < mTileCount; ++i)
+        units[i] = i;
+    program()->setUniformValueArray(mIdTiles, units, mTileCount);
+    mat->bind();
+    if (state.isOpacityDirty())
+        program()->setUniformValue(mIdOpacity, state.opacity());
+    if (state.isMatrixDirty())
+        program()->setUniformValue(mIdMatrix, state.combinedMatrix());
+}
+
+const char * const *QSGVivanteMosaicMaterialShader::attributeNames() const
+{
+    static const char *names[] = {
+        "qt_VertexPosition",
+        "qt_VertexTexCoord",
+        "qt_VertexTile",
+        0
+    };
+    return names;
+}
+
+const char *QSGVivanteMosaicMaterialShader::vertexShader() const
+{
+    static const char *shader =
+            "uniform highp mat4 qt_Matrix;                      \n"
+            "attribute highp vec4 qt_VertexPosition;            \n"
+            "attribute highp vec2 qt_VertexTexCoord;            \n"
+            "attribute mediump float qt_VertexTile;             \n"
+            "varying highp vec2 qt_TexCoord;                    \n"
+            "varying mediump float tile;                        \n"
+            "void main() {                                      \n"
+            "    qt_TexCoord = qt_VertexTexCoord;               \n"
+            "    tile = qt_VertexTile;                          \n"
+            "    gl_Position = qt_Matrix * qt_VertexPosition;   \n"
+            "}";
+    return shader;
+}
+
+const char *QSGVivanteMosaicMaterialShader::fragmentShader() const
+{
+    return mFragmentShader.constData();
+}
+
+void QSGVivanteMosaicMaterialShader::initialize()
+{
+    mIdMatrix = program()->uniformLocation("qt_Matrix");
+    mIdTiles = program()->uniformLocation("tiles");
+    mIdOpacity = program()->uniformLocation("opacity");
+}
+
+QSGVivanteMosaicNode::QSGVivanteMosaicNode(const QVector<IMX6CameraControl *> &controls)
+{
+    setFlag(QSGNode::OwnsMaterial, true);
+    mMaterial = new QSGVivanteMosaicMaterial(controls);
+    setMaterial(mMaterial);
+
+    // Two triangles per tile, tiles are apart so they can not share a strip
+    QSGGeometry *g = new QSGGeometry(mosaicAttributes(), 6 * controls.size());
+    g->setDrawingMode(GL_TRIANGLES);
+    memset(g->vertexData(), 0, g->vertexCount() * sizeof(MosaicVertex));
+    setFlag(QSGNode::OwnsGeometry, true);
+    setGeometry(g);
+}
+
+int QSGVivanteMosaicNode::tileCount() const
+{
+    return mMaterial->tileCount();
+}
+
+void QSGVivanteMosaicNode::setNextFrame(int tile, const IMX6CameraFrame &frame)
+{
+    mMaterial->setNextFrame(tile, frame);
+    markDirty(DirtyMaterial);
+}
+
+void QSGVivanteMosaicNode::setTileGeometry(int tile, const QRectF &rect, const QRectF &textureRect)
+{
+    MosaicVertex *v = static_cast<MosaicVertex *>(geometry()->vertexData()) + 6 * tile;
+    setVertex(v + 0, rect.topLeft(), textureRect.topLeft(), tile);
+    setVertex(v + 1, rect.bottomLeft(), textureRect.bottomLeft(), tile);
+    setVertex(v + 2, rect.topRight(), textureRect.topRight(), tile);
+    setVertex(v + 3, rect.topRight(), textureRect.topRight(), tile);
+    setVertex(v + 4, rect.bottomLeft(), textureRect.bottomLeft(), tile);
+    setVertex(v + 5, rect.bottomRight(), textureRect.bottomRight(), tile);
+    markDirty(DirtyGeometry);
+}
+
+IMX6CameraMosaic::IMX6CameraMosaic()
+    : m_columns(0)
+    , m_spacing(0)
+    , m_preserveAspectRatio(false)
+    , m_tilesDirty(false)
+    , m_geometryDirty(true)
+    , m_drawCalls(0)
+    , m_window(0)
+{
+    setFlag(ItemHasContents, true);
+    qRegisterMetaType<IMX6CameraFrame>("IMX6CameraFrame");
+    connect(this, &QQuickItem::windowChanged, this, &IMX6CameraMosaic::handleWindowChanged);
+    connect(this, &QQuickItem::visibleChanged, this, &IMX6CameraMosaic::updateDemand);
+}
+
+IMX6CameraMosaic::~IMX6CameraMosaic()
+{
+    releaseTiles();
+}
+
+QStringList IMX6CameraMosaic::devices() const
+{
+    return m_devices;
+}
+
+void IMX6CameraMosaic::setDevices(const QStringList &devices)
+{
+    if (devices == m_devices)
+        return;
+    // New sessions start before the old ones stop, so devices in both lists keep streaming
+    const QVector<Tile> previous = m_tiles;
+    m_tiles.clear();
+    m_devices = devices;
+
+    Q_FOREACH (const QString &device, m_devices) {
+        Tile tile;
+        tile.control = IMX6CameraControl::cameraControl(device.toLocal8Bit(), &tile.sessionId);
+        tile.frameChanged = false;
+        tile.frames = 0;
+        tile.synchronizedIndex = -1;
+        m_tiles.append(tile);
+        // One connection per device, a frame goes to every tile showing it
+        connect(tile.control, &IMX6CameraControl::frameReady, this, &IMX6CameraMosaic::present, Qt::UniqueConnection);
+        connect(tile.control, &IMX6CameraControl::sourceSizeChanged, this, &IMX6CameraMosaic::invalidateGeometry, Qt::UniqueConnection);
+        tile.control->startCamera(tile.sessionId);
+    }
+    Q_FOREACH (const Tile &tile, previous) {
+        if (!m_devices.contains(QString::fromLocal8Bit(tile.control->device())))
+            disconnect(tile.control, 0, this, 0);
+        tile.control->stopCameraStream(tile.sessionId);
+    }
+    updateDemand();
+    updateSynchronizedTiles();
+
+    m_tilesDirty = true;
+    invalidateGeometry();
+    emit devicesChanged(m_devices);
+}
+
+void IMX6CameraMosaic::releaseTiles()
+{
+    Q_FOREACH (const Tile &tile, m_tiles) {
+        disconnect(tile.control, 0, this, 0);
+        tile.control->stopCameraStream(tile.sessionId);
+    }
+    m_tiles.clear();
+}
+
+int IMX6CameraMosaic::columns() const
+{
+    return m_columns;
+}
+
+void IMX6CameraMosaic::setColumns(int columns)
+{
+    if (columns == m_columns)
+        return;
+    m_columns = columns;
+    invalidateGeometry();
+    emit columnsChanged(m_columns);
+}
+
+qreal IMX6CameraMosaic::spacing() const
+{
+    return m_spacing;
+}
+
+void IMX6CameraMosaic::setSpacing(qreal spacing)
+{
+    if (qFuzzyCompare(spacing, m_spacing))
+        return;
+    m_spacing = spacing;
+    invalidateGeometry();
+    emit spacingChanged(m_spacing);
+}
+
+QVariantList IMX6CameraMosaic::layout() const
+{
+    return m_layout;
+}
+
+void IMX6CameraMosaic::setLayout(const QVariantList &layout)
+{
+    if (layout == m_layout)
+        return;
+    m_layout = layout;
+    invalidateGeometry();
+    emit layoutChanged(m_layout);
+}
+
+bool IMX6CameraMosaic::preserveAspectRatio() const
+{
+    return m_preserveAspectRatio;
+}
+
+void IMX6CameraMosaic::setPreserveAspectRatio(bool value)
+{
+    if (value == m_preserveAspectRatio)
+        return;
+    m_preserveAspectRatio = value;
+    invalidateGeometry();
+    emit preserveAspectRatioChanged(m_preserveAspectRatio);
+}
+
+IMX6CameraSynchronizer *IMX6CameraMosaic::synchronizer() const
+{
+    return m_synchronizer;
+}
+
+void IMX6CameraMosaic::setSynchronizer(IMX6CameraSynchronizer *synchronizer)
+{
+    if (synchronizer == m_synchronizer)
+        return;
+    if (m_synchronizer)
+        disconnect(m_synchronizer, 0, this, 0);
+    m_synchronizer = synchronizer;
+    if (m_synchronizer) {
+        connect(m_synchronizer, &IMX6CameraSynchronizer::framesMatched, this, &IMX6CameraMosaic::presentSet);
+        connect(m_synchronizer, &IMX6CameraSynchronizer::devicesChanged, this, &IMX6CameraMosaic::updateSynchronizedTiles);
+        connect(m_synchronizer, &QObject::destroyed, this, &IMX6CameraMosaic::updateSynchronizedTiles);
+    }
+    updateSynchronizedTiles();
+    emit synchronizerChanged(m_synchronizer);
+}
+
+void IMX6CameraMosaic::updateSynchronizedTiles()
+{
+    const QStringList synchronized = m_synchronizer ? m_synchronizer->devices() : QStringList();
+    for (int i = 0; i < m_tiles.size(); ++i)
+        m_tiles[i].synchronizedIndex = synchronized.indexOf(m_devices.at(i));
+}
+
+int IMX6CameraMosaic::drawCalls() const
+{
+    return m_drawCalls;
+}
+
+void IMX6CameraMosaic::setDrawCalls(int count)
+{
+    if (count == m_drawCalls)
+        return;
+    m_drawCalls = count;
+    emit drawCallsChanged(m_drawCalls);
+}
+
+int IMX6CameraMosaic::tileFrames(int tile) const
+{
+    if (tile < 0 || tile >= m_tiles.size())
+        return 0;
+    return m_tiles.at(tile).frames;
+}
+
+void IMX6CameraMosaic::present(const IMX6CameraFrame &frame)
+{
+    if (!isVisible())
+        return;
+    IMX6CameraControl *control = qobject_cast<IMX6CameraControl *>(sender());
+    for (int i = 0; i < m_tiles.size(); ++i) {
+        Tile &tile = m_tiles[i];
+        if (tile.control != control || tile.synchronizedIndex >= 0)
+            continue;
+        tile.frame = frame; // An older frame not yet handed over is released here
+        tile.frameChanged = true;
+    }
+    update();
+}
+
+void IMX6CameraMosaic::presentSet(const QList<IMX6CameraFrame> &frames)
+{
+    if (!isVisible())
+        return;
+    // The whole set is handed over in the same updatePaintNode(), so its
+    // frames reach the screen together
+    for (int i = 0; i < m_tiles.size(); ++i) {
+        Tile &tile = m_tiles[i];
+        if (tile.synchronizedIndex < 0 || tile.synchronizedIndex >= frames.size())
+            continue;
+        tile.frame = frames.at(tile.synchronizedIndex);
+        tile.frameChanged = true;
+    }
+    update();
+}
+
+void IMX6CameraMosaic::invalidateGeometry()
+{
+    m_geometryDirty = true;
+    update();
+}
+
+void IMX6CameraMosaic::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size())
+        invalidateGeometry();
+}
+
+void IMX6CameraMosaic::handleWindowChanged(QQuickWindow *window)
+{
+    if (m_window)
+        disconnect(m_window, &QQuickWindow::afterRendering, this, &IMX6CameraMosaic::retireFrames);
+    m_window = window;
+    if (m_window)
+        connect(m_window, &QQuickWindow::afterRendering, this, &IMX6CameraMosaic::retireFrames, Qt::DirectConnection);
+}
+
+void IMX6CameraMosaic::retireFrames()
+{
+    // Called from the render thread once the scene is drawn
+    Q_FOREACH (IMX6CameraControl *control, m_renderControls) {
+        QSharedPointer<IMX6CameraTextureCache> textureCache = IMX6CameraTextureCache::cache(control, false);
+        if (!textureCache.isNull())
+            textureCache->afterRendering();
+    }
+}
+
+void IMX6CameraMosaic::updateDemand()
+{
+    Q_FOREACH (const Tile &tile, m_tiles)
+        tile.control->setSessionDemand(tile.sessionId, isVisible());
+}
+
+QRectF IMX6CameraMosaic::tileRect(int tile) const
+{
+    QRectF cell;
+    if (tile < m_layout.size()) {
+        // Explicit rectangles are fractions of the item size
+        const QRectF r = m_layout.at(tile).toRectF();
+        cell = QRectF(r.x() * width(), r.y() * height(), r.width() * width(), r.height() * height());
+    } else {
+        const int count = m_tiles.size();
+        const int columns = m_columns > 0 ? m_columns : qCeil(qSqrt(qreal(count)));
+        const int rows = (count + columns - 1) / columns;
+        const qreal cellWidth = (width() - m_spacing * (columns - 1)) / columns;
+        const qreal cellHeight = (height() - m_spacing * (rows - 1)) / rows;
+        cell = QRectF((tile % columns) * (cellWidth + m_spacing), (tile / columns) * (cellHeight + m_spacing),
+                      cellWidth, cellHeight);
+    }
+
+    const QSize source = m_tiles.at(tile).control->sourceSize();
+    if (m_preserveAspectRatio && !source.isEmpty() && !cell.isEmpty()) {
+        QRectF fitted(QPointF(0, 0), QSizeF(source).scaled(cell.size(), Qt::KeepAspectRatio));
+        fitted.moveCenter(cell.center());
+        cell = fitted;
+    }
+    return cell;
+}
+
+QRectF IMX6CameraMosaic::textureRect(int tile) const
+{
+    // Textures span the whole stride, padding at the end of the lines is never sampled
+    const IMX6CameraControl *control = m_tiles.at(tile).control;
+    const QSize frameSize = control->frameSize();
+    const QSize bufferSize = control->bufferSize();
+    if (frameSize.isEmpty() || bufferSize.width() <= frameSize.width())
+        return QRectF(0, 0, 1, 1);
+    return QRectF(0, 0, qreal(frameSize.width()) / bufferSize.width(), 1);
+}
+
+QSGNode *IMX6CameraMosaic::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data)
+{
+    IMX6_TRACE_SCOPE("mosaicUpdatePaintNode", -1);
+    Q_UNUSED(data);
+
+    if (m_tiles.isEmpty()) {
+        delete oldNode;
+        m_renderControls.clear();
+        QMetaObject::invokeMethod(this, "setDrawCalls", Qt::QueuedConnection, Q_ARG(int, 0));
+        return 0;
+    }
+
+    QSGNode *root = oldNode;
+    if (!root) {
+        root = new QSGNode;
+        m_tilesDirty = true;
+    }
+
+    if (m_tilesDirty) {
+        while (QSGNode *child = root->firstChild()) {
+            root->removeChildNode(child);
+            delete child;
+        }
+
+        // GLES2 guarantees 8 texture units to fragment shaders, a draw takes as many tiles as there are units
+        GLint units = 8;
+        QOpenGLContext::currentContext()->functions()->glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+        const int tilesPerDraw = qBound(1, int(units), MOSAIC_MAX_TILES_PER_DRAW);
+
+        m_renderControls.clear();
+        for (int first = 0; first < m_tiles.size(); first += tilesPerDraw) {
+            QVector<IMX6CameraControl *> controls;
+            for (int i = first; i < qMin(first + tilesPerDraw, m_tiles.size()); ++i) {
+                IMX6CameraControl *control = m_tiles.at(i).control;
+                controls.append(control);
+                if (!m_renderControls.contains(control))
+                    m_renderControls.append(control);
+            }
+            root->appendChildNode(new QSGVivanteMosaicNode(controls));
+        }
+        QMetaObject::invokeMethod(this, "setDrawCalls", Qt::QueuedConnection, Q_ARG(int, root->childCount()));
+        m_tilesDirty = false;
+        m_geometryDirty = true;
+    }
+
+    int tile = 0;
+    for (QSGNode *child = root->firstChild(); child; child = child->nextSibling()) {
+        QSGVivanteMosaicNode *node = static_cast<QSGVivanteMosaicNode *>(child);
+        for (int slot = 0; slot < node->tileCount(); ++slot, ++tile) {
+            Tile &t = m_tiles[tile];
+            if (m_geometryDirty)
+                node->setTileGeometry(slot, tileRect(tile), textureRect(tile));
+            // Only tiles with a new frame touch their texture cache
+            if (t.frameChanged) {
+                node->setNextFrame(slot, t.frame);
+                t.frame = IMX6CameraFrame(); // The texture cache holds the frame from now on
+                t.frameChanged = false;
+                ++t.frames;
+            }
+        }
+    }
+    m_geometryDirty = false;
+
+    return root;
+}
@@ -0,0 +1,189 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERAMOSAIC_H
+#define IMX6CAMERAMOSAIC_H
+
+#include <QPointer>
+#include <QQuickItem>
+#include <QSGGeometryNode>
+#include <QSGMaterial>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+#include "imx6cameracontrol.h"
+#include "imx6camerasynchronizer.h"
+#include "imx6cameratexturecache.h"
+
+#define MOSAIC_MAX_TILES_PER_DRAW 16    // Upper bound, the texture units of the GPU may allow fewer
+
+// Samples the textures of up to MOSAIC_MAX_TILES_PER_DRAW streams in one
+// draw, each vertex carries the index of the stream its tile shows.
+class QSGVivanteMosaicMaterial : public QSGMaterial
+{
+public:
+    QSGVivanteMosaicMaterial(const QVector<IMX6CameraControl *> &controls);
+
+    virtual QSGMaterialType *type() const;
+    virtual QSGMaterialShader *createShader() const;
+    virtual int compare(const QSGMaterial *other) const;
+    int tileCount() const { return mTextureCaches.size(); }
+    void setNextFrame(int tile, const IMX6CameraFrame &frame);
+    // Binds the texture of tile i to texture unit i
+    void bind();
+
+private:
+    QVector<QSharedPointer<IMX6CameraTextureCache> > mTextureCaches;
+};
+
+class QSGVivanteMosaicMaterialShader : public QSGMaterialShader
+{
+public:
+    explicit QSGVivanteMosaicMaterialShader(int tileCount);
+
+    void updateState(const RenderState &state, QSGMaterial *newMaterial, QSGMaterial *oldMaterial);
+    virtual char const *const *attributeNames() const;
+
+protected:
+    virtual const char *vertexShader() const;
+    virtual const char *fragmentShader() const;
+    virtual void initialize();
+
+private:
+    int mTileCount;
+    QByteArray mFragmentShader;
+    int mIdMatrix;
+    int mIdTiles;
+    int mIdOpacity;
+};
+
+class QSGVivanteMosaicNode : public QSGGeometryNode
+{
+public:
+    QSGVivanteMosaicNode(const QVector<IMX6CameraControl *> &controls);
+
+    int tileCount() const;
+    void setNextFrame(int tile, const IMX6CameraFrame &frame);
+    void setTileGeometry(int tile, const QRectF &rect, const QRectF &textureRect);
+
+private:
+    QSGVivanteMosaicMaterial *mMaterial;
+};
+
+// Shows several capture devices side by side in as few draw calls as the
+// GPU allows, one per MOSAIC_MAX_TILES_PER_DRAW tiles at most. Tiles follow
+// a grid unless layout gives their rectangles explicitly.
+class IMX6CameraMosaic : public QQuickItem
+{
+    Q_OBJECT
+    Q_PROPERTY(QStringList devices READ devices WRITE setDevices NOTIFY devicesChanged)
+    Q_PROPERTY(int columns READ columns WRITE setColumns NOTIFY columnsChanged)
+    Q_PROPERTY(qreal spacing READ spacing WRITE setSpacing NOTIFY spacingChanged)
+    Q_PROPERTY(QVariantList layout READ layout WRITE setLayout NOTIFY layoutChanged)
+    Q_PROPERTY(bool preserveAspectRatio READ preserveAspectRatio WRITE setPreserveAspectRatio NOTIFY preserveAspectRatioChanged)
+    Q_PROPERTY(IMX6CameraSynchronizer *synchronizer READ synchronizer WRITE setSynchronizer NOTIFY synchronizerChanged)
+    Q_PROPERTY(int drawCalls READ drawCalls NOTIFY drawCallsChanged)
+
+public:
+    IMX6CameraMosaic();
+    ~IMX6CameraMosaic();
+
+    QStringList devices() const;
+    int columns() const;
+    qreal spacing() const;
+    QVariantList layout() const;
+    bool preserveAspectRatio() const;
+    IMX6CameraSynchronizer *synchronizer() const;
+    int drawCalls() const;
+    // Frames shown by a tile since its device was assigned
+    Q_INVOKABLE int tileFrames(int tile) const;
+
+public Q_SLOTS:
+    void setDevices(const QStringList &devices);
+    void setColumns(int columns);
+    void setSpacing(qreal spacing);
+    void setLayout(const QVariantList &layout);
+    void setPreserveAspectRatio(bool value);
+    // Tiles of the synchronizer's devices only show matched sets, all in the same frame
+    void setSynchronizer(IMX6CameraSynchronizer *synchronizer);
+
+Q_SIGNALS:
+    void devicesChanged(const QStringList &);
+    void columnsChanged(int);
+    void spacingChanged(qreal);
+    void layoutChanged(const QVariantList &);
+    void preserveAspectRatioChanged(bool);
+    void synchronizerChanged(IMX6CameraSynchronizer *);
+    void drawCallsChanged(int);
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *);
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry);
+
+private Q_SLOTS:
+    void present(const IMX6CameraFrame &frame);
+    void presentSet(const QList<IMX6CameraFrame> &frames);
+    void updateSynchronizedTiles();
+    void invalidateGeometry();
+    void handleWindowChanged(QQuickWindow *window);
+    void retireFrames();
+    void updateDemand();
+    void setDrawCalls(int count);
+
+private:
+    struct Tile {
+        IMX6CameraControl *control;
+        int sessionId;
+        IMX6CameraFrame frame;  // Newest frame not yet handed to the scene graph
+        bool frameChanged;
+        int frames;
+        int synchronizedIndex;  // Position of the device in the synchronizer, -1 if not synchronized
+    };
+
+    void releaseTiles();
+    QRectF tileRect(int tile) const;
+    QRectF textureRect(int tile) const;
+
+    QStringList m_devices;
+    int m_columns;
+    qreal m_spacing;
+    QVariantList m_layout;
+    bool m_preserveAspectRatio;
+    QPointer<IMX6CameraSynchronizer> m_synchronizer;
+    QVector<Tile> m_tiles;
+    bool m_tilesDirty;      // Devices changed, the nodes are rebuilt
+    bool m_geometryDirty;
+    int m_drawCalls;
+    QQuickWindow *m_window;
+    QVector<IMX6CameraControl *> m_renderControls;  // Render thread copy, one entry per device
+};
+
+#endif // IMX6CAMERAMOSAIC_H
@@ -0,0 +1,210 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameramotiondetector.h"
+#include "imx6camerasimd.h"
+#include <QMutexLocker>
+#include <QtMath>
+
+#define MOTION_CELL_SIZE 16
+#define MOTION_LEARNING_SHIFT 5     // The background follows the scene with 1/32 per frame
+#define MOTION_START_FRAMES 2       // Consecutive frames with motion before it is reported
+#define MOTION_STOP_FRAMES 25       // Quiet frames before the end of motion is reported
+
+IMX6CameraMotionDetector::IMX6CameraMotionDetector(QObject *parent)
+    : IMX6CameraProcessingStage(parent)
+    , m_sensitivity(20)
+    , m_minimumArea(0.01)
+    , m_columns(0)
+    , m_rows(0)
+    , m_motion(false)
+    , m_motionFrames(0)
+    , m_quietFrames(0)
+{
+}
+
+IMX6CameraMotionDetector::~IMX6CameraMotionDetector()
+{
+    detach();
+}
+
+void IMX6CameraMotionDetector::setZones(const QList<QRectF> &zones)
+{
+    QMutexLocker locker(&m_configMutex);
+    m_zones = zones;
+}
+
+void IMX6CameraMotionDetector::setSensitivity(int threshold)
+{
+    QMutexLocker locker(&m_configMutex);
+    m_sensitivity = qBound(0, threshold, 255);
+}
+
+void IMX6CameraMotionDetector::setMinimumArea(qreal fraction)
+{
+    QMutexLocker locker(&m_configMutex);
+    m_minimumArea = qBound<qreal>(0, fraction, 1);
+}
+
+// Averages 4 rows of 16 luma samples per cell into m_current
+bool IMX6CameraMotionDetector::downsample(const IMX6CameraFrame &frame)
+{
+    int offset, step;
+    if (!frame.lumaLayout(&offset, &step))
+        return false;
+
+    const int columns = frame.size.width() / MOTION_CELL_SIZE;
+    const int rows = frame.size.height() / MOTION_CELL_SIZE;
+    const BufferPlane &plane = frame.plane(0);
+    if (!columns || !rows || !plane.data)
+        return false;
+
+    if (columns != m_columns || rows != m_rows) {
+        m_columns = columns;
+        m_rows = rows;
+        m_current.resize(columns * rows);
+        m_mask.resize(columns * rows);
+        m_background.clear();
+    }
+
+    uchar *out = m_current.data();
+    for (int row = 0; row < rows; ++row) {
+        const uchar *cell = plane.data + row * MOTION_CELL_SIZE * plane.bytesPerLine + offset;
+        for (int column = 0; column < columns; ++column) {
+            const uchar *line = cell + column * MOTION_CELL_SIZE * step + 2 * plane.bytesPerLine;
+            uint sum = 0;
+            for (int i = 0; i < 4; ++i)
+                sum += imx6SumLuma16(line + i * 4 * plane.bytesPerLine, step, offset);
+            *out++ = sum >> 6;
+        }
+    }
+    return true;
+}
+
+void IMX6CameraMotionDetector::resetBackground()
+{
+    const int count = m_current.size();
+    m_background.resize(count);
+    m_background8 = m_current;
+    for (int i = 0; i < count; ++i)
+        m_background[i] = m_current[i] << 8;
+    m_motionFrames = 0;
+    m_quietFrames = 0;
+}
+
+void IMX6CameraMotionDetector::process(const IMX6CameraFrame &frame)
+{
+    if (!downsample(frame))
+        return;
+    if (m_background.size() != m_current.size()) {
+        resetBackground();
+        return;
+    }
+
+    m_configMutex.lock();
+    QList<QRectF> zones = m_zones;
+    const int sensitivity = m_sensitivity;
+    const qreal minimumArea = m_minimumArea;
+    m_configMutex.unlock();
+    if (zones.isEmpty())
+        zones.append(QRectF(0, 0, 1, 1));
+
+    const int count = m_current.size();
+    const int changed = imx6AbsDiffThreshold(m_current.constData(), m_background8.constData(),
+                                             m_mask.data(), count, sensitivity);
+    for (int i = 0; i < count; ++i) {
+        const int delta = (int(m_current[i]) << 8) - m_background[i];
+        m_background[i] += delta / (1 << MOTION_LEARNING_SHIFT);
+        m_background8[i] = m_background[i] >> 8;
+    }
+
+    QVariantList activeZones;
+    int left = m_columns, top = m_rows, right = -1, bottom = -1;
+    for (int zone = 0; changed && zone < zones.size(); ++zone) {
+        const QRectF &rect = zones.at(zone);
+        const int zoneLeft = qBound(0, qFloor(rect.left() * m_columns), m_columns);
+        const int zoneRight = qBound(0, qCeil(rect.right() * m_columns), m_columns);
+        const int zoneTop = qBound(0, qFloor(rect.top() * m_rows), m_rows);
+        const int zoneBottom = qBound(0, qCeil(rect.bottom() * m_rows), m_rows);
+        const int area = (zoneRight - zoneLeft) * (zoneBottom - zoneTop);
+        if (area <= 0)
+            continue;
+
+        // Only zones that trigger add their changed cells to the bounding box
+        int zoneChanged = 0;
+        int zoneChangedLeft = zoneRight, zoneChangedTop = zoneBottom, zoneChangedRight = -1, zoneChangedBottom = -1;
+        for (int y = zoneTop; y < zoneBottom; ++y) {
+            const uchar *mask = m_mask.constData() + y * m_columns;
+            for (int x = zoneLeft; x < zoneRight; ++x) {
+                if (!mask[x])
+                    continue;
+                ++zoneChanged;
+                zoneChangedLeft = qMin(zoneChangedLeft, x);
+                zoneChangedRight = qMax(zoneChangedRight, x);
+                zoneChangedTop = qMin(zoneChangedTop, y);
+                zoneChangedBottom = qMax(zoneChangedBottom, y);
+            }
+        }
+        if (zoneChanged >= qMax(1, qCeil(minimumArea * area))) {
+            activeZones.append(zone);
+            left = qMin(left, zoneChangedLeft);
+            right = qMax(right, zoneChangedRight);
+            top = qMin(top, zoneChangedTop);
+            bottom = qMax(bottom, zoneChangedBottom);
+        }
+    }
+
+    if (activeZones.isEmpty()) {
+        ++m_quietFrames;
+        m_motionFrames = 0;
+    } else {
+        ++m_motionFrames;
+        m_quietFrames = 0;
+    }
+    const bool motion = m_motion ? m_quietFrames < MOTION_STOP_FRAMES : m_motionFrames >= MOTION_START_FRAMES;
+
+    QRectF boundingBox;
+    if (!activeZones.isEmpty()) {
+        boundingBox = QRectF(qreal(left) / m_columns, qreal(top) / m_rows,
+                             qreal(right - left + 1) / m_columns, qreal(bottom - top + 1) / m_rows);
+    }
+
+    if (motion == m_motion && (!motion || activeZones.isEmpty()
+                               || (boundingBox == m_boundingBox && activeZones == m_activeZones))) {
+        return;
+    }
+    m_motion = motion;
+    if (!activeZones.isEmpty() || !motion) {
+        m_boundingBox = boundingBox;
+        m_activeZones = activeZones;
+    }
+    emit motionUpdated(m_motion, m_boundingBox, m_activeZones);
+}
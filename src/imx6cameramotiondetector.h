@@ -0,0 +1,88 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERAMOTIONDETECTOR_H
+#define IMX6CAMERAMOTIONDETECTOR_H
+
+#include <QList>
+#include <QRectF>
+#include <QVariantList>
+#include <QVector>
+#include "imx6cameraprocessingstage.h"
+
+// Detects motion against a running-average background of the luma plane,
+// kept at one cell per 16x16 pixels.
+class IMX6CameraMotionDetector : public IMX6CameraProcessingStage
+{
+    Q_OBJECT
+public:
+    explicit IMX6CameraMotionDetector(QObject *parent = 0);
+    ~IMX6CameraMotionDetector();
+
+    // Zones are in normalized frame coordinates, none watches the whole frame
+    void setZones(const QList<QRectF> &zones);
+    // Luma difference from the background that counts as change
+    void setSensitivity(int threshold);
+    // Share of a zone that has to change before it reports motion
+    void setMinimumArea(qreal fraction);
+
+Q_SIGNALS:
+    // Emitted on the worker thread when motion starts, stops or moves.
+    // zones holds the indices of the zones that see motion.
+    void motionUpdated(bool motion, const QRectF &boundingBox, const QVariantList &zones);
+
+protected:
+    void process(const IMX6CameraFrame &frame);
+
+private:
+    bool downsample(const IMX6CameraFrame &frame);
+    void resetBackground();
+
+    QMutex m_configMutex;
+    QList<QRectF> m_zones;
+    int m_sensitivity;
+    qreal m_minimumArea;
+
+    // Used by the worker thread only
+    int m_columns;
+    int m_rows;
+    QVector<uchar> m_current;
+    QVector<quint16> m_background;  // 8.8 fixed point
+    QVector<uchar> m_background8;
+    QVector<uchar> m_mask;
+    bool m_motion;
+    int m_motionFrames;
+    int m_quietFrames;
+    QRectF m_boundingBox;
+    QVariantList m_activeZones;
+};
+
+#endif // IMX6CAMERAMOTIONDETECTOR_H
@@ -0,0 +1,566 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6camerapreeventbuffer.h"
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutexLocker>
+#include <QtMath>
+
+#include <linux/videodev2.h>
+#include <cstring>
+
+// Extra second of slots, so capture can go on while the writer drains a clip
+#define PRE_EVENT_WRITER_HEADROOM 1.0
+
+static quint32 v4l2FourCC(IMX6CameraFrame::PixelFormat format)
+{
+    switch (format) {
+    case IMX6CameraFrame::Format_UYVY:
+        return V4L2_PIX_FMT_UYVY;
+    case IMX6CameraFrame::Format_YUYV:
+        return V4L2_PIX_FMT_YUYV;
+    case IMX6CameraFrame::Format_YUV444:
+        return V4L2_PIX_FMT_YUV444;
+    case IMX6CameraFrame::Format_YUV420P:
+        return V4L2_PIX_FMT_YUV420;
+    case IMX6CameraFrame::Format_YV12:
+        return V4L2_PIX_FMT_YVU420;
+    case IMX6CameraFrame::Format_NV12:
+        return V4L2_PIX_FMT_NV12;
+    case IMX6CameraFrame::Format_NV21:
+        return V4L2_PIX_FMT_NV21;
+    default:
+        break;
+    }
+    return 0;
+}
+
+// Offset of the first luma sample in packed formats, -1 when luma is a plane of its own
+static int packedLumaOffset(IMX6CameraFrame::PixelFormat format)
+{
+    switch (format) {
+    case IMX6CameraFrame::Format_UYVY:
+        return 1;
+    case IMX6CameraFrame::Format_YUYV:
+        return 0;
+    default:
+        break;
+    }
+    return -1;
+}
+
+static bool hasLumaPlane(IMX6CameraFrame::PixelFormat format)
+{
+    switch (format) {
+    case IMX6CameraFrame::Format_YUV420P:
+    case IMX6CameraFrame::Format_YV12:
+    case IMX6CameraFrame::Format_NV12:
+    case IMX6CameraFrame::Format_NV21:
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+IMX6CameraPreEventWriter::IMX6CameraPreEventWriter(IMX6CameraPreEventBuffer *buffer)
+    : mBuffer(buffer)
+{
+}
+
+void IMX6CameraPreEventWriter::open(const QString &fileName)
+{
+    Job job = { Job::Open, -1, fileName };
+    enqueue(job);
+}
+
+void IMX6CameraPreEventWriter::write(int slot)
+{
+    Job job = { Job::Write, slot, QString() };
+    enqueue(job);
+}
+
+void IMX6CameraPreEventWriter::close()
+{
+    Job job = { Job::Close, -1, QString() };
+    enqueue(job);
+}
+
+void IMX6CameraPreEventWriter::stop()
+{
+    Job job = { Job::Quit, -1, QString() };
+    enqueue(job);
+}
+
+void IMX6CameraPreEventWriter::enqueue(const Job &job)
+{
+    QMutexLocker locker(&mMutex);
+    mJobs.enqueue(job);
+    mCondition.wakeOne();
+}
+
+void IMX6CameraPreEventWriter::run()
+{
+    QFile file;
+    int frameCount = 0;
+    bool ok = false;
+
+    forever {
+        mMutex.lock();
+        while (mJobs.isEmpty())
+            mCondition.wait(&mMutex);
+        const Job job = mJobs.dequeue();
+        mMutex.unlock();
+
+        switch (job.type) {
+        case Job::Open:
+            file.setFileName(job.fileName);
+            ok = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+            if (!ok)
+                qWarning("Could not open %s for the pre-event clip.", qPrintable(job.fileName));
+            frameCount = 0;
+            break;
+        case Job::Write: {
+            // Pinned slots are left alone by capture until they are unpinned
+            const IMX6CameraPreEventBuffer::Slot &slot = mBuffer->m_slots.at(job.slot);
+            if (ok) {
+                ok = file.write(reinterpret_cast<const char *>(&slot.record), sizeof(slot.record)) == sizeof(slot.record)
+                        && file.write(reinterpret_cast<const char *>(slot.data), slot.record.length) == slot.record.length;
+                if (ok)
+                    ++frameCount;
+                else
+                    qWarning("Could not write the pre-event clip %s.", qPrintable(file.fileName()));
+            }
+            mBuffer->unpin(job.slot);
+            break;
+        }
+        case Job::Close:
+            file.close();
+            QMetaObject::invokeMethod(mBuffer, "finishClip", Qt::QueuedConnection,
+                                      Q_ARG(QString, file.fileName()), Q_ARG(int, frameCount), Q_ARG(bool, ok));
+            break;
+        case Job::Quit:
+            return;
+        }
+    }
+}
+
+IMX6CameraPreEventBuffer::IMX6CameraPreEventBuffer(QObject *parent)
+    : QObject(parent)
+    , m_cameraControl(NULL)
+    , m_sessionId(0)
+    , m_active(false)
+    , m_mode(Raw)
+    , m_duration(5)
+    , m_postDuration(5)
+    , m_frameRate(30)
+    , m_arena(0)
+    , m_slotSize(0)
+    , m_arenaFormat(IMX6CameraFrame::Format_Invalid)
+    , m_head(0)
+    , m_count(0)
+    , m_recording(false)
+    , m_recordUntil(0)
+    , m_droppedFrames(0)
+    , m_copyTime(0)
+    , m_pinnedCount(0)
+    , m_writer(new IMX6CameraPreEventWriter(this))
+{
+    m_cameraControl = IMX6CameraControl::cameraControl(&m_sessionId);
+    m_writer->start(QThread::LowPriority);
+}
+
+IMX6CameraPreEventBuffer::~IMX6CameraPreEventBuffer()
+{
+    setActive(false);
+    m_writer->stop();
+    m_writer->wait();
+    delete m_writer;
+    release();
+}
+
+bool IMX6CameraPreEventBuffer::active() const
+{
+    return m_active;
+}
+
+void IMX6CameraPreEventBuffer::setActive(bool value)
+{
+    if (m_active == value)
+        return;
+
+    m_active = value;
+    if (m_active) {
+        connect(m_cameraControl, &IMX6CameraControl::frameReady, this, &IMX6CameraPreEventBuffer::storeFrame);
+        QMetaObject::invokeMethod(m_cameraControl, "startCamera", Qt::QueuedConnection, Q_ARG(uint, m_sessionId));
+    } else {
+        disconnect(m_cameraControl, &IMX6CameraControl::frameReady, this, &IMX6CameraPreEventBuffer::storeFrame);
+        m_cameraControl->stopCameraStream(m_sessionId);
+        if (m_recording) {
+            m_recording = false;
+            m_writer->close();
+            emit recordingChanged(false);
+        }
+        release();
+    }
+    emit activeChanged(m_active);
+}
+
+IMX6CameraPreEventBuffer::Mode IMX6CameraPreEventBuffer::mode() const
+{
+    return m_mode;
+}
+
+void IMX6CameraPreEventBuffer::setMode(Mode value)
+{
+    if (m_mode == value)
+        return;
+
+    m_mode = value;
+    release();
+    emit modeChanged(m_mode);
+}
+
+qreal IMX6CameraPreEventBuffer::duration() const
+{
+    return m_duration;
+}
+
+void IMX6CameraPreEventBuffer::setDuration(qreal seconds)
+{
+    seconds = qMax<qreal>(0, seconds);
+    if (qFuzzyCompare(m_duration, seconds))
+        return;
+
+    m_duration = seconds;
+    release();
+    emit durationChanged(m_duration);
+}
+
+qreal IMX6CameraPreEventBuffer::postDuration() const
+{
+    return m_postDuration;
+}
+
+void IMX6CameraPreEventBuffer::setPostDuration(qreal seconds)
+{
+    seconds = qMax<qreal>(0, seconds);
+    if (qFuzzyCompare(m_postDuration, seconds))
+        return;
+
+    m_postDuration = seconds;
+    emit postDurationChanged(m_postDuration);
+}
+
+qreal IMX6CameraPreEventBuffer::frameRate() const
+{
+    return m_frameRate;
+}
+
+void IMX6CameraPreEventBuffer::setFrameRate(qreal value)
+{
+    if (value <= 0) {
+        qWarning("The pre-event frame rate has to be positive, got %f.", value);
+        return;
+    }
+    if (qFuzzyCompare(m_frameRate, value))
+        return;
+
+    m_frameRate = value;
+    release();
+    emit frameRateChanged(m_frameRate);
+}
+
+QString IMX6CameraPreEventBuffer::outputDirectory() const
+{
+    return m_outputDirectory;
+}
+
+void IMX6CameraPreEventBuffer::setOutputDirectory(const QString &path)
+{
+    if (m_outputDirectory == path)
+        return;
+
+    m_outputDirectory = path;
+    emit outputDirectoryChanged(m_outputDirectory);
+}
+
+bool IMX6CameraPreEventBuffer::recording() const
+{
+    return m_recording;
+}
+
+int IMX6CameraPreEventBuffer::bufferedFrames() const
+{
+    return m_count;
+}
+
+int IMX6CameraPreEventBuffer::droppedFrames() const
+{
+    return m_droppedFrames;
+}
+
+qreal IMX6CameraPreEventBuffer::copyTime() const
+{
+    return m_copyTime;
+}
+
+qint64 IMX6CameraPreEventBuffer::memoryUsage() const
+{
+    return qint64(m_slotSize) * m_slots.size();
+}
+
+void IMX6CameraPreEventBuffer::trigger()
+{
+    if (!m_active || !m_count) {
+        qWarning("Pre-event trigger ignored, no frames are buffered.");
+        return;
+    }
+
+    const int slotCount = m_slots.size();
+    const qint64 newest = m_slots.at((m_head + slotCount - 1) % slotCount).record.timestamp;
+    if (m_recording) {
+        // Another event during the clip extends it
+        m_recordUntil = newest + qint64(m_postDuration * 1000000);
+        return;
+    }
+
+    const QString fileName = QDir(m_outputDirectory).filePath(QStringLiteral("event-%1.raw")
+            .arg(QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmss-zzz"))));
+    m_writer->open(fileName);
+
+    const qint64 oldest = newest - qint64(m_duration * 1000000);
+    for (int i = 0; i < m_count; ++i) {
+        const int slot = (m_head + slotCount - m_count + i) % slotCount;
+        if (m_slots.at(slot).record.timestamp < oldest)
+            continue;
+        pin(slot);
+        m_writer->write(slot);
+    }
+
+    if (m_postDuration > 0) {
+        m_recordUntil = newest + qint64(m_postDuration * 1000000);
+        m_recording = true;
+        emit recordingChanged(true);
+    } else {
+        m_writer->close();
+    }
+}
+
+void IMX6CameraPreEventBuffer::storeFrame(const IMX6CameraFrame &frame)
+{
+    if (!frame.isValid())
+        return;
+
+    if (!m_arena || frame.size != m_arenaFrameSize || frame.format != m_arenaFormat) {
+        if (!allocate(frame)) {
+            ++m_droppedFrames;
+            emit statisticsChanged();
+            return;
+        }
+    }
+
+    m_mutex.lock();
+    Slot &slot = m_slots[m_head];
+    const bool pinned = slot.pinned;
+    m_mutex.unlock();
+    if (pinned) {
+        // The writer fell behind by more than the whole ring
+        ++m_droppedFrames;
+        emit statisticsChanged();
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const size_t length = copyFrame(frame, slot.data);
+    const qreal elapsed = timer.nsecsElapsed() / 1000.0;
+    m_copyTime = m_copyTime > 0 ? m_copyTime * 0.95 + elapsed * 0.05 : elapsed;
+
+    const bool lumaOnly = m_mode == LumaOnly
+            && (hasLumaPlane(frame.format) || packedLumaOffset(frame.format) >= 0);
+    slot.record.magic = IMX6_CAMERA_PRE_EVENT_MAGIC;
+    slot.record.fourcc = lumaOnly ? V4L2_PIX_FMT_GREY : v4l2FourCC(frame.format);
+    slot.record.width = frame.size.width();
+    slot.record.height = frame.size.height();
+    slot.record.sequence = frame.sequence;
+    slot.record.length = length;
+    slot.record.timestamp = frame.timestamp;
+
+    const int index = m_head;
+    m_head = (m_head + 1) % m_slots.size();
+    m_count = qMin(m_count + 1, m_slots.size());
+
+    if (m_recording) {
+        if (frame.timestamp <= m_recordUntil) {
+            pin(index);
+            m_writer->write(index);
+        }
+        if (frame.timestamp >= m_recordUntil) {
+            m_recording = false;
+            m_writer->close();
+            emit recordingChanged(false);
+        }
+    }
+    emit statisticsChanged();
+}
+
+void IMX6CameraPreEventBuffer::finishClip(const QString &fileName, int frameCount, bool ok)
+{
+    if (ok)
+        emit clipSaved(fileName, frameCount);
+    else
+        emit error(QStringLiteral("Could not write %1").arg(fileName));
+
+    if (!m_active)
+        release();
+}
+
+bool IMX6CameraPreEventBuffer::allocate(const IMX6CameraFrame &frame)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_recording || m_pinnedCount) {
+        // The writer still reads from the arena
+        return false;
+    }
+
+    const size_t slotSize = payloadSize(frame);
+    const int slotCount = qMax(1, qCeil((m_duration + PRE_EVENT_WRITER_HEADROOM) * m_frameRate));
+    if (!m_arena || slotSize != m_slotSize || slotCount != m_slots.size()) {
+        qFreeAligned(m_arena);
+        m_arena = static_cast<uchar *>(qMallocAligned(slotSize * slotCount, 64));
+        if (!m_arena) {
+            qCritical("Could not allocate %d pre-event frames of %zu bytes.", slotCount, slotSize);
+            m_slotSize = 0;
+            m_slots.clear();
+            return false;
+        }
+        m_slotSize = slotSize;
+        m_slots.resize(slotCount);
+        for (int i = 0; i < slotCount; ++i) {
+            m_slots[i].data = m_arena + i * slotSize;
+            m_slots[i].pinned = false;
+            memset(&m_slots[i].record, 0, sizeof(m_slots[i].record));
+        }
+    }
+
+    m_arenaFrameSize = frame.size;
+    m_arenaFormat = frame.format;
+    m_head = 0;
+    m_count = 0;
+    return true;
+}
+
+void IMX6CameraPreEventBuffer::release()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_recording || m_pinnedCount) {
+        // Reallocated with the next frame once the writer is done
+        m_arenaFormat = IMX6CameraFrame::Format_Invalid;
+        return;
+    }
+
+    qFreeAligned(m_arena);
+    m_arena = 0;
+    m_slotSize = 0;
+    m_slots.clear();
+    m_arenaFormat = IMX6CameraFrame::Format_Invalid;
+    m_head = 0;
+    m_count = 0;
+}
+
+size_t IMX6CameraPreEventBuffer::payloadSize(const IMX6CameraFrame &frame) const
+{
+    if (m_mode == LumaOnly && (hasLumaPlane(frame.format) || packedLumaOffset(frame.format) >= 0))
+        return size_t(frame.size.width()) * frame.size.height();
+
+    size_t size = 0;
+    for (int plane = 0; plane < frame.planeCount(); ++plane) {
+        size += size_t(frame.planeWidthBytes(plane)) * frame.planeHeight(plane);
+    }
+    return size;
+}
+
+// Copies the visible part of the frame without row padding, returns the bytes written
+size_t IMX6CameraPreEventBuffer::copyFrame(const IMX6CameraFrame &frame, uchar *destination) const
+{
+    uchar *out = destination;
+    const int lumaOffset = packedLumaOffset(frame.format);
+    if (m_mode == LumaOnly && lumaOffset >= 0) {
+        const BufferPlane &plane = frame.plane(0);
+        const int width = frame.size.width();
+        for (int y = 0; y < frame.size.height(); ++y) {
+            const uchar *in = plane.data + y * plane.bytesPerLine + lumaOffset;
+            for (int x = 0; x < width; ++x)
+                out[x] = in[x * 2];
+            out += width;
+        }
+        return out - destination;
+    }
+
+    const int planeCount = m_mode == LumaOnly && hasLumaPlane(frame.format) ? 1 : frame.planeCount();
+    for (int i = 0; i < planeCount; ++i) {
+        const BufferPlane &plane = frame.plane(i);
+        const int rowBytes = frame.planeWidthBytes(i);
+        const int rows = frame.planeHeight(i);
+        if (rowBytes == plane.bytesPerLine) {
+            memcpy(out, plane.data, size_t(rowBytes) * rows);
+            out += size_t(rowBytes) * rows;
+            continue;
+        }
+        for (int y = 0; y < rows; ++y) {
+            memcpy(out, plane.data + y * plane.bytesPerLine, rowBytes);
+            out += rowBytes;
+        }
+    }
+    return out - destination;
+}
+
+void IMX6CameraPreEventBuffer::pin(int slot)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_slots[slot].pinned) {
+        m_slots[slot].pinned = true;
+        ++m_pinnedCount;
+    }
+}
+
+void IMX6CameraPreEventBuffer::unpin(int slot)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_slots[slot].pinned) {
+        m_slots[slot].pinned = false;
+        --m_pinnedCount;
+    }
+}
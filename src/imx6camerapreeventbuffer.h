@@ -0,0 +1,197 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERAPREEVENTBUFFER_H
+#define IMX6CAMERAPREEVENTBUFFER_H
+
+#include <QMutex>
+#include <QObject>
+#include <QQueue>
+#include <QSize>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include "imx6cameracontrol.h"
+
+// Header in front of every frame of a clip written by IMX6CameraPreEventBuffer.
+// The planes follow tightly packed, without the driver's row padding.
+struct IMX6CameraPreEventRecord {
+    quint32 magic;      // IMX6_CAMERA_PRE_EVENT_MAGIC
+    quint32 fourcc;     // V4L2 pixel format of the payload, GREY in LumaOnly mode
+    quint32 width;
+    quint32 height;
+    quint32 sequence;   // IMX6CameraFrame::sequence
+    quint32 length;     // Payload bytes following this header
+    qint64 timestamp;   // Capture time in microseconds
+};
+
+#define IMX6_CAMERA_PRE_EVENT_MAGIC 0x31564550 // "PEV1"
+
+class IMX6CameraPreEventBuffer;
+
+// Writes the frames of a triggered clip, so the disk never stalls capture
+class IMX6CameraPreEventWriter : public QThread
+{
+public:
+    explicit IMX6CameraPreEventWriter(IMX6CameraPreEventBuffer *buffer);
+
+    void open(const QString &fileName);
+    void write(int slot);
+    void close();
+    void stop();
+
+protected:
+    void run();
+
+private:
+    struct Job {
+        enum Type { Open, Write, Close, Quit };
+        Type type;
+        int slot;
+        QString fileName;
+    };
+    void enqueue(const Job &job);
+
+    IMX6CameraPreEventBuffer *mBuffer;
+    QMutex mMutex;
+    QWaitCondition mCondition;
+    QQueue<Job> mJobs;
+};
+
+// Keeps copies of the last seconds of frames in memory. When triggered, those
+// frames and the ones of the following seconds are written to disk.
+class IMX6CameraPreEventBuffer : public QObject
+{
+    Q_OBJECT
+    Q_ENUMS(Mode)
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(Mode mode READ mode WRITE setMode NOTIFY modeChanged)
+    Q_PROPERTY(qreal duration READ duration WRITE setDuration NOTIFY durationChanged)
+    Q_PROPERTY(qreal postDuration READ postDuration WRITE setPostDuration NOTIFY postDurationChanged)
+    Q_PROPERTY(qreal frameRate READ frameRate WRITE setFrameRate NOTIFY frameRateChanged)
+    Q_PROPERTY(QString outputDirectory READ outputDirectory WRITE setOutputDirectory NOTIFY outputDirectoryChanged)
+    Q_PROPERTY(bool recording READ recording NOTIFY recordingChanged)
+    Q_PROPERTY(int bufferedFrames READ bufferedFrames NOTIFY statisticsChanged)
+    Q_PROPERTY(int droppedFrames READ droppedFrames NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal copyTime READ copyTime NOTIFY statisticsChanged)
+    Q_PROPERTY(qint64 memoryUsage READ memoryUsage NOTIFY statisticsChanged)
+
+public:
+    enum Mode {
+        Raw,        // The frame as captured
+        LumaOnly    // Only the luma plane, a third to a half of the size
+    };
+
+    explicit IMX6CameraPreEventBuffer(QObject *parent = 0);
+    ~IMX6CameraPreEventBuffer();
+
+    bool active() const;
+    Mode mode() const;
+    qreal duration() const;
+    qreal postDuration() const;
+    qreal frameRate() const;
+    QString outputDirectory() const;
+    bool recording() const;
+    int bufferedFrames() const;
+    int droppedFrames() const;
+    qreal copyTime() const;
+    qint64 memoryUsage() const;
+
+public Q_SLOTS:
+    void setActive(bool value);
+    void setMode(Mode value);
+    void setDuration(qreal seconds);
+    void setPostDuration(qreal seconds);
+    void setFrameRate(qreal value);
+    void setOutputDirectory(const QString &path);
+    void trigger();
+
+Q_SIGNALS:
+    void activeChanged(bool);
+    void modeChanged(Mode);
+    void durationChanged(qreal);
+    void postDurationChanged(qreal);
+    void frameRateChanged(qreal);
+    void outputDirectoryChanged(const QString &);
+    void recordingChanged(bool);
+    void statisticsChanged();
+    void clipSaved(const QString &fileName, int frameCount);
+    void error(const QString &message);
+
+private Q_SLOTS:
+    void storeFrame(const IMX6CameraFrame &frame);
+    void finishClip(const QString &fileName, int frameCount, bool ok);
+
+private:
+    friend class IMX6CameraPreEventWriter;
+
+    struct Slot {
+        uchar *data;
+        IMX6CameraPreEventRecord record;
+        bool pinned;    // Queued for writing, capture must not overwrite it
+    };
+
+    bool allocate(const IMX6CameraFrame &frame);
+    void release();
+    size_t copyFrame(const IMX6CameraFrame &frame, uchar *destination) const;
+    size_t payloadSize(const IMX6CameraFrame &frame) const;
+    void pin(int slot);
+    void unpin(int slot);
+
+    IMX6CameraControl *m_cameraControl;
+    int m_sessionId;
+    bool m_active;
+    Mode m_mode;
+    qreal m_duration;
+    qreal m_postDuration;
+    qreal m_frameRate;
+    QString m_outputDirectory;
+
+    // The arena is allocated once for the current format and slot count
+    uchar *m_arena;
+    size_t m_slotSize;
+    QSize m_arenaFrameSize;
+    IMX6CameraFrame::PixelFormat m_arenaFormat;
+    QVector<Slot> m_slots;
+    int m_head;
+    int m_count;
+
+    bool m_recording;
+    qint64 m_recordUntil;   // Timestamp of the last post-event frame
+    int m_droppedFrames;
+    qreal m_copyTime;       // Running average in microseconds
+
+    QMutex m_mutex;         // Guards the pinned flags, shared with the writer
+    int m_pinnedCount;
+    IMX6CameraPreEventWriter *m_writer;
+};
+
+#endif // IMX6CAMERAPREEVENTBUFFER_H
@@ -0,0 +1,183 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameraprocessingstage.h"
+#include <QMutexLocker>
+
+void IMX6CameraStageThread::run()
+{
+    mStage->run();
+}
+
+IMX6CameraProcessingStage::IMX6CameraProcessingStage(QObject *parent)
+    : QObject(parent)
+    , m_control(NULL)
+    , m_thread(this)
+    , m_stopping(false)
+    , m_frameDivisor(1)
+    , m_divisorCount(0)
+    , m_windowBusy(0)
+    , m_windowFrames(0)
+    , m_processingTime(0)
+    , m_load(0)
+    , m_processedFrames(0)
+    , m_skippedFrames(0)
+{
+}
+
+IMX6CameraProcessingStage::~IMX6CameraProcessingStage()
+{
+    Q_ASSERT_X(!m_thread.isRunning(), Q_FUNC_INFO, "Subclasses have to detach in their destructor");
+    detach();
+}
+
+void IMX6CameraProcessingStage::attach(IMX6CameraControl *control)
+{
+    if (m_control == control)
+        return;
+    detach();
+
+    m_control = control;
+    if (!m_control)
+        return;
+
+    m_stopping = false;
+    m_window.start();
+    m_profile = m_control->processingProfile();
+    m_thread.start(QThread::LowPriority);
+    // Delivered on the capture thread, the worker is only woken up
+    connect(m_control, &IMX6CameraControl::frameReady, this, &IMX6CameraProcessingStage::submit, Qt::DirectConnection);
+}
+
+void IMX6CameraProcessingStage::detach()
+{
+    if (!m_control)
+        return;
+
+    disconnect(m_control, &IMX6CameraControl::frameReady, this, &IMX6CameraProcessingStage::submit);
+    m_control = NULL;
+
+    m_mutex.lock();
+    m_stopping = true;
+    m_pending = IMX6CameraFrame();
+    m_condition.wakeOne();
+    m_mutex.unlock();
+    m_thread.wait();
+}
+
+bool IMX6CameraProcessingStage::isAttached() const
+{
+    return m_control != NULL;
+}
+
+void IMX6CameraProcessingStage::submit(const IMX6CameraFrame &frame)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_stopping)
+        return;
+    if (m_frameDivisor > 1 && ++m_divisorCount % m_frameDivisor)
+        return;
+    if (m_pending.isValid())
+        ++m_skippedFrames;
+    m_pending = frame; // The replaced frame goes back to the driver
+    m_condition.wakeOne();
+}
+
+void IMX6CameraProcessingStage::setFrameDivisor(int divisor)
+{
+    QMutexLocker locker(&m_mutex);
+    m_frameDivisor = qMax(1, divisor);
+    m_divisorCount = 0;
+}
+
+void IMX6CameraProcessingStage::run()
+{
+    m_profile.applyToCurrentThread("processing");
+    QElapsedTimer timer;
+    forever {
+        m_mutex.lock();
+        while (!m_pending.isValid() && !m_stopping)
+            m_condition.wait(&m_mutex);
+        if (m_stopping) {
+            m_mutex.unlock();
+            return;
+        }
+        IMX6CameraFrame frame = m_pending;
+        m_pending = IMX6CameraFrame();
+        m_mutex.unlock();
+
+        timer.start();
+        process(frame);
+        const qint64 busy = timer.nsecsElapsed();
+        frame = IMX6CameraFrame();
+
+        m_mutex.lock();
+        ++m_processedFrames;
+        ++m_windowFrames;
+        m_windowBusy += busy;
+        const qint64 elapsed = m_window.nsecsElapsed();
+        const bool windowDone = elapsed >= 1000000000;
+        if (windowDone) {
+            m_processingTime = m_windowBusy / 1000.0 / m_windowFrames;
+            m_load = qreal(m_windowBusy) / elapsed;
+            m_windowBusy = 0;
+            m_windowFrames = 0;
+            m_window.restart();
+        }
+        m_mutex.unlock();
+        if (windowDone)
+            emit statisticsChanged();
+    }
+}
+
+qreal IMX6CameraProcessingStage::processingTime() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_processingTime;
+}
+
+qreal IMX6CameraProcessingStage::load() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_load;
+}
+
+int IMX6CameraProcessingStage::processedFrames() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_processedFrames;
+}
+
+int IMX6CameraProcessingStage::skippedFrames() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_skippedFrames;
+}
@@ -0,0 +1,115 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERAPROCESSINGSTAGE_H
+#define IMX6CAMERAPROCESSINGSTAGE_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QObject>
+#include <QThread>
+#include <QWaitCondition>
+#include "imx6cameracontrol.h"
+
+class IMX6CameraProcessingStage;
+
+class IMX6CameraStageThread : public QThread
+{
+public:
+    explicit IMX6CameraStageThread(IMX6CameraProcessingStage *stage) : mStage(stage) {}
+
+protected:
+    void run();
+
+private:
+    IMX6CameraProcessingStage *mStage;
+};
+
+// Base for analysis that runs on every frame, on a worker thread of its own.
+// Frames arriving while the worker is busy replace the one waiting, so a slow
+// stage sees fewer frames but never holds more than two driver buffers.
+//
+// Subclasses implement process() and have to call detach() in their
+// destructor, before their own members go away.
+class IMX6CameraProcessingStage : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IMX6CameraProcessingStage(QObject *parent = 0);
+    ~IMX6CameraProcessingStage();
+
+    void attach(IMX6CameraControl *control);
+    void detach();
+    bool isAttached() const;
+
+    // Averages over the last second of processing
+    qreal processingTime() const;   // Microseconds per frame
+    qreal load() const;             // Share of one core
+    int processedFrames() const;
+    int skippedFrames() const;
+
+    // Only every divisor-th submitted frame is processed, to take load off
+    void setFrameDivisor(int divisor);
+
+public Q_SLOTS:
+    void submit(const IMX6CameraFrame &frame);
+
+Q_SIGNALS:
+    void statisticsChanged();
+
+protected:
+    // Called on the worker thread
+    virtual void process(const IMX6CameraFrame &frame) = 0;
+
+private:
+    friend class IMX6CameraStageThread;
+    void run();
+
+    IMX6CameraControl *m_control;
+    IMX6CameraSchedulingProfile m_profile;  // The control's processing profile, applied by the worker
+    IMX6CameraStageThread m_thread;
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    IMX6CameraFrame m_pending;
+    bool m_stopping;
+    int m_frameDivisor;
+    quint32 m_divisorCount;
+
+    QElapsedTimer m_window;
+    qint64 m_windowBusy;    // Nanoseconds spent in process() in the current window
+    int m_windowFrames;
+    qreal m_processingTime;
+    qreal m_load;
+    int m_processedFrames;
+    int m_skippedFrames;
+};
+
+#endif // IMX6CAMERAPROCESSINGSTAGE_H
@@ -0,0 +1,148 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameraqualitygovernor.h"
+#include "imx6cameracontrol.h"
+#include <QQuickWindow>
+#include <QScreen>
+
+IMX6CameraQualityGovernor::IMX6CameraQualityGovernor(IMX6CameraControl *control, QObject *parent)
+    : QObject(parent)
+    , m_control(control)
+    , m_level(FullQuality)
+    , m_overloadedWindows(0)
+    , m_quietWindows(0)
+    , m_stepUpWindows(GOVERNOR_STEP_UP_WINDOWS)
+    , m_sinceStepUp(GOVERNOR_MAX_STEP_UP_WINDOWS)
+    , m_refreshPeriod(1000000 / 60)
+    , m_queueSamples(0)
+    , m_starvedSamples(0)
+{
+    // Sampled on a timer, taking frames would keep the control out of pull mode
+    connect(&m_sampleTimer, &QTimer::timeout, this, &IMX6CameraQualityGovernor::sampleQueue);
+    connect(&m_timer, &QTimer::timeout, this, &IMX6CameraQualityGovernor::evaluate);
+    m_sampleTimer.start(GOVERNOR_SAMPLE_INTERVAL);
+    m_timer.start(GOVERNOR_INTERVAL);
+}
+
+IMX6CameraQualityGovernor::~IMX6CameraQualityGovernor()
+{
+    setWindow(NULL);
+}
+
+void IMX6CameraQualityGovernor::setWindow(QQuickWindow *window)
+{
+    if (m_window == window)
+        return;
+    if (m_window)
+        disconnect(m_window, 0, this, 0);
+    m_window = window;
+    if (!m_window)
+        return;
+
+    const qreal refreshRate = m_window->screen() ? m_window->screen()->refreshRate() : 0;
+    m_refreshPeriod.store(refreshRate > 1 ? int(1000000 / refreshRate) : 1000000 / 60);
+    connect(m_window, &QQuickWindow::beforeSynchronizing, this, &IMX6CameraQualityGovernor::beginFrame, Qt::DirectConnection);
+    connect(m_window, &QQuickWindow::afterRendering, this, &IMX6CameraQualityGovernor::endFrame, Qt::DirectConnection);
+}
+
+IMX6CameraQualityGovernor::Level IMX6CameraQualityGovernor::level() const
+{
+    return m_level;
+}
+
+void IMX6CameraQualityGovernor::beginFrame()
+{
+    m_frameTimer.start();
+}
+
+// Synchronizing and recording the frame, without the swap that waits for vsync
+void IMX6CameraQualityGovernor::endFrame()
+{
+    if (!m_frameTimer.isValid())
+        return;
+    m_frames.ref();
+    if (m_frameTimer.nsecsElapsed() / 1000 > m_refreshPeriod.load())
+        m_lateFrames.ref();
+}
+
+// Buffers out with consumers are buffers the driver cannot capture into
+void IMX6CameraQualityGovernor::sampleQueue()
+{
+    ++m_queueSamples;
+    if (m_control->heldBuffers() >= IMX6CameraControl::bufferCount())
+        ++m_starvedSamples;
+}
+
+void IMX6CameraQualityGovernor::evaluate()
+{
+    const int frames = m_frames.fetchAndStoreRelaxed(0);
+    const int lateFrames = m_lateFrames.fetchAndStoreRelaxed(0);
+    const qreal late = frames ? qreal(lateFrames) / frames : 0;
+    const qreal starved = m_queueSamples ? qreal(m_starvedSamples) / m_queueSamples : 0;
+    m_queueSamples = 0;
+    m_starvedSamples = 0;
+
+    const bool overloaded = late > GOVERNOR_LATE_HIGH || starved > GOVERNOR_STARVED_HIGH;
+    const bool quiet = late < GOVERNOR_LATE_LOW && starved < GOVERNOR_STARVED_LOW;
+    m_sinceStepUp = qMin(m_sinceStepUp + 1, GOVERNOR_MAX_STEP_UP_WINDOWS);
+
+    if (overloaded) {
+        m_quietWindows = 0;
+        if (++m_overloadedWindows < GOVERNOR_STEP_DOWN_WINDOWS || m_level == LowestQuality)
+            return;
+        // Back where it just came from, wait longer before trying again
+        if (m_sinceStepUp < m_stepUpWindows)
+            m_stepUpWindows = qMin(2 * m_stepUpWindows, GOVERNOR_MAX_STEP_UP_WINDOWS);
+        m_overloadedWindows = 0;
+        setLevel(Level(m_level + 1));
+    } else if (quiet) {
+        m_overloadedWindows = 0;
+        if (m_sinceStepUp >= GOVERNOR_MAX_STEP_UP_WINDOWS)
+            m_stepUpWindows = GOVERNOR_STEP_UP_WINDOWS;  // Stable for long, forget the bouncing
+        if (++m_quietWindows < m_stepUpWindows || m_level == FullQuality)
+            return;
+        m_quietWindows = 0;
+        m_sinceStepUp = 0;
+        setLevel(Level(m_level - 1));
+    } else {
+        m_overloadedWindows = 0;
+        m_quietWindows = 0;
+    }
+}
+
+void IMX6CameraQualityGovernor::setLevel(Level level)
+{
+    if (m_level == level)
+        return;
+    m_level = level;
+    emit levelChanged(m_level);
+}
@@ -0,0 +1,111 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERAQUALITYGOVERNOR_H
+#define IMX6CAMERAQUALITYGOVERNOR_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+class IMX6CameraControl;
+class QQuickWindow;
+
+#define GOVERNOR_INTERVAL 500               // Milliseconds per evaluation window
+#define GOVERNOR_SAMPLE_INTERVAL 20         // Milliseconds between looks at the driver queue
+#define GOVERNOR_STEP_DOWN_WINDOWS 2        // Overloaded windows in a row before quality drops
+#define GOVERNOR_STEP_UP_WINDOWS 10         // Quiet windows in a row before it comes back
+#define GOVERNOR_MAX_STEP_UP_WINDOWS 80     // Step up backs off to this when it keeps bouncing
+#define GOVERNOR_LATE_HIGH 0.10             // Share of late frames that is overloaded
+#define GOVERNOR_LATE_LOW 0.02              // Share of late frames that is quiet
+#define GOVERNOR_STARVED_HIGH 0.25          // Share of samples without a buffer to capture into that is overloaded
+#define GOVERNOR_STARVED_LOW 0.02           // Share of such samples that is quiet
+
+// Takes load off a struggling scene graph. Every window it looks at the
+// frames the render thread took longer than a refresh period for, and at how
+// often consumers held every driver buffer, leaving none to capture into.
+// Consumers always hold a few, only running the driver dry drops frames.
+// Overload in either steps quality down a level, a long quiet spell steps it
+// back up. A level that is left again soon after stepping up makes the next
+// step up wait longer.
+class IMX6CameraQualityGovernor : public QObject
+{
+    Q_OBJECT
+public:
+    enum Level {
+        FullQuality,
+        ReducedProcessing,  // Processing stages see every other frame
+        HalfRate,           // and every other frame is delivered
+        QuarterRate,        // or one frame in four
+        LowestQuality = QuarterRate
+    };
+
+    explicit IMX6CameraQualityGovernor(IMX6CameraControl *control, QObject *parent = 0);
+    ~IMX6CameraQualityGovernor();
+
+    void setWindow(QQuickWindow *window);
+    Level level() const;
+
+Q_SIGNALS:
+    void levelChanged(int level);
+
+private Q_SLOTS:
+    void evaluate();
+    void sampleQueue();
+
+private:
+    void setLevel(Level level);
+    void beginFrame();  // Render thread
+    void endFrame();    // Render thread
+
+    IMX6CameraControl *m_control;
+    QPointer<QQuickWindow> m_window;
+    QTimer m_timer;
+    QTimer m_sampleTimer;
+    Level m_level;
+    int m_overloadedWindows;
+    int m_quietWindows;
+    int m_stepUpWindows;
+    int m_sinceStepUp;      // Windows since the last step up
+
+    // Render thread side
+    QElapsedTimer m_frameTimer;
+    QAtomicInt m_refreshPeriod; // Microseconds
+    QAtomicInt m_frames;
+    QAtomicInt m_lateFrames;
+
+    int m_queueSamples;
+    int m_starvedSamples;
+};
+
+#endif // IMX6CAMERAQUALITYGOVERNOR_H
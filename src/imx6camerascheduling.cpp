@@ -0,0 +1,117 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6camerascheduling.h"
+#include <QList>
+#include <QtGlobal>
+
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#include <cstring>
+
+// "3", "2,3" or "0-1,3"
+static quint32 parseCpus(const QByteArray &spec)
+{
+    quint32 cpus = 0;
+    Q_FOREACH (const QByteArray &part, spec.split(',')) {
+        const int dash = part.indexOf('-');
+        bool firstOk, lastOk;
+        const int first = (dash < 0 ? part : part.left(dash)).trimmed().toInt(&firstOk);
+        const int last = dash < 0 ? first : part.mid(dash + 1).trimmed().toInt(&lastOk);
+        if (!firstOk || (dash >= 0 && !lastOk) || first < 0 || last > 31 || first > last) {
+            qWarning("Ignoring CPU list \"%s\"", spec.constData());
+            return 0;
+        }
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus |= 1u << cpu;
+    }
+    return cpus;
+}
+
+IMX6CameraSchedulingProfile IMX6CameraSchedulingProfile::fromEnvironment(const char *name)
+{
+    IMX6CameraSchedulingProfile profile;
+    const QByteArray prefix = QByteArray("IMX6CAMERA_") + name;
+
+    const QByteArray sched = qgetenv((prefix + "_SCHED").constData()).trimmed().toLower();
+    if (!sched.isEmpty()) {
+        const int colon = sched.indexOf(':');
+        const QByteArray policy = colon < 0 ? sched : sched.left(colon);
+        const int priority = colon < 0 ? 1 : sched.mid(colon + 1).toInt();
+        if (policy == "fifo")
+            profile.policy = FifoPolicy;
+        else if (policy == "rr")
+            profile.policy = RoundRobinPolicy;
+        else if (policy != "other")
+            qWarning("Ignoring unknown scheduling policy \"%s\"", sched.constData());
+        profile.priority = qBound(1, priority, 99);
+    }
+
+    const QByteArray cpus = qgetenv((prefix + "_CPUS").constData()).trimmed();
+    if (!cpus.isEmpty())
+        profile.cpus = parseCpus(cpus);
+    return profile;
+}
+
+bool IMX6CameraSchedulingProfile::applyToCurrentThread(const char *threadName) const
+{
+    bool applied = true;
+    if (policy != DefaultPolicy) {
+        sched_param parameters;
+        memset(&parameters, 0, sizeof(parameters));
+        parameters.sched_priority = priority;
+        const int result = pthread_setschedparam(pthread_self(), policy == FifoPolicy ? SCHED_FIFO : SCHED_RR,
+                                                 &parameters);
+        if (result) {
+            // Usually EPERM: no CAP_SYS_NICE and no RLIMIT_RTPRIO for this priority
+            qWarning("Could not give the %s thread real-time priority %d: %s, it stays as it is",
+                     threadName, priority, strerror(result));
+            applied = false;
+        }
+    }
+
+    if (cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < 32; ++cpu) {
+            if (cpus & (1u << cpu))
+                CPU_SET(cpu, &set);
+        }
+        const int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (result) {
+            // EINVAL when none of the CPUs exist or are allowed to the process
+            qWarning("Could not pin the %s thread to CPUs 0x%x: %s", threadName, cpus, strerror(result));
+            applied = false;
+        }
+    }
+    return applied;
+}
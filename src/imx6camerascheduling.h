@@ -0,0 +1,67 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERASCHEDULING_H
+#define IMX6CAMERASCHEDULING_H
+
+#include <QByteArray>
+
+// How a thread of the capture pipeline is scheduled. The default profile
+// leaves the thread as Qt created it.
+//
+// Profiles are read from the environment, with NAME being CAPTURE or PROCESSING:
+//   IMX6CAMERA_NAME_SCHED   "fifo:60", "rr:40" or "other"
+//   IMX6CAMERA_NAME_CPUS    CPUs the thread may run on, "3" or "2,3" or "0-1"
+struct IMX6CameraSchedulingProfile
+{
+    enum Policy {
+        DefaultPolicy,
+        FifoPolicy,
+        RoundRobinPolicy
+    };
+
+    IMX6CameraSchedulingProfile() : policy(DefaultPolicy), priority(0), cpus(0) {}
+
+    bool isDefault() const { return policy == DefaultPolicy && !cpus; }
+
+    static IMX6CameraSchedulingProfile fromEnvironment(const char *name);
+
+    // Applies the profile to the calling thread. What the process lacks the
+    // privileges for is skipped with a warning, the rest still applies.
+    // Returns false when anything was skipped.
+    bool applyToCurrentThread(const char *threadName) const;
+
+    Policy policy;
+    int priority;   // 1 to 99 for the real-time policies
+    quint32 cpus;   // Bit mask of allowed CPUs, 0 leaves the affinity alone
+};
+
+#endif // IMX6CAMERASCHEDULING_H
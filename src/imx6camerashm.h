@@ -0,0 +1,92 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef IMX6CAMERASHM_H
+#define IMX6CAMERASHM_H
+
+// Layout shared between IMX6CameraFramePublisher and the reader library.
+// Plain C types only, both sides access the fields with __atomic builtins.
+
+#include <stdint.h>
+
+#define IMX6_CAMERA_SHM_MAGIC       0x36584d49  // "IMX6"
+#define IMX6_CAMERA_SHM_VERSION     1
+#define IMX6_CAMERA_SHM_MAX_SLOTS   8
+#define IMX6_CAMERA_SHM_MAX_PLANES  3
+
+struct IMX6CameraShmPlane
+{
+    uint32_t memory;        // Index of the dmabuf of the slot holding the plane
+    uint32_t offset;
+    uint32_t bytesPerLine;
+    uint32_t length;
+};
+
+// One slot per V4L2 buffer. The sequence works as a seqlock: it is odd while the
+// slot is written or after the buffer went back to the driver, and even while
+// the frame may be read. Readers bump readers while they access the buffer and
+// check the sequence again afterwards, the publisher never waits for them.
+struct IMX6CameraShmSlot
+{
+    uint32_t sequence;
+    uint32_t frameSequence;
+    int64_t timestamp;      // Capture time in microseconds, CLOCK_MONOTONIC
+    uint32_t fourcc;        // V4L2 pixel format
+    uint32_t width;
+    uint32_t height;
+    uint32_t planeCount;
+    IMX6CameraShmPlane planes[IMX6_CAMERA_SHM_MAX_PLANES];
+    int32_t readers;
+    uint32_t reserved;
+};
+
+struct IMX6CameraShmHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t memoryCount;   // dmabufs per slot, more than one for multi-planar devices
+    uint32_t published;     // Futex word, increments with every published frame
+    uint32_t latestSlot;
+    uint32_t waiters;       // Readers sleeping on published
+    uint32_t reserved;
+    IMX6CameraShmSlot slots[IMX6_CAMERA_SHM_MAX_SLOTS];
+};
+
+// Sent once to every client that connects to the publisher socket. The header
+// memfd and slotCount * memoryCount dmabuf fds follow as SCM_RIGHTS, slot by slot.
+struct IMX6CameraShmHello
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fdCount;
+};
+
+#endif // IMX6CAMERASHM_H
@@ -0,0 +1,203 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERASIMD_H
+#define IMX6CAMERASIMD_H
+
+// Small vector kernels for the frame analysis code. NEON on the i.MX6,
+// SSE2 on desktop builds and plain C everywhere else.
+
+#include <QtGlobal>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define IMX6_CAMERA_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define IMX6_CAMERA_SSE2
+#endif
+
+// Packed 4:2:2 is loaded by whole pixel pairs from data - offset, the last
+// block of a row then ends with the row and never reads past the buffer.
+#if defined(IMX6_CAMERA_NEON)
+static inline uint8x16_t imx6LoadLuma16(const uchar *data, int step, int offset)
+{
+    if (step != 2)
+        return vld1q_u8(data);
+    const uint8x16x2_t pairs = vld2q_u8(data - offset);
+    return offset ? pairs.val[1] : pairs.val[0];
+}
+
+static inline uint imx6HorizontalSum(uint8x16_t vector)
+{
+    const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vector)));
+    return uint(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+}
+#elif defined(IMX6_CAMERA_SSE2)
+static inline __m128i imx6LoadLuma16(const uchar *data, int step, int offset)
+{
+    if (step != 2)
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    const __m128i *pairs = reinterpret_cast<const __m128i *>(data - offset);
+    __m128i low = _mm_loadu_si128(pairs);
+    __m128i high = _mm_loadu_si128(pairs + 1);
+    if (offset) {
+        low = _mm_srli_epi16(low, 8);
+        high = _mm_srli_epi16(high, 8);
+    } else {
+        const __m128i mask = _mm_set1_epi16(0x00ff);
+        low = _mm_and_si128(low, mask);
+        high = _mm_and_si128(high, mask);
+    }
+    return _mm_packus_epi16(low, high);
+}
+
+static inline uint imx6HorizontalSum(__m128i vector)
+{
+    const __m128i sum = _mm_sad_epu8(vector, _mm_setzero_si128());
+    return uint(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+}
+#endif
+
+// Sum of 16 luma samples. step is 1 for a luma plane and 2 for packed 4:2:2,
+// where data has to point at the first luma byte and offset is its position
+// in the pixel pair, as IMX6CameraFrame::lumaLayout() reports them.
+static inline uint imx6SumLuma16(const uchar *data, int step, int offset)
+{
+#if defined(IMX6_CAMERA_NEON) || defined(IMX6_CAMERA_SSE2)
+    return imx6HorizontalSum(imx6LoadLuma16(data, step, offset));
+#else
+    Q_UNUSED(offset);
+    uint sum = 0;
+    for (int i = 0; i < 16; ++i)
+        sum += data[i * step];
+    return sum;
+#endif
+}
+
+// Counts count luma samples into four interleaved 256 bin histograms, which
+// avoids stalls on repeated bins, and returns the sum of the samples.
+static inline quint32 imx6LumaHistogram(const uchar *data, int count, int step, int offset, quint32 *histograms)
+{
+    quint32 sum = 0;
+    int i = 0;
+#if defined(IMX6_CAMERA_NEON) || defined(IMX6_CAMERA_SSE2)
+    uchar luma[16] __attribute__((aligned(16)));
+    for (; i + 16 <= count; i += 16) {
+#if defined(IMX6_CAMERA_NEON)
+        const uint8x16_t vector = imx6LoadLuma16(data + i * step, step, offset);
+        vst1q_u8(luma, vector);
+#else
+        const __m128i vector = imx6LoadLuma16(data + i * step, step, offset);
+        _mm_store_si128(reinterpret_cast<__m128i *>(luma), vector);
+#endif
+        sum += imx6HorizontalSum(vector);
+        for (int j = 0; j < 16; j += 4) {
+            ++histograms[luma[j]];
+            ++histograms[256 + luma[j + 1]];
+            ++histograms[512 + luma[j + 2]];
+            ++histograms[768 + luma[j + 3]];
+        }
+    }
+#else
+    Q_UNUSED(offset);
+#endif
+    for (; i < count; ++i) {
+        const uchar luma = data[i * step];
+        ++histograms[(i & 3) * 256 + luma];
+        sum += luma;
+    }
+    return sum;
+}
+
+// Sum of |a[i] - b[i]| over length bytes
+static inline quint64 imx6SumAbsDiff(const uchar *a, const uchar *b, int length)
+{
+    quint64 sum = 0;
+    int i = 0;
+#if defined(IMX6_CAMERA_NEON)
+    uint32x4_t accumulator = vdupq_n_u32(0);
+    for (; i + 16 <= length; i += 16) {
+        const uint8x16_t difference = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        accumulator = vpadalq_u16(accumulator, vpaddlq_u8(difference));
+    }
+    const uint64x2_t total = vpaddlq_u32(accumulator);
+    sum = vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#elif defined(IMX6_CAMERA_SSE2)
+    __m128i accumulator = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        accumulator = _mm_add_epi64(accumulator, _mm_sad_epu8(va, vb));
+    }
+    sum = quint64(_mm_cvtsi128_si32(accumulator)) + quint64(_mm_cvtsi128_si32(_mm_srli_si128(accumulator, 8)));
+#endif
+    for (; i < length; ++i)
+        sum += qAbs(int(a[i]) - int(b[i]));
+    return sum;
+}
+
+// mask[i] = 0xff where |a[i] - b[i]| > threshold, else 0. Returns the number of set bytes.
+static inline int imx6AbsDiffThreshold(const uchar *a, const uchar *b, uchar *mask, int length, uchar threshold)
+{
+    int count = 0;
+    int i = 0;
+#if defined(IMX6_CAMERA_NEON)
+    const uint8x16_t limit = vdupq_n_u8(threshold);
+    uint32x4_t counter = vdupq_n_u32(0);
+    for (; i + 16 <= length; i += 16) {
+        const uint8x16_t set = vcgtq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)), limit);
+        vst1q_u8(mask + i, set);
+        counter = vpadalq_u16(counter, vpaddlq_u8(vshrq_n_u8(set, 7)));
+    }
+    const uint64x2_t total = vpaddlq_u32(counter);
+    count = int(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1));
+#elif defined(IMX6_CAMERA_SSE2)
+    const __m128i limit = _mm_set1_epi8(char(threshold));
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        const __m128i difference = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        // difference > threshold <=> saturating difference - threshold != 0
+        const __m128i set = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(difference, limit), zero), _mm_set1_epi8(-1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(mask + i), set);
+        count += __builtin_popcount(_mm_movemask_epi8(set));
+    }
+#endif
+    for (; i < length; ++i) {
+        mask[i] = qAbs(int(a[i]) - int(b[i])) > threshold ? 0xff : 0;
+        count += mask[i] & 1;
+    }
+    return count;
+}
+
+#endif // IMX6CAMERASIMD_H
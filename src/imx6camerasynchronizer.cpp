@@ -0,0 +1,220 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6camerasynchronizer.h"
+
+IMX6CameraSynchronizer::IMX6CameraSynchronizer(QObject *parent)
+    : QObject(parent)
+    , m_tolerance(10000)
+    , m_matchedSets(0)
+    , m_discardedFrames(0)
+    , m_skew(0)
+    , m_maxSkew(0)
+    , m_windowSkewSum(0)
+    , m_windowSkewMax(0)
+    , m_windowSets(0)
+{
+    qRegisterMetaType<IMX6CameraFrame>("IMX6CameraFrame");
+}
+
+IMX6CameraSynchronizer::~IMX6CameraSynchronizer()
+{
+    releaseStreams();
+}
+
+QStringList IMX6CameraSynchronizer::devices() const
+{
+    return m_devices;
+}
+
+void IMX6CameraSynchronizer::setDevices(const QStringList &devices)
+{
+    if (devices == m_devices)
+        return;
+    // New sessions start before the old ones stop, so devices in both lists keep streaming
+    const QVector<Stream> previous = m_streams;
+    m_streams.clear();
+    m_devices = devices;
+
+    Q_FOREACH (const QString &device, m_devices) {
+        Stream stream;
+        stream.control = IMX6CameraControl::cameraControl(device.toLocal8Bit(), &stream.sessionId);
+        stream.sinceFrame.start();
+        m_streams.append(stream);
+        connect(stream.control, &IMX6CameraControl::frameReady, this, &IMX6CameraSynchronizer::handleFrame, Qt::UniqueConnection);
+        stream.control->startCamera(stream.sessionId);
+    }
+    Q_FOREACH (const Stream &stream, previous) {
+        if (!m_devices.contains(QString::fromLocal8Bit(stream.control->device())))
+            disconnect(stream.control, 0, this, 0);
+        stream.control->stopCameraStream(stream.sessionId);
+    }
+    emit devicesChanged(m_devices);
+}
+
+void IMX6CameraSynchronizer::releaseStreams()
+{
+    // Dropping the queued frames hands their buffers back to the drivers
+    Q_FOREACH (const Stream &stream, m_streams) {
+        disconnect(stream.control, 0, this, 0);
+        stream.control->stopCameraStream(stream.sessionId);
+    }
+    m_streams.clear();
+}
+
+qreal IMX6CameraSynchronizer::tolerance() const
+{
+    return m_tolerance / 1000.0;
+}
+
+void IMX6CameraSynchronizer::setTolerance(qreal milliseconds)
+{
+    const qint64 tolerance = qMax(qint64(0), qint64(milliseconds * 1000));
+    if (tolerance == m_tolerance)
+        return;
+    m_tolerance = tolerance;
+    emit toleranceChanged(tolerance / 1000.0);
+}
+
+int IMX6CameraSynchronizer::matchedSets() const
+{
+    return m_matchedSets;
+}
+
+int IMX6CameraSynchronizer::discardedFrames() const
+{
+    return m_discardedFrames;
+}
+
+qreal IMX6CameraSynchronizer::skew() const
+{
+    return m_skew;
+}
+
+qreal IMX6CameraSynchronizer::maxSkew() const
+{
+    return m_maxSkew;
+}
+
+void IMX6CameraSynchronizer::handleFrame(const IMX6CameraFrame &frame)
+{
+    IMX6CameraControl *control = qobject_cast<IMX6CameraControl *>(sender());
+    // A device listed twice is paired with itself, every entry gets the frame
+    for (int i = 0; i < m_streams.size(); ++i) {
+        Stream &stream = m_streams[i];
+        if (stream.control != control)
+            continue;
+        stream.frames.enqueue(frame);
+        stream.sinceFrame.restart();
+        // Partners lag by more than the queue covers, the oldest can not be matched in time
+        while (stream.frames.size() > SYNC_QUEUE_DEPTH)
+            discard(&stream);
+    }
+    match();
+    publishStatistics();
+}
+
+void IMX6CameraSynchronizer::discard(Stream *stream)
+{
+    stream->frames.dequeue();
+    ++m_discardedFrames;
+}
+
+void IMX6CameraSynchronizer::match()
+{
+    if (m_streams.isEmpty())
+        return;
+
+    for (;;) {
+        // A device that stopped delivering must not keep the others' buffers
+        bool complete = true;
+        for (int i = 0; i < m_streams.size(); ++i) {
+            if (m_streams.at(i).frames.isEmpty()) {
+                complete = false;
+                if (m_streams.at(i).sinceFrame.elapsed() > SYNC_STALL_TIMEOUT) {
+                    for (int j = 0; j < m_streams.size(); ++j) {
+                        while (!m_streams.at(j).frames.isEmpty())
+                            discard(&m_streams[j]);
+                    }
+                    break;
+                }
+            }
+        }
+        if (!complete)
+            return;
+
+        int oldest = 0;
+        qint64 first = m_streams.at(0).frames.head().timestamp;
+        qint64 last = first;
+        for (int i = 1; i < m_streams.size(); ++i) {
+            const qint64 timestamp = m_streams.at(i).frames.head().timestamp;
+            if (timestamp < first) {
+                first = timestamp;
+                oldest = i;
+            }
+            last = qMax(last, timestamp);
+        }
+
+        if (last - first > m_tolerance) {
+            // Every other head is newer than the oldest by more than the
+            // tolerance and later frames only get newer, so it has no partner
+            discard(&m_streams[oldest]);
+            continue;
+        }
+
+        QList<IMX6CameraFrame> frames;
+        for (int i = 0; i < m_streams.size(); ++i)
+            frames.append(m_streams[i].frames.dequeue());
+        ++m_matchedSets;
+        m_windowSkewSum += last - first;
+        m_windowSkewMax = qMax(m_windowSkewMax, last - first);
+        ++m_windowSets;
+        emit framesMatched(frames);
+    }
+}
+
+void IMX6CameraSynchronizer::publishStatistics()
+{
+    if (!m_window.isValid()) {
+        m_window.start();
+        return;
+    }
+    if (m_window.elapsed() < 1000)
+        return;
+
+    m_skew = m_windowSets ? m_windowSkewSum / 1000.0 / m_windowSets : 0;
+    m_maxSkew = m_windowSkewMax / 1000.0;
+    m_windowSkewSum = 0;
+    m_windowSkewMax = 0;
+    m_windowSets = 0;
+    m_window.restart();
+    emit statisticsChanged();
+}
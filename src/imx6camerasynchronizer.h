@@ -0,0 +1,112 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERASYNCHRONIZER_H
+#define IMX6CAMERASYNCHRONIZER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QQueue>
+#include <QStringList>
+#include <QVector>
+#include "imx6cameracontrol.h"
+
+#define SYNC_QUEUE_DEPTH 2          // Frames held per device while waiting for partners
+#define SYNC_STALL_TIMEOUT 200      // Milliseconds without frames before a device stops holding the others back
+
+// Pairs frames of several devices by capture timestamp. A set is delivered
+// once every device has a frame within tolerance of the others, frames that
+// can no longer be part of a set are released to their driver right away.
+class IMX6CameraSynchronizer : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QStringList devices READ devices WRITE setDevices NOTIFY devicesChanged)
+    Q_PROPERTY(qreal tolerance READ tolerance WRITE setTolerance NOTIFY toleranceChanged)
+    Q_PROPERTY(int matchedSets READ matchedSets NOTIFY statisticsChanged)
+    Q_PROPERTY(int discardedFrames READ discardedFrames NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal skew READ skew NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal maxSkew READ maxSkew NOTIFY statisticsChanged)
+
+public:
+    explicit IMX6CameraSynchronizer(QObject *parent = 0);
+    ~IMX6CameraSynchronizer();
+
+    QStringList devices() const;
+    qreal tolerance() const;        // Milliseconds
+    int matchedSets() const;
+    int discardedFrames() const;
+    // Spread of the capture timestamps within a set, in milliseconds,
+    // averaged and maximum over the last second
+    qreal skew() const;
+    qreal maxSkew() const;
+
+public Q_SLOTS:
+    void setDevices(const QStringList &devices);
+    void setTolerance(qreal milliseconds);
+
+Q_SIGNALS:
+    // One frame per device, in the order of devices
+    void framesMatched(const QList<IMX6CameraFrame> &frames);
+    void devicesChanged(const QStringList &);
+    void toleranceChanged(qreal);
+    void statisticsChanged();
+
+private Q_SLOTS:
+    void handleFrame(const IMX6CameraFrame &frame);
+
+private:
+    struct Stream {
+        IMX6CameraControl *control;
+        int sessionId;
+        QQueue<IMX6CameraFrame> frames;
+        QElapsedTimer sinceFrame;
+    };
+
+    void releaseStreams();
+    void match();
+    void discard(Stream *stream);
+    void publishStatistics();
+
+    QStringList m_devices;
+    qint64 m_tolerance;     // Microseconds
+    QVector<Stream> m_streams;
+    int m_matchedSets;
+    int m_discardedFrames;
+    qreal m_skew;
+    qreal m_maxSkew;
+    QElapsedTimer m_window;
+    qint64 m_windowSkewSum;
+    qint64 m_windowSkewMax;
+    int m_windowSets;
+};
+
+#endif // IMX6CAMERASYNCHRONIZER_H
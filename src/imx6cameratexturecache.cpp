@@ -0,0 +1,305 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Copyright (C) 2014 Pelagicore AG
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt-project.org/legal
+**
+** This file is based on Qt5 multimedia imx6 videonode plugin from
+** http://code.qt.io/cgit/qt/qtmultimedia.git/tree/src/plugins/videonode/imx6
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifdef ARM_TARGET
+#include "GLES2/gl2.h"
+#include "GLES2/gl2ext.h"
+#include "EGL/egl.h"
+#include "EGL/eglext.h"
+#endif // ARM_TARGET
+#include "imx6cameratexturecache.h"
+#include "imx6camera.h"
+#include "imx6cameratrace.h"
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <cstring>
+
+#ifdef ARM_TARGET
+namespace {
+
+struct FenceFunctions
+{
+    FenceFunctions() : resolved(false), display(EGL_NO_DISPLAY), create(0), clientWait(0), destroy(0) {}
+
+    bool isSupported()
+    {
+        if (!resolved) {
+            resolved = true;
+            display = eglGetCurrentDisplay();
+            const char *extensions = display != EGL_NO_DISPLAY ? eglQueryString(display, EGL_EXTENSIONS) : 0;
+            if (extensions && strstr(extensions, "EGL_KHR_fence_sync")) {
+                create = reinterpret_cast<PFNEGLCREATESYNCKHRPROC>(eglGetProcAddress("eglCreateSyncKHR"));
+                clientWait = reinterpret_cast<PFNEGLCLIENTWAITSYNCKHRPROC>(eglGetProcAddress("eglClientWaitSyncKHR"));
+                destroy = reinterpret_cast<PFNEGLDESTROYSYNCKHRPROC>(eglGetProcAddress("eglDestroySyncKHR"));
+            }
+            if (!create || !clientWait || !destroy)
+                qWarning("EGL_KHR_fence_sync is not available, buffers are released when the next frame is bound");
+        }
+        return create && clientWait && destroy;
+    }
+
+    bool resolved;
+    EGLDisplay display;
+    PFNEGLCREATESYNCKHRPROC create;
+    PFNEGLCLIENTWAITSYNCKHRPROC clientWait;
+    PFNEGLDESTROYSYNCKHRPROC destroy;
+};
+
+Q_GLOBAL_STATIC(FenceFunctions, fenceFunctions)
+
+}
+#endif // ARM_TARGET
+
+QMutex IMX6CameraTextureCache::s_cacheMutex;
+QHash<IMX6CameraTextureCache::Key, QWeakPointer<IMX6CameraTextureCache> > IMX6CameraTextureCache::s_caches;
+
+IMX6CameraTextureCache::IMX6CameraTextureCache(QOpenGLContext *context, IMX6CameraControl *control) :
+    mContext(context),
+    mControl(control),
+    mWidth(0),
+    mHeight(0),
+    mFormat(IMX6CameraFrame::Format_Invalid),
+    mCurrentTexture(0)
+{
+}
+
+IMX6CameraTextureCache::~IMX6CameraTextureCache()
+{
+    {
+        QMutexLocker lock(&s_cacheMutex);
+        const Key key(mContext, mControl);
+        if (s_caches.value(key).isNull())
+            s_caches.remove(key);
+    }
+    fenceReplacedFrames();
+    releaseSignaledFrames(true);
+#ifdef ARM_TARGET
+    Q_FOREACH (GLuint id, mBitsToTextureMap.values()) {
+#ifdef QT_VIVANTE_VIDEO_DEBUG
+        qDebug() << "delete texture: " << id;
+#endif
+        glDeleteTextures(1, &id);
+    }
+#endif
+}
+
+QSharedPointer<IMX6CameraTextureCache> IMX6CameraTextureCache::cache(IMX6CameraControl *control, bool create)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    const Key key(context, control);
+
+    QMutexLocker lock(&s_cacheMutex);
+    QSharedPointer<IMX6CameraTextureCache> textureCache = s_caches.value(key).toStrongRef();
+    if (textureCache.isNull() && create) {
+        textureCache = QSharedPointer<IMX6CameraTextureCache>(new IMX6CameraTextureCache(context, control));
+        s_caches.insert(key, textureCache.toWeakRef());
+    }
+    return textureCache;
+}
+
+void IMX6CameraTextureCache::setNextFrame(const IMX6CameraFrame &frame)
+{
+    QMutexLocker lock(&mFrameMutex);
+    // Several views hand over the same frame, only the first one counts
+    if (mNextFrame.isValid() && mNextFrame.sequence == frame.sequence)
+        return;
+    if (mCurrentFrame.isValid() && mCurrentFrame.sequence == frame.sequence)
+        return;
+    // A pending frame that was never bound is simply replaced, which releases it
+    mNextFrame = frame;
+}
+
+GLuint IMX6CameraTextureCache::bind()
+{
+    IMX6_TRACE_SCOPE("bind", -1);
+#ifdef ARM_TARGET
+    QMutexLocker lock(&mFrameMutex);
+    if (mNextFrame.isValid()) {
+        replaceCurrentFrame();
+        mCurrentFrame = mNextFrame;
+        mNextFrame = IMX6CameraFrame();
+        mCurrentTexture = vivanteMapping(mCurrentFrame);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, mCurrentTexture);
+    }
+    releaseSignaledFrames();
+#endif
+    return mCurrentTexture;
+}
+
+void IMX6CameraTextureCache::afterRendering()
+{
+    IMX6_TRACE_SCOPE("retireFrames", -1);
+#ifdef ARM_TARGET
+    QMutexLocker lock(&mFrameMutex);
+    fenceReplacedFrames();
+    releaseSignaledFrames();
+#endif
+}
+
+void IMX6CameraTextureCache::replaceCurrentFrame()
+{
+    if (!mCurrentFrame.isValid())
+        return;
+#ifdef ARM_TARGET
+    if (fenceFunctions()->isSupported())
+        mReplacedFrames.append(mCurrentFrame);
+#endif
+    // Without a fence the buffer goes back right away, like before
+    mCurrentFrame = IMX6CameraFrame();
+}
+
+// One fence per pass, behind everything the pass submitted, covers every frame
+// replaced in it however many views bound the cache
+void IMX6CameraTextureCache::fenceReplacedFrames()
+{
+#ifdef ARM_TARGET
+    if (mReplacedFrames.isEmpty())
+        return;
+    FenceFunctions *fences = fenceFunctions();
+    RetiredFrames retired;
+    retired.frames = mReplacedFrames;
+    retired.fence = fences->create(fences->display, EGL_SYNC_FENCE_KHR, NULL);
+    mReplacedFrames.clear();
+    if (retired.fence != EGL_NO_SYNC_KHR)
+        mRetiredFrames.append(retired);
+#endif
+}
+
+void IMX6CameraTextureCache::releaseSignaledFrames(bool wait)
+{
+#ifndef ARM_TARGET
+    Q_UNUSED(wait)
+#else
+    if (mRetiredFrames.isEmpty())
+        return;
+    FenceFunctions *fences = fenceFunctions();
+    const EGLTimeKHR timeout = wait ? 100000000 : 0; // 100 ms when tearing down
+    QList<RetiredFrames>::Iterator it = mRetiredFrames.begin();
+    while (it != mRetiredFrames.end()) {
+        const EGLint status = fences->clientWait(fences->display, it->fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, timeout);
+        if (status == EGL_TIMEOUT_EXPIRED_KHR && !wait)
+            break; // Fences signal in order, later ones are not done either
+        fences->destroy(fences->display, it->fence);
+        it = mRetiredFrames.erase(it); // Returns the buffers to the driver
+    }
+#endif
+}
+
+GLuint IMX6CameraTextureCache::vivanteMapping(const IMX6CameraFrame &vF)
+{
+    IMX6_TRACE_SCOPE("vivanteMapping", vF.sequence);
+    QOpenGLContext *glcontext = QOpenGLContext::currentContext();
+    if (glcontext == 0) {
+        qWarning() << Q_FUNC_INFO << "no QOpenGLContext::currentContext() => return 0";
+        return 0;
+    }
+#ifndef ARM_TARGET
+    Q_UNUSED(vF)
+#else
+    static PFNGLTEXDIRECTVIVMAPPROC glTexDirectVIVMap_LOCAL = 0;
+    static PFNGLTEXDIRECTINVALIDATEVIVPROC glTexDirectInvalidateVIV_LOCAL = 0;
+
+    if (glTexDirectVIVMap_LOCAL == 0 || glTexDirectInvalidateVIV_LOCAL == 0) {
+        glTexDirectVIVMap_LOCAL = reinterpret_cast<PFNGLTEXDIRECTVIVMAPPROC>(glcontext->getProcAddress("glTexDirectVIVMap"));
+        glTexDirectInvalidateVIV_LOCAL = reinterpret_cast<PFNGLTEXDIRECTINVALIDATEVIVPROC>(glcontext->getProcAddress("glTexDirectInvalidateVIV"));
+    }
+    if (glTexDirectVIVMap_LOCAL == 0 || glTexDirectInvalidateVIV_LOCAL == 0) {
+        qWarning() << Q_FUNC_INFO << "couldn't find \"glTexDirectVIVMap\" and/or \"glTexDirectInvalidateVIV\" => do nothing and return";
+        return 0;
+    }
+
+    // The texture is as wide as the stride, the padding is cut off by the texture
+    // coordinates, and the chroma planes must follow the luma plane back to back.
+    const int alignedWidth = qMax(vF.size.width(), vF.plane(0).bytesPerLine / IMX6CameraFrame::bytesPerPixel(vF.format));
+    for (int plane = 1; plane < vF.planeCount(); ++plane) {
+        if (vF.plane(plane).data != vF.plane(plane - 1).data + vF.plane(plane - 1).length) {
+            static bool warned = false;
+            if (!warned) {
+                qWarning() << Q_FUNC_INFO << "planes are not contiguous, glTexDirectVIVMap can not map them";
+                warned = true;
+            }
+            return 0;
+        }
+    }
+
+    if (mWidth != alignedWidth || mHeight != vF.size.height() || mFormat != vF.format) {
+        mWidth = alignedWidth;
+        mHeight = vF.size.height();
+        mFormat = vF.format;
+        Q_FOREACH (GLuint id, mBitsToTextureMap.values()) {
+#ifdef QT_VIVANTE_VIDEO_DEBUG
+            qDebug() << "delete texture: " << id;
+#endif
+            glDeleteTextures(1, &id);
+        }
+        mBitsToTextureMap.clear();
+    }
+
+    if (!mBitsToTextureMap.contains(vF.buffer->start())) {
+        GLuint tmpTexId;
+        glGenTextures(1, &tmpTexId);
+        mBitsToTextureMap.insert(vF.buffer->start(), tmpTexId);
+
+        const uchar *constBits = vF.buffer->start();
+        void *bits = (void*)constBits;
+
+        GLuint physical = ~0U;
+
+        glBindTexture(GL_TEXTURE_2D, tmpTexId);
+        glTexDirectVIVMap_LOCAL(GL_TEXTURE_2D,
+                                alignedWidth, vF.size.height(),
+                                QSGVivanteVideoNode::getVideoFormat2GLFormatMap().value(vF.format),
+                                &bits, &physical);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexDirectInvalidateVIV_LOCAL(GL_TEXTURE_2D);
+
+        return tmpTexId;
+    } else {
+        glBindTexture(GL_TEXTURE_2D, mBitsToTextureMap.value(vF.buffer->start()));
+        glTexDirectInvalidateVIV_LOCAL(GL_TEXTURE_2D);
+        return mBitsToTextureMap.value(vF.buffer->start());
+    }
+
+    Q_ASSERT(false); // should never reach this line!;
+#endif
+    return 0;
+}
@@ -0,0 +1,99 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Copyright (C) 2014 Pelagicore AG
+** Copyright (C) 2015 The Qt Company Ltd.
+** Contact: http://www.qt-project.org/legal
+**
+** This file is based on Qt5 multimedia imx6 videonode plugin from
+** http://code.qt.io/cgit/qt/qtmultimedia.git/tree/src/plugins/videonode/imx6
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+#ifndef IMX6CAMERATEXTURECACHE_H
+#define IMX6CAMERATEXTURECACHE_H
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QSharedPointer>
+#include <QWeakPointer>
+#include <qopengl.h>
+#include "imx6cameracontrol.h"
+
+class QOpenGLContext;
+
+// Direct-mapped textures of one capture stream in one OpenGL context.
+// Every item showing the stream shares the cache, so each frame is mapped
+// and invalidated once no matter how many views sample it.
+class IMX6CameraTextureCache
+{
+public:
+    ~IMX6CameraTextureCache();
+
+    // Returns the cache of the stream for the current OpenGL context, a null
+    // pointer when create is false and no material uses the stream yet
+    static QSharedPointer<IMX6CameraTextureCache> cache(IMX6CameraControl *control, bool create = true);
+
+    void setNextFrame(const IMX6CameraFrame &frame);
+    GLuint bind();
+    // Called once the scene is drawn, fences the frames bind() replaced in this
+    // pass and releases those the GPU is done with
+    void afterRendering();
+
+private:
+    struct RetiredFrames {
+        QList<IMX6CameraFrame> frames;
+        void *fence;    // EGLSyncKHR signalled once the GPU is done with the frames
+    };
+
+    IMX6CameraTextureCache(QOpenGLContext *context, IMX6CameraControl *control);
+    GLuint vivanteMapping(const IMX6CameraFrame &frame);
+    void replaceCurrentFrame();
+    void fenceReplacedFrames();
+    void releaseSignaledFrames(bool wait = false);
+
+    typedef QPair<QOpenGLContext *, IMX6CameraControl *> Key;
+
+    QOpenGLContext *mContext;
+    IMX6CameraControl *mControl;
+    int mWidth;
+    int mHeight;
+    IMX6CameraFrame::PixelFormat mFormat;
+    QMap<const uchar*, GLuint> mBitsToTextureMap;
+    IMX6CameraFrame mCurrentFrame, mNextFrame;
+    GLuint mCurrentTexture;
+    QList<IMX6CameraFrame> mReplacedFrames;    // Replaced in this pass, not fenced yet
+    QList<RetiredFrames> mRetiredFrames;
+    QMutex mFrameMutex;
+
+    static QMutex s_cacheMutex;
+    static QHash<Key, QWeakPointer<IMX6CameraTextureCache> > s_caches;
+};
+
+#endif // IMX6CAMERATEXTURECACHE_H
@@ -0,0 +1,255 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameratrace.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+#include <cstdlib>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    qint64 start;
+    qint64 end;
+    qint64 value;
+};
+
+// Written by its own thread only. The exporter copies it while it is being
+// written and drops whatever may have been overwritten meanwhile.
+struct TraceRing {
+    TraceRing() : tid(0), inUse(true), cleared(0) {}
+
+    QByteArray threadName;
+    int tid;
+    bool inUse;     // False once its thread exited, guarded by ringsMutex
+    QAtomicInteger<quint64> head;       // Events ever written
+    QAtomicInteger<quint64> cleared;    // Head at the last clear()
+    TraceEvent events[TRACE_RING_SIZE];
+};
+
+QMutex ringsMutex;
+// A ring outlives its thread, so the events can still be exported, until a new
+// thread takes it over. There are never more rings than threads alive at once.
+QList<TraceRing *> rings;
+
+TraceRing *acquireRing()
+{
+    const int tid = syscall(SYS_gettid);
+    QThread *thread = QThread::currentThread();
+    const QByteArray threadName = thread && !thread->objectName().isEmpty() ? thread->objectName().toUtf8()
+                                                                            : "Thread " + QByteArray::number(tid);
+    QMutexLocker lock(&ringsMutex);
+    TraceRing *ring = 0;
+    Q_FOREACH (TraceRing *candidate, rings) {
+        if (!candidate->inUse) {
+            ring = candidate;
+            break;
+        }
+    }
+    if (ring) {
+        // Rings are only written by their owner and read under the lock, nobody sees this
+        ring->inUse = true;
+        ring->head.store(0);
+        ring->cleared.store(0);
+    } else {
+        ring = new TraceRing;
+        rings.append(ring);
+    }
+    ring->tid = tid;
+    ring->threadName = threadName;
+    return ring;
+}
+
+// Gives the ring up when its thread exits, worker pools come and go
+struct ThreadRing {
+    ThreadRing() : ring(0) {}
+    ~ThreadRing()
+    {
+        if (ring) {
+            QMutexLocker lock(&ringsMutex);
+            ring->inUse = false;
+        }
+    }
+
+    TraceRing *ring;
+};
+
+thread_local ThreadRing threadRing;
+
+QString exportFileName;
+
+void exportAtExit()
+{
+    IMX6CameraTrace::exportChromeTrace(exportFileName);
+}
+
+// IMX6CAMERA_TRACE=1 traces from the start, a file name also saves the trace on exit
+void initializeTrace()
+{
+    const QByteArray trace = qgetenv("IMX6CAMERA_TRACE");
+    if (trace.isEmpty() || trace == "0")
+        return;
+    IMX6CameraTrace::setEnabled(true);
+    if (trace != "1") {
+        exportFileName = QString::fromLocal8Bit(trace);
+        atexit(exportAtExit);
+    }
+}
+
+}
+
+Q_CONSTRUCTOR_FUNCTION(initializeTrace)
+
+QBasicAtomicInt IMX6CameraTrace::s_enabled = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+void IMX6CameraTrace::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled ? 1 : 0);
+}
+
+qint64 IMX6CameraTrace::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void IMX6CameraTrace::record(const char *name, qint64 start, qint64 end, qint64 value)
+{
+    TraceRing *ring = threadRing.ring;
+    if (Q_UNLIKELY(!ring))
+        ring = threadRing.ring = acquireRing();
+
+    const quint64 head = ring->head.load();
+    TraceEvent &event = ring->events[head % TRACE_RING_SIZE];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    event.value = value;
+    ring->head.storeRelease(head + 1);
+}
+
+void IMX6CameraTrace::clear()
+{
+    QMutexLocker lock(&ringsMutex);
+    Q_FOREACH (TraceRing *ring, rings)
+        ring->cleared.storeRelease(ring->head.loadAcquire());
+}
+
+bool IMX6CameraTrace::exportChromeTrace(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Could not write trace %s: %s", qPrintable(fileName), qPrintable(file.errorString()));
+        return false;
+    }
+
+    const QByteArray pid = QByteArray::number(getpid());
+    QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    QVector<TraceEvent> events;
+
+    QMutexLocker lock(&ringsMutex);
+    Q_FOREACH (TraceRing *ring, rings) {
+        const QByteArray tid = QByteArray::number(ring->tid);
+        json += QByteArray(first ? "" : ",\n") + "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid
+                + ",\"tid\":" + tid + ",\"args\":{\"name\":\"" + ring->threadName + "\"}}";
+        first = false;
+
+        // Copy while the owner keeps writing, then keep what cannot have been overwritten
+        const quint64 head = ring->head.loadAcquire();
+        quint64 begin = qMax(ring->cleared.loadAcquire(), head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0);
+        events.resize(head - begin);
+        for (quint64 i = begin; i < head; ++i)
+            events[i - begin] = ring->events[i % TRACE_RING_SIZE];
+        const quint64 after = ring->head.loadAcquire();
+        const quint64 valid = after >= TRACE_RING_SIZE ? after - TRACE_RING_SIZE + 1 : 0;
+
+        for (quint64 i = qMax(begin, valid); i < head; ++i) {
+            const TraceEvent &event = events.at(i - begin);
+            json += ",\n{\"name\":\"" + QByteArray(event.name) + "\",\"pid\":" + pid + ",\"tid\":" + tid
+                    + ",\"ts\":" + QByteArray::number(event.start / 1000.0, 'f', 3);
+            if (event.end < 0)
+                json += ",\"ph\":\"i\",\"s\":\"t\"";
+            else
+                json += ",\"ph\":\"X\",\"dur\":" + QByteArray::number((event.end - event.start) / 1000.0, 'f', 3);
+            if (event.value != -1)
+                json += ",\"args\":{\"value\":" + QByteArray::number(event.value) + "}";
+            json += "}";
+        }
+    }
+    lock.unlock();
+
+    json += "\n]}\n";
+    if (file.write(json) != json.size()) {
+        qWarning("Could not write trace %s: %s", qPrintable(fileName), qPrintable(file.errorString()));
+        return false;
+    }
+    return true;
+}
+
+IMX6CameraTracer::IMX6CameraTracer(QObject *parent)
+    : QObject(parent)
+{
+}
+
+bool IMX6CameraTracer::enabled() const
+{
+    return IMX6CameraTrace::isEnabled();
+}
+
+void IMX6CameraTracer::setEnabled(bool enabled)
+{
+    if (enabled == IMX6CameraTrace::isEnabled())
+        return;
+    IMX6CameraTrace::setEnabled(enabled);
+    emit enabledChanged(enabled);
+}
+
+bool IMX6CameraTracer::save(const QString &fileName)
+{
+    return IMX6CameraTrace::exportChromeTrace(fileName);
+}
+
+void IMX6CameraTracer::clear()
+{
+    IMX6CameraTrace::clear();
+}
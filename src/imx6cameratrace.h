@@ -0,0 +1,122 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERATRACE_H
+#define IMX6CAMERATRACE_H
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QString>
+
+#define TRACE_RING_SIZE 8192    // Events kept per thread, older ones are overwritten
+
+// Trace points on the capture and render paths. Each thread records into a
+// ring of its own without locks; export() merges the rings into a Chrome
+// trace, which chrome://tracing and the Perfetto UI open. While tracing is
+// off a trace point costs one relaxed load and a branch.
+//
+// Names have to be string literals, only their pointers are recorded.
+class IMX6CameraTrace
+{
+public:
+    static bool isEnabled() { return Q_UNLIKELY(s_enabled.load()); }
+    static void setEnabled(bool enabled);
+
+    static qint64 now();    // CLOCK_MONOTONIC nanoseconds, the clock of V4L2 timestamps
+    // An end of -1 records an instant event
+    static void record(const char *name, qint64 start, qint64 end, qint64 value);
+
+    // Writes every ring as Chrome trace event JSON
+    static bool exportChromeTrace(const QString &fileName);
+    static void clear();
+
+private:
+    static QBasicAtomicInt s_enabled;
+};
+
+// Records the time between construction and destruction as one event
+class IMX6CameraTraceScope
+{
+public:
+    IMX6CameraTraceScope(const char *name, qint64 value = -1)
+        : m_name(0)
+    {
+        if (IMX6CameraTrace::isEnabled()) {
+            m_name = name;
+            m_value = value;
+            m_start = IMX6CameraTrace::now();
+        }
+    }
+
+    ~IMX6CameraTraceScope()
+    {
+        if (Q_UNLIKELY(m_name))
+            IMX6CameraTrace::record(m_name, m_start, IMX6CameraTrace::now(), m_value);
+    }
+
+private:
+    const char *m_name;
+    qint64 m_value;
+    qint64 m_start;
+};
+
+#define IMX6_TRACE_CONCAT2(a, b) a##b
+#define IMX6_TRACE_CONCAT(a, b) IMX6_TRACE_CONCAT2(a, b)
+// Traces the rest of the enclosing block, value is shown as an argument when not -1
+#define IMX6_TRACE_SCOPE(name, value) \
+    IMX6CameraTraceScope IMX6_TRACE_CONCAT(imx6TraceScope, __LINE__)(name, value)
+#define IMX6_TRACE_INSTANT(name, value) \
+    do { \
+        if (IMX6CameraTrace::isEnabled()) \
+            IMX6CameraTrace::record(name, IMX6CameraTrace::now(), -1, value); \
+    } while (0)
+
+// Switches tracing from QML and saves the trace
+class IMX6CameraTracer : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ enabled WRITE setEnabled NOTIFY enabledChanged)
+
+public:
+    explicit IMX6CameraTracer(QObject *parent = 0);
+
+    bool enabled() const;
+
+public Q_SLOTS:
+    void setEnabled(bool enabled);
+    bool save(const QString &fileName);
+    void clear();
+
+Q_SIGNALS:
+    void enabledChanged(bool);
+};
+
+#endif // IMX6CAMERATRACE_H
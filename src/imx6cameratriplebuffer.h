@@ -0,0 +1,72 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERATRIPLEBUFFER_H
+#define IMX6CAMERATRIPLEBUFFER_H
+
+#include <QAtomicInt>
+
+// Hands the newest value from one writing thread to one reading thread
+// without locks. Each side owns one of the three buffers, the third is
+// swapped through an atomic that also flags whether it holds news.
+template <typename T>
+class IMX6CameraTripleBuffer
+{
+public:
+    IMX6CameraTripleBuffer() : m_middle(1), m_back(0), m_front(2) {}
+
+    // Writer side: fill back(), then publish() it
+    T &back() { return m_buffers[m_back]; }
+    void publish()
+    {
+        m_back = m_middle.fetchAndStoreOrdered(m_back | Fresh) & IndexMask;
+    }
+
+    // Reader side: update() takes the newest published value, if any, into front()
+    bool update()
+    {
+        if (!(m_middle.load() & Fresh))
+            return false;
+        m_front = m_middle.fetchAndStoreOrdered(m_front) & IndexMask;
+        return true;
+    }
+    const T &front() const { return m_buffers[m_front]; }
+
+private:
+    enum { IndexMask = 3, Fresh = 4 };
+
+    T m_buffers[3];
+    QAtomicInt m_middle;
+    int m_back;
+    int m_front;
+};
+
+#endif // IMX6CAMERATRIPLEBUFFER_H
@@ -0,0 +1,197 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#include "imx6cameravideosource.h"
+
+IMX6CameraVideoBuffer::IMX6CameraVideoBuffer(const IMX6CameraFrame &frame)
+    : QAbstractPlanarVideoBuffer(NoHandle)
+    , mFrame(frame)
+    , mMapMode(NotMapped)
+{
+}
+
+QAbstractVideoBuffer::MapMode IMX6CameraVideoBuffer::mapMode() const
+{
+    return mMapMode;
+}
+
+// Hands out the driver's mapping, so a video frame keeps the row padding of the capture
+int IMX6CameraVideoBuffer::map(MapMode mode, int *numBytes, int bytesPerLine[4], uchar *data[4])
+{
+    if (mode != ReadOnly || mMapMode != NotMapped || !mFrame.isValid())
+        return 0;
+
+    const int planeCount = qMin(mFrame.planeCount(), 4);
+    *numBytes = 0;
+    for (int i = 0; i < planeCount; ++i) {
+        const BufferPlane &plane = mFrame.plane(i);
+        data[i] = plane.data;
+        bytesPerLine[i] = plane.bytesPerLine;
+        *numBytes += int(plane.length);
+    }
+    mMapMode = mode;
+    return planeCount;
+}
+
+void IMX6CameraVideoBuffer::unmap()
+{
+    mMapMode = NotMapped;
+}
+
+QVideoFrame::PixelFormat IMX6CameraVideoBuffer::pixelFormat(IMX6CameraFrame::PixelFormat format)
+{
+    switch (format) {
+    case IMX6CameraFrame::Format_AYUV444:
+        return QVideoFrame::Format_AYUV444;
+    case IMX6CameraFrame::Format_AYUV444_Premultiplied:
+        return QVideoFrame::Format_AYUV444_Premultiplied;
+    case IMX6CameraFrame::Format_YUV444:
+        return QVideoFrame::Format_YUV444;
+    case IMX6CameraFrame::Format_YUV420P:
+        return QVideoFrame::Format_YUV420P;
+    case IMX6CameraFrame::Format_YV12:
+        return QVideoFrame::Format_YV12;
+    case IMX6CameraFrame::Format_UYVY:
+        return QVideoFrame::Format_UYVY;
+    case IMX6CameraFrame::Format_YUYV:
+        return QVideoFrame::Format_YUYV;
+    case IMX6CameraFrame::Format_NV12:
+        return QVideoFrame::Format_NV12;
+    case IMX6CameraFrame::Format_NV21:
+        return QVideoFrame::Format_NV21;
+    default:
+        break;
+    }
+    return QVideoFrame::Format_Invalid;
+}
+
+IMX6CameraVideoSource::IMX6CameraVideoSource(QObject *parent)
+    : QObject(parent)
+    , m_cameraControl(NULL)
+    , m_sessionId(0)
+    , m_active(false)
+    , m_rejectedFrames(0)
+{
+    m_cameraControl = IMX6CameraControl::cameraControl(&m_sessionId);
+}
+
+IMX6CameraVideoSource::~IMX6CameraVideoSource()
+{
+    setActive(false);
+}
+
+bool IMX6CameraVideoSource::active() const
+{
+    return m_active;
+}
+
+void IMX6CameraVideoSource::setActive(bool value)
+{
+    if (m_active == value)
+        return;
+
+    m_active = value;
+    if (m_active) {
+        connect(m_cameraControl, &IMX6CameraControl::frameReady, this, &IMX6CameraVideoSource::presentFrame);
+        QMetaObject::invokeMethod(m_cameraControl, "startCamera", Qt::QueuedConnection, Q_ARG(uint, m_sessionId));
+    } else {
+        disconnect(m_cameraControl, &IMX6CameraControl::frameReady, this, &IMX6CameraVideoSource::presentFrame);
+        m_cameraControl->stopCameraStream(m_sessionId);
+        stopSurface();
+    }
+    emit activeChanged(m_active);
+}
+
+QAbstractVideoSurface *IMX6CameraVideoSource::videoSurface() const
+{
+    return m_surface;
+}
+
+void IMX6CameraVideoSource::setVideoSurface(QAbstractVideoSurface *surface)
+{
+    if (m_surface == surface)
+        return;
+
+    stopSurface();
+    m_surface = surface;
+    emit videoSurfaceChanged();
+}
+
+int IMX6CameraVideoSource::rejectedFrames() const
+{
+    return m_rejectedFrames;
+}
+
+void IMX6CameraVideoSource::presentFrame(const IMX6CameraFrame &frame)
+{
+    if (!m_surface || !frame.isValid())
+        return;
+
+    // A format the surface turned down is not offered again until it changes
+    if (m_format.frameSize() != frame.size
+            || m_format.pixelFormat() != IMX6CameraVideoBuffer::pixelFormat(frame.format))
+        startSurface(frame);
+    if (!m_surface->isActive()) {
+        emit rejectedFramesChanged(++m_rejectedFrames);
+        return;
+    }
+
+    // The video frame owns a reference, the capture buffer is queued back once
+    // the surface and everyone it passed the frame on to have dropped it
+    QVideoFrame videoFrame(new IMX6CameraVideoBuffer(frame), frame.size, m_format.pixelFormat());
+    videoFrame.setStartTime(frame.timestamp);
+    if (!m_surface->present(videoFrame))
+        emit rejectedFramesChanged(++m_rejectedFrames);
+}
+
+void IMX6CameraVideoSource::startSurface(const IMX6CameraFrame &frame)
+{
+    stopSurface();
+
+    const QVideoFrame::PixelFormat pixelFormat = IMX6CameraVideoBuffer::pixelFormat(frame.format);
+    QVideoSurfaceFormat format(frame.size, pixelFormat, QAbstractVideoBuffer::NoHandle);
+    format.setFrameRate(m_cameraControl->frameRate());
+    m_format = format;
+    if (pixelFormat == QVideoFrame::Format_Invalid || !m_surface->isFormatSupported(format)) {
+        emit error(QStringLiteral("Video surface does not support %1x%2 frames of format %3")
+                   .arg(frame.size.width()).arg(frame.size.height()).arg(pixelFormat));
+        return;
+    }
+    if (!m_surface->start(format))
+        emit error(QStringLiteral("Cannot start the video surface: %1").arg(m_surface->error()));
+}
+
+void IMX6CameraVideoSource::stopSurface()
+{
+    if (m_surface && m_surface->isActive())
+        m_surface->stop();
+    m_format = QVideoSurfaceFormat();
+}
@@ -0,0 +1,101 @@
+/****************************************************************************
+**
+** Copyright (C) 2015 Intopalo Oy
+** Contact: http://www.qt-project.org/legal
+**
+** $QT_BEGIN_LICENSE:LGPL21$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and Digia. For licensing terms and
+** conditions see http://qt.digia.com/licensing. For further information
+** use the contact form at http://qt.digia.com/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 2.1 or version 3 as published by the Free
+** Software Foundation and appearing in the file LICENSE.LGPLv21 and
+** LICENSE.LGPLv3 included in the packaging of this file. Please review the
+** following information to ensure the GNU Lesser General Public License
+** requirements will be met: https://www.gnu.org/licenses/lgpl.html and
+** http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.
+**
+** In addition, as a special exception, Digia gives you certain additional
+** rights. These rights are described in the Digia Qt LGPL Exception
+** version 1.1, included in the file LGPL_EXCEPTION.txt in this package.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+#ifndef IMX6CAMERAVIDEOSOURCE_H
+#define IMX6CAMERAVIDEOSOURCE_H
+
+#include <QAbstractPlanarVideoBuffer>
+#include <QAbstractVideoSurface>
+#include <QPointer>
+#include <QVideoSurfaceFormat>
+#include "imx6cameracontrol.h"
+
+// The mapped capture buffer of a frame, for QVideoFrame. Holding the frame keeps
+// the buffer away from the driver until Qt Multimedia lets go of the video frame.
+class IMX6CameraVideoBuffer : public QAbstractPlanarVideoBuffer
+{
+public:
+    explicit IMX6CameraVideoBuffer(const IMX6CameraFrame &frame);
+
+    MapMode mapMode() const;
+    int map(MapMode mode, int *numBytes, int bytesPerLine[4], uchar *data[4]);
+    void unmap();
+
+    static QVideoFrame::PixelFormat pixelFormat(IMX6CameraFrame::PixelFormat format);
+
+private:
+    IMX6CameraFrame mFrame;
+    MapMode mMapMode;
+};
+
+// Presents the camera stream to a QAbstractVideoSurface, e.g. the one of a QML
+// VideoOutput that has this as its source. Frames are not copied.
+class IMX6CameraVideoSource : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(QAbstractVideoSurface *videoSurface READ videoSurface WRITE setVideoSurface NOTIFY videoSurfaceChanged)
+    Q_PROPERTY(int rejectedFrames READ rejectedFrames NOTIFY rejectedFramesChanged)
+
+public:
+    explicit IMX6CameraVideoSource(QObject *parent = 0);
+    ~IMX6CameraVideoSource();
+
+    bool active() const;
+    QAbstractVideoSurface *videoSurface() const;
+    int rejectedFrames() const;
+
+public Q_SLOTS:
+    void setActive(bool value);
+    void setVideoSurface(QAbstractVideoSurface *surface);
+
+Q_SIGNALS:
+    void activeChanged(bool);
+    void videoSurfaceChanged();
+    void rejectedFramesChanged(int);
+    void error(const QString &message);
+
+private Q_SLOTS:
+    void presentFrame(const IMX6CameraFrame &frame);
+
+private:
+    void startSurface(const IMX6CameraFrame &frame);
+    void stopSurface();
+
+    IMX6CameraControl *m_cameraControl;
+    int m_sessionId;
+    bool m_active;
+    QPointer<QAbstractVideoSurface> m_surface;
+    QVideoSurfaceFormat m_format;
+    int m_rejectedFrames;
+};
+
+#endif // IMX6CAMERAVIDEOSOURCE_H